@@ -0,0 +1,81 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_ 1
+
+// Shared by the benchmarks: synthetic V1724 data, an allocation counter and
+// the output format. Include it only from the file with main, it replaces
+// the global operator new.
+#include "Event.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <random>
+
+static atomic<long> s_Allocations(0);
+
+// noinline, or gcc pairs the inlined malloc and free and warns about a mismatch
+__attribute__((noinline)) void* operator new(size_t size) {
+    s_Allocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept {free(p);}
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {free(p);}
+
+/* Appends one board's event, header included, as the board would send it:
+ * ZLE channels have a size word and iSegments good stretches of 100 samples,
+ * full records are iRecordLength samples per channel.
+*/
+static void MakeBoard(vector<WORD>& out, int board, bool bZLE, int iSegments, unsigned int iRecordLength, mt19937& gen, unsigned int TTT = 0) {
+    const unsigned int iMask(0xFF), iSegmentWords(50);
+    size_t iStart = out.size();
+    out.resize(iStart + 4);
+    for (int ch = 0; ch < NUM_CH; ch++) {
+        size_t iChannel = out.size();
+        if (bZLE) out.push_back(0);
+        unsigned int iWordsLeft = iRecordLength/2;
+        for (int s = 0; (s < iSegments) && (iWordsLeft > 2*iSegmentWords); s++) {
+            unsigned int iSkip = gen() % ((iRecordLength/2) / (iSegments+1));
+            iSkip = min(iSkip, iWordsLeft - iSegmentWords);
+            if (bZLE && (iSkip > 0)) out.push_back(iSkip);
+            if (bZLE) out.push_back(0x80000000 | iSegmentWords);
+            for (unsigned int i = 0; i < iSegmentWords; i++) out.push_back((iBaselineRef << 16) | iBaselineRef);
+            iWordsLeft -= iSkip + iSegmentWords;
+        }
+        if (bZLE) {
+            if (iWordsLeft > 0) out.push_back(iWordsLeft);
+            out[iChannel] = out.size() - iChannel;
+        } else out.resize(iChannel + iRecordLength/2, (iBaselineRef << 16) | iBaselineRef);
+    }
+    out[iStart] = 0xA0000000 | (out.size() - iStart);
+    out[iStart+1] = (bZLE ? 0x1000000 : 0) | iMask;
+    out[iStart+2] = 0;
+    out[iStart+3] = TTT & 0x7FFFFFFF;
+}
+
+/* Times a benchmark and prints it as one line of JSON:
+ * {"bench": name, <params>, "events_per_s", "gb_per_s", "ns_per_event", "allocs_per_event"}
+ * where params is a list of "key": value pairs without braces.
+*/
+class BenchTimer {
+public:
+    BenchTimer() {Start();}
+    void Start() {
+        m_lAllocations = s_Allocations.load(memory_order_relaxed);
+        m_tStart = chrono::steady_clock::now();
+    }
+    void Report(const string& name, const string& params, long lEvents, double dBytes) {
+        double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - m_tStart).count();
+        long lAllocations = s_Allocations.load(memory_order_relaxed) - m_lAllocations;
+        printf("{\"bench\": \"%s\"%s%s, \"events\": %li, \"events_per_s\": %.6g, \"gb_per_s\": %.6g, \"ns_per_event\": %.6g, \"allocs_per_event\": %.6g}\n",
+               name.c_str(), params.empty() ? "" : ", ", params.c_str(), lEvents, lEvents/dSeconds, dBytes/dSeconds/1e9,
+               dSeconds*1e9/lEvents, (double)lAllocations/lEvents);
+        fflush(stdout);
+    }
+
+private:
+    chrono::steady_clock::time_point m_tStart;
+    long m_lAllocations;
+};
+
+#endif // _BENCH_H_ defined
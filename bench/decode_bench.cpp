@@ -0,0 +1,51 @@
+// Times Event::Decode and PulseFinder over synthetic V1724 bodies, one JSON line each.
+// usage: decode_bench [zle (1/0)] [segments per channel] [record length] [boards]
+#include "bench.h"
+#include "PulseFinder.h"
+
+int main(int argc, char** argv) {
+    bool bZLE = argc > 1 ? atoi(argv[1]) : true;
+    int iSegments = argc > 2 ? atoi(argv[2]) : 4;
+    unsigned int iRecordLength = argc > 3 ? atoi(argv[3]) : 4096;
+    int iBoards = argc > 4 ? atoi(argv[4]) : 1;
+    const int iNumEvents(1024), iPasses(200);
+    mt19937 gen(1);
+    vector<vector<WORD>> vBuffers(iNumEvents);
+    vector<Event> vEvents(iNumEvents);
+    FragmentSet fragments;
+    size_t iBodyBytes(0), iSegmentsFound(0);
+
+    for (int e = 0; e < iNumEvents; e++) {
+        vector<size_t> vOffsets;
+        for (int b = 0; b < iBoards; b++) {
+            vOffsets.push_back(vBuffers[e].size());
+            MakeBoard(vBuffers[e], b, bZLE, iSegments, iRecordLength, gen);
+        }
+        fragments.fragments.clear();
+        for (int b = 0; b < iBoards; b++) {
+            fragments.fragments.push_back(Fragment{vBuffers[e].data() + vOffsets[b], b, 0, BlockRef()});
+            iBodyBytes += ((vBuffers[e][vOffsets[b]] & 0xFFFFFFF) - 4)*sizeof(WORD);
+        }
+        fragments.timestamp = e;
+        fragments.number = e;
+        fragments.incomplete = false;
+        vEvents[e].Add(fragments, e == 0);
+        if (!vEvents[e].Decode()) {
+            cout << "Event " << e << " did not decode\n";
+            return 1;
+        }
+    }
+
+    string sParams = string("\"zle\": ") + (bZLE ? "true" : "false") + ", \"boards\": " + to_string(iBoards)
+                   + ", \"record_length\": " + to_string(iRecordLength) + ", \"segments\": " + to_string(iSegments);
+    BenchTimer timer;
+    for (int p = 0; p < iPasses; p++) for (auto& ev : vEvents) ev.Decode();
+    timer.Report("decode", sParams, (long)iNumEvents*iPasses, (double)iBodyBytes*iPasses);
+    for (auto& ev : vEvents) for (int ch = 0; ch < iBoards*NUM_CH; ch++) iSegmentsFound += ev.Channel(ch).size();
+    if (iSegmentsFound == 0) cout << "No segments found\n";
+    PulseFinder finder(iRecordLength, 40, 200);
+    timer.Start();
+    for (int p = 0; p < iPasses; p++) for (auto& ev : vEvents) finder.Process(ev);
+    timer.Report("pulse_finding", sParams + ", \"avx2\": " + (CpuHasAVX2() ? "true" : "false"), (long)iNumEvents*iPasses, (double)iBodyBytes*iPasses);
+    return 0;
+}
@@ -0,0 +1,195 @@
+// Times the ingestion and write paths on synthetic V1724 data, one JSON line per case:
+// Event::Add and AddView for 1-4 boards, ZLE and full records, building events
+// from readout blocks (EventBuilder, as DAQ::BuildEvents does), Event::Write
+// through the FileWriter, handing slots through the EventRing's stages, and
+// the readout thread polling an emulated board in each readout mode.
+// usage: pipeline_bench [output file, default /dev/null] [record length]
+#include "bench.h"
+#include "EventRing.h"
+#include "BlockPool.h"
+#include "V1724Emulator.h"
+#include <thread>
+
+static const int s_NumEvents(1024);
+
+struct Case {
+    int boards;
+    bool zle;
+    unsigned int record_length;
+    vector<vector<WORD>> buffers; // one per event, every board's data back to back
+    vector<FragmentSet> fragments;
+    size_t body_bytes;
+};
+
+static Case MakeCase(int iBoards, bool bZLE, unsigned int iRecordLength) {
+    Case c{iBoards, bZLE, iRecordLength, vector<vector<WORD>>(s_NumEvents), vector<FragmentSet>(s_NumEvents), 0};
+    mt19937 gen(1);
+    for (int e = 0; e < s_NumEvents; e++) {
+        vector<size_t> vOffsets;
+        for (int b = 0; b < iBoards; b++) {
+            vOffsets.push_back(c.buffers[e].size());
+            MakeBoard(c.buffers[e], b, bZLE, 4, iRecordLength, gen, e);
+        }
+        for (int b = 0; b < iBoards; b++) {
+            c.fragments[e].fragments.push_back(Fragment{c.buffers[e].data() + vOffsets[b], b, e, BlockRef()});
+            c.body_bytes += ((c.buffers[e][vOffsets[b]] & 0xFFFFFFF) - 4)*sizeof(WORD);
+        }
+        c.fragments[e].timestamp = e;
+        c.fragments[e].number = e;
+        c.fragments[e].incomplete = false;
+    }
+    return c;
+}
+
+static string Params(const Case& c) {
+    return "\"boards\": " + to_string(c.boards) + ", \"zle\": " + (c.zle ? "true" : "false");
+}
+
+static void BenchAdd(const Case& c, vector<Event>& vEvents, int iPasses) {
+    string sParams = Params(c); // before the timer, it allocates
+    // warm up first, so only what happens in every event is counted
+    for (int e = 0; e < s_NumEvents; e++) vEvents[e].Add(c.fragments[e]);
+    BenchTimer timer;
+    for (int p = 0; p < iPasses; p++) for (int e = 0; e < s_NumEvents; e++) vEvents[e].Add(c.fragments[e]);
+    timer.Report("event_add", sParams, (long)s_NumEvents*iPasses, (double)c.body_bytes*iPasses);
+    for (int e = 0; e < s_NumEvents; e++) vEvents[e].AddView(c.fragments[e]);
+    timer.Start();
+    for (int p = 0; p < iPasses; p++) for (int e = 0; e < s_NumEvents; e++) vEvents[e].AddView(c.fragments[e]);
+    timer.Report("event_add_view", sParams, (long)s_NumEvents*iPasses, (double)c.body_bytes*iPasses);
+    for (auto& ev : vEvents) ev.Clear();
+}
+
+// readout blocks of iPerBlock events per board, split and matched by the builder
+static void BenchBuild(const Case& c, int iPasses) {
+    const int iPerBlock(64);
+    size_t iBoardBytes(0);
+    vector<vector<WORD>> vBoardData(c.boards);
+    for (int b = 0; b < c.boards; b++) {
+        mt19937 gen(b);
+        for (int e = 0; e < iPerBlock; e++) MakeBoard(vBoardData[b], b, c.zle, 4, c.record_length, gen, 1000*e);
+        iBoardBytes = max(iBoardBytes, vBoardData[b].size()*sizeof(WORD));
+    }
+    BlockPool pool(2*c.boards, [&](unsigned int& size){size = iBoardBytes; return (char*)malloc(size);}, [](char* p){free(p);});
+    EventBuilder builder(c.boards, 100, 1000);
+    FragmentSet fragments;
+    BlockRef block;
+    long lEvents(0);
+    double dBytes(0);
+    string sParams = Params(c);
+    BenchTimer timer;
+    for (int p = 0; p < iPasses*s_NumEvents/iPerBlock; p++) {
+        for (int b = 0; b < c.boards; b++) {
+            block = pool.Acquire();
+            memcpy(block->data, vBoardData[b].data(), vBoardData[b].size()*sizeof(WORD));
+            block->size = vBoardData[b].size()*sizeof(WORD);
+            block->NumEvents = iPerBlock;
+            dBytes += block->size;
+            builder.AddBlock(b, block);
+        }
+        while (builder.Next(fragments, true)) lEvents++;
+        fragments.fragments.clear();
+        builder.Reset(); // the trigger time tags start over in the next block
+    }
+    timer.Report("build_events", sParams, lEvents, dBytes);
+}
+
+static void BenchWrite(const Case& c, vector<Event>& vEvents, const string& sOutput, int iPasses) {
+    FileWriter writer(4 << 20, 4, false);
+    unsigned int iEvNum(0);
+    double dBytes(0);
+    for (int e = 0; e < s_NumEvents; e++) vEvents[e].Add(c.fragments[e]);
+    if (!writer.Open(sOutput)) return;
+    string sParams = Params(c) + ", \"io_uring\": " + (writer.UsesIoUring() ? "true" : "false");
+    BenchTimer timer;
+    for (int p = 0; p < iPasses; p++) for (auto& ev : vEvents) dBytes += ev.Write(writer, iEvNum);
+    writer.Close();
+    timer.Report("event_write", sParams, (long)s_NumEvents*iPasses, dBytes);
+    for (auto& ev : vEvents) ev.Clear();
+}
+
+// empty events through insert, decode and write, each stage on its own thread(s)
+static void BenchRing(int iDecodeThreads, long lBatch, long lEvents) {
+    EventRing ring(1024);
+    atomic<bool> bRun(true);
+    vector<thread> vThreads;
+    long seq(0);
+    string sParams = "\"decode_threads\": " + to_string(iDecodeThreads) + ", \"batch\": " + to_string(lBatch);
+    BenchTimer timer;
+    for (int t = 0; t < iDecodeThreads; t++) vThreads.emplace_back([&] {
+        long s(0), n(0);
+        while (bRun) if (ring.ClaimDecode(s, n, lBatch)) ring.PublishDecode(s, n);
+    });
+    thread writer([&] {
+        long s(0), n(0);
+        for (long i = 0; i < lEvents; ) if (ring.ClaimWrite(s, n, 16*lBatch)) {ring.PublishWrite(s, n); i += n;}
+    });
+    for (long i = 0; i < lEvents; i++) {
+        while (!ring.ClaimInsert(seq)) {}
+        ring.PublishInsert(seq);
+    }
+    writer.join();
+    timer.Report("ring_handoff", sParams, lEvents, 0);
+    bRun = false;
+    ring.Stop();
+    for (auto& th : vThreads) th.join();
+}
+
+// an emulated board triggering at dRate for a second: how much cpu its readout thread
+// takes, and how long after its trigger each event was read
+static void BenchReadout(const string& sMode, double dRate, unsigned int iRecordLength) {
+    V1724Emulator board(EmulatorSettings_t{0, dRate, 0.05, 0});
+    ConfigSettings_t CS{};
+    WaitPoint DataReady;
+    BlockRef block;
+    struct timespec cpu;
+    clockid_t clock;
+    long lEvents(0), lStart(0), lEnd(0);
+    double dLatency(0), dSpacing(1e9/dRate), dNsPerTick(MetricsClock::NsPerTick());
+    CS.RecordLength = iRecordLength;
+    CS.PostTrigger = 60;
+    CS.EnableMask = 0xFF;
+    CS.BlockTransfer = 64;
+    CS.IsZLE = true;
+    board.ProgramDigitizer(CS);
+    board.AllocateBlocks(4);
+    board.SetPolling(ReadoutMode.at(sMode), PollPolicy::s_DefaultMinWaitNs, PollPolicy::s_DefaultMaxWaitNs, 1);
+    board.StartAcquisition();
+    lStart = MetricsClock::Ticks(); // the emulator's triggers are counted from about here
+    board.StartReadout(&DataReady);
+    BenchTimer timer;
+    while ((lEnd = MetricsClock::Ticks()) < lStart + long(1e9/dNsPerTick)) {
+        int iEpoch = DataReady.Prepare();
+        if (!board.PopBlock(block)) {
+            DataReady.Wait(iEpoch, 1000000);
+            continue;
+        }
+        DataReady.Cancel();
+        for (unsigned int e = 0; e < block->NumEvents; e++, lEvents++) dLatency += (block->read_ticks - lStart)*dNsPerTick - lEvents*dSpacing;
+        block.Reset();
+    }
+    pthread_getcpuclockid(board.ReadoutThread(), &clock);
+    clock_gettime(clock, &cpu);
+    board.StopReadout();
+    board.StopAcquisition();
+    timer.Report("readout_poll", "\"mode\": \"" + sMode + "\", \"trigger_rate\": " + to_string((long)dRate) + ", \"readout_cpu\": "
+        + to_string((cpu.tv_sec*1e9 + cpu.tv_nsec) / ((lEnd - lStart)*dNsPerTick)) + ", \"latency_us\": " + to_string(lEvents ? dLatency/lEvents/1e3 : 0), lEvents, 0);
+}
+
+int main(int argc, char** argv) {
+    string sOutput = argc > 1 ? argv[1] : "/dev/null";
+    unsigned int iRecordLength = argc > 2 ? atoi(argv[2]) : 4096;
+    vector<Event> vEvents(s_NumEvents);
+    logging::core::get()->set_logging_enabled(false); // the writer complains that it can't truncate /dev/null
+    for (bool bZLE : {true, false}) {
+        for (int iBoards = 1; iBoards <= 4; iBoards++) {
+            Case c = MakeCase(iBoards, bZLE, iRecordLength);
+            int iPasses = max(2, (int)(200e6 / c.body_bytes)); // about 200 MB of body per case
+            BenchAdd(c, vEvents, iPasses);
+            BenchBuild(c, iPasses);
+            BenchWrite(c, vEvents, sOutput, iPasses);
+        }
+    }
+    for (long lBatch : {1, 16}) for (int iThreads : {1, 2, 4}) BenchRing(iThreads, lBatch, 2000000);
+    for (double dRate : {100., 10000.}) for (auto& mode : ReadoutMode) BenchReadout(mode.first, dRate, iRecordLength);
+    return 0;
+}
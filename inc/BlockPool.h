@@ -0,0 +1,78 @@
+#ifndef _BLOCKPOOL_H_
+#define _BLOCKPOOL_H_ 1
+
+#include "base.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class BlockPool;
+
+/* One block transfer worth of data from one board. */
+struct Block {
+    char* data;
+    unsigned int capacity;
+    unsigned int size;
+    unsigned int NumEvents;
+    long read_ticks; // MetricsClock::Ticks() when the transfer finished
+    atomic<int> refs;
+    BlockPool* pool;
+};
+
+/* Intrusive reference to a Block. The block goes back to its pool when the
+ * last reference is dropped.
+*/
+class BlockRef {
+public:
+    BlockRef() : m_pBlock(nullptr) {}
+    explicit BlockRef(Block* pBlock) : m_pBlock(pBlock) {if (m_pBlock) m_pBlock->refs++;}
+    BlockRef(const BlockRef& rhs) : BlockRef(rhs.m_pBlock) {}
+    BlockRef(BlockRef&& rhs) : m_pBlock(rhs.m_pBlock) {rhs.m_pBlock = nullptr;}
+    ~BlockRef() {Reset();}
+    BlockRef& operator=(BlockRef rhs) {swap(m_pBlock, rhs.m_pBlock); return *this;}
+    Block* operator->() const {return m_pBlock;}
+    Block* get() const {return m_pBlock;}
+    explicit operator bool() const {return m_pBlock != nullptr;}
+    void Reset();
+
+private:
+    Block* m_pBlock;
+};
+
+class BlockPool {
+public:
+    BlockPool(int NumBlocks, function<char*(unsigned int&)> Alloc, function<void(char*)> Free);
+    ~BlockPool();
+    BlockRef Acquire(long lTimeoutMs = 100); // empty ref if nothing came free in time
+    void Release(Block* pBlock);
+    int Free();
+    int Size() const {return m_vBlocks.size();}
+
+private:
+    vector<unique_ptr<Block>> m_vBlocks;
+    vector<Block*> m_vFree;
+    function<void(char*)> m_Free;
+    mutex m_Mutex;
+    condition_variable m_CV;
+};
+
+/* Single producer, single consumer queue of filled blocks, from a board's
+ * readout thread to the event builder. Never holds more than the pool size.
+*/
+class BlockQueue {
+public:
+    BlockQueue(int Capacity);
+    bool Push(BlockRef& block); // producer only
+    bool Pop(BlockRef& block); // consumer only
+    bool IsEmpty() const {return m_lHead.load(memory_order_acquire) == m_lTail.load(memory_order_acquire);}
+    void Clear(); // consumer only
+
+private:
+    vector<BlockRef> m_vSlots;
+    long m_lMask;
+    alignas(64) atomic<long> m_lHead; // next to push
+    alignas(64) atomic<long> m_lTail; // next to pop
+};
+
+#endif // _BLOCKPOOL_H_ defined
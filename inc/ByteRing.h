@@ -0,0 +1,37 @@
+#ifndef _BYTERING_H_
+#define _BYTERING_H_ 1
+
+#include "base.h"
+#include <atomic>
+
+/* Bip buffer: one producer reserves contiguous stretches of bytes, and one
+ * consumer releases them in the order they were reserved. A stretch that
+ * doesn't fit before the end starts over at the beginning and the rest of
+ * the lap is skipped, until the consumer passes it. Positions are counts of
+ * bytes since Reset that only grow, lap = count / capacity. Any stretch up
+ * to the capacity fits once the ring is empty.
+*/
+class ByteRing {
+public:
+    ByteRing() : m_pData(nullptr), m_iCapacity(0), m_bHugePages(false) {Reset();}
+    ~ByteRing() {Free();}
+    void Allocate(size_t Bytes, bool bHugePages); // 0 frees it, only while nothing is reserved
+    char* Reserve(size_t Bytes); // producer; nullptr if there is no room for now
+    bool HasRoom(size_t Bytes) const; // producer, without reserving
+    void Release(const char* p, size_t Bytes); // consumer, each stretch once and in order
+    void Reset(); // forgets every reservation
+    size_t Capacity() const {return m_iCapacity;}
+    size_t Used() const {return m_Head.load(memory_order_relaxed) - m_Tail.load(memory_order_relaxed);}
+
+private:
+    size_t Skip(size_t Head, size_t Bytes) const {return ((Head % m_iCapacity) + Bytes > m_iCapacity) ? m_iCapacity - Head % m_iCapacity : 0;}
+    void Free();
+
+    char* m_pData;
+    size_t m_iCapacity;
+    bool m_bHugePages;
+    atomic<size_t> m_Head; // producer
+    alignas(64) atomic<size_t> m_Tail; // consumer
+};
+
+#endif // _BYTERING_H_ defined
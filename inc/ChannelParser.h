@@ -0,0 +1,40 @@
+#ifndef _CHANNELPARSER_H_
+#define _CHANNELPARSER_H_ 1
+
+#include "base.h"
+
+/* A run of consecutive samples of one channel, pointing into the body. */
+struct Segment {
+    unsigned int start; // sample in the record
+    unsigned int length; // samples
+    const unsigned short* samples; // 14-bit values
+};
+
+struct SegmentRange {
+    const Segment* first;
+    const Segment* last;
+    const Segment* begin() const {return first;}
+    const Segment* end() const {return last;}
+    unsigned int size() const {return last - first;}
+};
+
+/* Splits V1724 channel data into segments, for Event::Decode and the
+ * reader's AstEvent::Decode. The channels follow each other in the order of
+ * the bits set in mask, bit c being channel FirstChannel + c. Full records
+ * share the words equally. With ZLE a channel has a size word (counting
+ * itself), then control words: good ones are followed by their data, the
+ * others give the samples left out. Each channel's segments are appended to
+ * segments between ChannelStart[ch] and ChannelStart[ch+1]; the entries of
+ * channels not in mask are left alone.
+*/
+class ChannelParser {
+public:
+    static bool Parse(const WORD* body, unsigned int words, unsigned int mask, bool IsZLE, int FirstChannel,
+                      vector<Segment>& segments, unsigned int* ChannelStart); // false if the words don't parse
+
+private:
+    static const unsigned int s_ZLELengthMask = (0x1FFFFF);
+    static const unsigned int s_GoodControlWord = (0x80000000);
+};
+
+#endif // _CHANNELPARSER_H_ defined
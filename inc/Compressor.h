@@ -0,0 +1,95 @@
+#ifndef _COMPRESSOR_H_
+#define _COMPRESSOR_H_ 1
+
+#include "base.h"
+#include "FileWriter.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/* Compressed block format, in place of plain events:
+ * word0: bits[31:30] = 0b10, bits [0:29] = number of events in the block
+ * word1: codec the payload was compressed with (0 if stored as is)
+ * word2: payload bytes on disk
+ * word3: payload bytes uncompressed
+ * then the event headers of every event in the block, unchanged, then the
+ * payload: the event bodies, back to back, compressed as one.
+*/
+
+struct BlockInfo {
+    int file_number;
+    long offset; // in the file
+    unsigned int first_event;
+    unsigned int n_events;
+    unsigned int raw_bytes;
+    unsigned int compressed_bytes;
+};
+
+/* Gathers events into blocks of about BlockBytes of body, compresses the
+ * blocks on a pool of worker threads and writes them out in order. Only
+ * the writer thread calls Add*, Flush and NewFile; it blocks only when
+ * every block is still being compressed. Blocks never span events or files.
+*/
+class Compressor {
+public:
+    enum codec_t {
+        codec_none = 0,
+        codec_zstd,
+        codec_lz4,
+    };
+
+    Compressor(FileWriter* pWriter, codec_t Codec, int Level, int NumThreads, unsigned int BlockBytes);
+    ~Compressor();
+    void AddHeader(const char* header, unsigned int HeaderBytes); // starts the next event
+    void AddBody(const char* body, unsigned int BodyBytes);
+    void Flush(); // writes out everything, call before the file changes
+    void NewFile(int FileNumber); // after Flush
+    const vector<BlockInfo>& Blocks() const {return m_vBlocks;}
+    void ClearBlocks() {m_vBlocks.clear(); m_iBlockNumber = 0;}
+    unsigned int BlockNumber() const {return m_iBlockNumber;} // of the block the last event went into
+    unsigned int BodyOffset() const {return m_iBodyOffset;} // of the last event in its block's payload
+    static const map<string, codec_t> Codecs;
+
+private:
+    struct Job {
+        vector<char> headers;
+        vector<char> raw;
+        vector<char> packed; // only ever grows
+        size_t packed_bytes;
+        unsigned int n_events;
+        unsigned int first_event;
+        codec_t codec;
+        bool done;
+    };
+
+    void Seal();
+    void WriteReady(bool bWait);
+    void Work();
+
+    FileWriter* m_pWriter;
+    codec_t m_Codec;
+    int m_iLevel;
+    unsigned int m_iBlockBytes;
+    int m_iFileNumber;
+    long m_lFileOffset;
+    vector<BlockInfo> m_vBlocks;
+    unsigned int m_iBlockNumber;
+    unsigned int m_iBodyOffset;
+
+    vector<unique_ptr<Job>> m_vJobs;
+    vector<Job*> m_vFree;
+    Job* m_pFilling;
+    deque<Job*> m_InFlight; // in file order, writer thread only
+    deque<Job*> m_ToDo;
+    vector<thread> m_vWorkers;
+    bool m_bRun;
+    mutex m_Mutex;
+    condition_variable m_WorkCV;
+    condition_variable m_DoneCV;
+
+    static const unsigned int s_BlockStartIndicator = (0x80000000);
+};
+
+#endif // _COMPRESSOR_H_ defined
@@ -0,0 +1,60 @@
+#ifndef _CONTROLSERVER_H_
+#define _CONTROLSERVER_H_ 1
+
+#include "base.h"
+#include "WaitPoint.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/* Commands for the main thread, from the terminal and from clients of a
+ * Unix socket. A command is one line, a word and what follows it as the
+ * argument ("comment calibration with the LED"), and the answer is one line
+ * too. Post queues a command, wakes the main thread through its WaitPoint
+ * and waits for the answer; the main thread only checks Pending between
+ * builds and carries out what is queued with Serve, so starting, stopping
+ * and the like never race with the data taking. Listen takes clients on a
+ * socket at that path, any number of them on a thread of its own, each
+ * sending as many lines as it likes. After Close every Post is refused.
+*/
+class ControlServer {
+public:
+    using Handler = function<string(const string& command, const string& arg)>;
+
+    ControlServer(WaitPoint* pWake) : m_pWake(pWake), m_aiPending(0), m_bClosed(false), m_iListenFd(-1), m_abListen(false) {}
+    ~ControlServer() {Close();}
+    bool Listen(const string& SocketPath);
+    string Post(const string& line); // any thread but the main one
+    bool Pending() const {return m_aiPending.load(memory_order_acquire) > 0;}
+    void Serve(const Handler& handler); // main thread, everything queued so far
+    void Close();
+
+private:
+    struct Request {
+        string command;
+        string arg;
+        string reply;
+        bool done;
+    };
+
+    void Accept();
+
+    WaitPoint* m_pWake;
+    deque<Request*> m_Requests;
+    mutex m_Mutex;
+    condition_variable m_Answered;
+    atomic<int> m_aiPending;
+    bool m_bClosed;
+
+    int m_iListenFd;
+    string m_sSocketPath;
+    atomic<bool> m_abListen;
+    thread m_ListenThread;
+
+    static const size_t s_MaxLine = (4096);
+};
+
+#endif // _CONTROLSERVER_H_ defined
@@ -2,13 +2,22 @@
 #define _DAQ_H_ 1
 
 #include "Digitizer.h"
+#include "V1724Emulator.h"
 #include "Event.h"
+#include "EventRing.h"
+#include "PulseFinder.h"
+#include "EventFilter.h"
+#include "NoiseCalibration.h"
+#include "EventIndex.h"
+#include "WriteShard.h"
+#include "ControlServer.h"
 #include "kbhit.h"
 
 #include <sqlite3.h>
 
 #include <thread>
 #include <mutex>
+#include <deque>
 
 #include <ctime>
 #include <chrono>
@@ -17,7 +26,8 @@
 #include <cctype>
 #include <chrono>
 
-using file_info = array<unsigned int, 4>;
+using file_info = array<unsigned int, 5>;
+using class_counts = array<long, PulseSummary::num_classes>;
 
 class DAQException : public exception {
 public:
@@ -31,7 +41,7 @@ public:
     DAQ(int BufferSize = 1024);
     ~DAQ();
     void Setup(const string& filename);
-    void Readout();
+    void Readout(bool bTerminal = true); // without the terminal, commands only come through the control socket
     void SetRunComment(const string& in) {m_sRunComment = in;}
 
 private:
@@ -39,22 +49,64 @@ private:
     void StopAcquisition();
     void StartRun();
     void EndRun();
-    void GetNewRunComment();
+    void RollOver(); // main thread, the next event built starts a new run
+    string Command(const string& command, const string& arg); // main thread, returns the answer
+    string Status(); // main thread, as json
+    void Terminal(); // keys and the status line, one client of m_Control among others
+    void StopTerminal();
+    string FileName(int FileNumber); // where it is written
+    string FileName(int FileNumber, const string& Dir);
+    string MakeRunDirectory(); // returns the run name
+    void WriteNoiseThresholds(const string& RunName, const vector<NoiseResult>& vNoise); // pmt_config.json in the run directory
     void DoesNothing() {}; // for creation of threads
 
+    /* Everything pax_info.json and the runs database need about a finished
+     * run, taken by the writer so the next run can go on while it is written.
+    */
+    struct RunSummary {
+        string name;
+        string comment;
+        chrono::high_resolution_clock::time_point start;
+        chrono::high_resolution_clock::time_point end;
+        long first_trigger; // the first event's trigger time in board clock ticks, -1 if the run has none
+        vector<file_info> files;
+        long events;
+        long bytes;
+        long incomplete;
+        long orphans;
+        bool test_run; // not added to the runs database
+        int decode_errors;
+        array<class_counts, EventFilter::num_decisions> classes;
+        vector<BlockInfo> blocks;
+        long noise_events;
+        vector<NoiseResult> noise;
+        DeadTime::Summary deadtime; // between start and end
+    };
+    struct RunStart {
+        string name;
+        chrono::high_resolution_clock::time_point start;
+        long orphans; // of the run before
+        DeadTime::Summary deadtime; // of the run before
+    };
+
     atomic<bool> m_abSaveWaveforms;
     bool m_bTestRun;
     atomic<bool> m_abIsFirstEvent;
     atomic<bool> m_abRun;
     atomic<bool> m_abRunThreads;
-    atomic<bool> m_abSuppressOutput;
+    atomic<bool> m_abTerminal;
+    bool m_bQuit; // main thread
+    long m_lBuiltEvents; // main thread
+    long m_lBuiltBytes; // main thread
     atomic<int> m_aiEventsInCurrentFile;
     atomic<int> m_aiEventsInRun;
+    atomic<int> m_aiDecodeErrors;
 
-    ofstream fout;
+    vector<unique_ptr<WriteShard>> m_vShards; // the first writes to raw_data_dir, which also gets the run's metadata
+    unique_ptr<Compressor> m_Compressor;
     sqlite3* m_RunsDB;
     sqlite3_stmt* m_InsertStmt;
-    string m_sRunComment;
+    string m_sRunComment; // m_RunMutex, like m_bTestRun
     map<string, int> m_BindIndex;
     vector<unique_ptr<Digitizer>> digis;
     vector<thread> m_DecodeThreads;
@@ -63,11 +115,42 @@ private:
     chrono::high_resolution_clock::time_point m_tStart;
     string m_sRunName;
     string m_sRunPath;
-    vector<unsigned int> m_vEventSizes;
-    vector<file_info> m_vFileInfos; // file_number, first_event, last_event, n_events
-    vector<unsigned int> m_vEventSizeCum;
-
-    vector<const char*> buffers;
+    chrono::high_resolution_clock::time_point m_tRunStart; // of the run being written, writer thread
+    vector<file_info> m_vFileInfos; // file_number, first_event, last_event, n_events, shard
+    long m_lIncomplete;
+    deque<RunStart> m_NewRuns; // rollovers the writer hasn't reached yet
+    mutex m_RunMutex;
+    bool m_bTagNextEvent; // main thread
+    bool m_bWarnedOversize; // main thread
+    atomic<bool> m_abRollOverPending;
+    atomic<bool> m_abWriteFailed; // a shard could not open its next file
+    thread m_FinishThread;
+    EventIndex m_Index;
+    // writer thread
+    struct WriteBatch {
+        long first;
+        long count;
+        int shard;
+        long ticket; // the slots can go back once the shard is done with it
+    };
+    int m_iShard; // of the batch being written
+    vector<int> m_vOpenFile; // per shard
+    vector<long> m_vFileOffset; // per shard, bytes written to its current file, before compression
+    vector<vector<struct iovec>> m_vWriteIov; // per shard, what hasn't been handed to it yet
+    unsigned int m_iFileSetEvents; // written to the current files
+    deque<WriteBatch> m_InFlight;
+    long m_lRunBytes;
+    long m_lRunFirstTrigger; // as in RunSummary
+    array<class_counts, EventFilter::num_decisions> m_EventClasses; // by filter decision and PulseSummary::Class
+
+    unique_ptr<EventBuilder> m_Builder;
+    unique_ptr<EventFilter> m_Filter;
+    unique_ptr<NoiseCalibration> m_Calibration;
+    unique_ptr<Metrics> m_Metrics;
+    FragmentSet m_Fragments;
+    WaitPoint m_DataReady;
+    DeadTime m_DeadTime;
+    ThreadPlacement m_Placement;
 
     struct {
         int RecordLength;
@@ -78,6 +161,40 @@ private:
         string RunName;
         vector<ChannelSettings_t> ChannelSettings;
         int PostTrigger;
+        bool ZeroCopy;
+        int ReadoutBlocks;
+        bool DirectIO;
+        bool PackSamples;
+        bool FindPulses;
+        int PulseThreshold;
+        int S2MinWidthNs;
+        bool Filter;
+        int FilterMinChannels;
+        int FilterMinArea;
+        int FilterMinHeight;
+        int FilterPrescale;
+        bool NoiseCalibration;
+        float NoiseZLERateHz;
+        float NoiseTriggerRateHz;
+        int WriteBufferMB;
+        string Compression;
+        int CompressionLevel;
+        int CompressionThreads;
+        int CompressionBlockKB;
+        long BuilderWindowNs;
+        long BuilderTimeoutMs;
+        int MaxEventsPerRun;
+        int MaxRunSeconds;
+        string MetricsSocket;
+        string ControlSocket;
+        string RegisterCacheDir; // empty to reset every board
+        bool HugePages;
+        int EventBufferMB;
+        vector<string> ShardDirs; // raw_data_dir first
+        PollPolicy::mode_t ReadoutMode;
+        int PollMinUs;
+        int PollMaxUs;
+        int IRQEvents;
         vector<GW_t> GWs;
     } config;
 
@@ -86,26 +203,33 @@ private:
         first_event,
         last_event,
         n_events,
+        shard,
     };
 
-    void AddEvents(vector<const char*>& buffer, unsigned int NumEvents);
-    void DecodeEvent();
+    void ProgramDigitizers(vector<ConfigSettings_t>& CS); // the boards of different links at the same time
+    unsigned int BuildEvents(unsigned int& iBytes, bool bFlush = false); // returns events added
+    bool AddEvent(FragmentSet& fragments);
+    void DecodeEvent(int iThread);
     void WriteEvent();
-    void ResetPointers(); // call this while threads aren't active
-
-    atomic<int> m_iInsertPtr;
-    atomic<int> m_iDecodePtr;
-    atomic<int> m_iWritePtr;
-
-    atomic<int> m_iToDecode;
-    atomic<int> m_iToWrite;
-
-    vector<Event> m_vBuffer;
-    const int m_iBufferLength;
-    const int m_iMaxEventsInRun = 1000000;
-    const float m_fMaxFileRunTime = 3600.;
-
-    KBHIT kb;
+    void SaveEvent(long seq); // writer thread, one event of a batch
+    void FlushWrites(); // writer thread
+    void RetireWrites(bool bWait); // writer thread, hands back the slots of finished batches, with bWait at least one
+    void OpenFiles(); // writer thread, the next file on every shard
+    void OpenRun(); // writer side of starting config.RunName
+    RunSummary CloseRun(chrono::high_resolution_clock::time_point tEnd); // writer side of ending it
+    void SwitchRun(); // writer thread, at the event that starts the next run
+    bool WriteRunSummary(RunSummary summary); // pax_info.json and the runs database, logs and returns false if either failed
+
+    EventRing m_Ring;
+    const int m_iWriteBuffers = 4;
+    static const long s_DecodeBatch = (16); // events per claim, small so that decoders share the work
+    static const long s_WriteBatch = (256);
+    static const unsigned int s_MaxInFlight = (4); // write batches per shard
+    static const int s_IdleWaitMs = (100); // for a key or a command
+
+    KBHIT kb; // terminal thread
+    ControlServer m_Control;
+    thread m_TerminalThread;
 };
 
 #endif // _DAQ_H_ defined
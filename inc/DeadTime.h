@@ -0,0 +1,50 @@
+#ifndef _DEADTIME_H_
+#define _DEADTIME_H_ 1
+
+#include "base.h"
+#include <mutex>
+
+/* Intervals in which some part of the pipeline could not take triggers,
+ * by cause. Any thread calls Begin and End around a stall; a cause can be
+ * open more than once (several boards full at once), and a cause's time,
+ * like the total, counts overlapping intervals once. Take returns what was
+ * collected since the last Take and cuts the intervals still open at lNow,
+ * so a run gets exactly the dead time within its own start and end.
+ * Totals keeps counting across Takes, for the metrics.
+ * Times are ns since the epoch, like the run start and end times.
+*/
+class DeadTime {
+public:
+    enum cause_t {
+        ring_full = 0, // the main thread waits for the ring
+        rollover, // a new run directory, or the writer switching runs
+        restart, // the boards are stopped
+        board_full, // a board's event buffer is full
+        num_causes
+    };
+    static const char* Names[num_causes];
+    struct Summary {
+        array<long, num_causes> cause_ns;
+        long dead_ns; // time in which anything was dead, overlaps counted once
+    };
+
+    DeadTime();
+    void Begin(cause_t cause, long lNow = Now());
+    void End(cause_t cause, long lNow = Now()); // ignored if the cause isn't open
+    Summary Take(long lNow);
+    Summary Totals(long lNow = Now());
+    static long Now() {return chrono::high_resolution_clock::now().time_since_epoch().count();}
+
+private:
+    Summary Collect(long lNow, bool bReset);
+
+    mutex m_Mutex;
+    array<int, num_causes> m_Open; // intervals open per cause
+    array<long, num_causes> m_Since; // start of the cause's open stretch, or of the last Take
+    int m_iOpen;
+    long m_lSince;
+    Summary m_Run; // since the last Take, without the open stretches
+    Summary m_Total; // since the start, likewise
+};
+
+#endif // _DEADTIME_H_ defined
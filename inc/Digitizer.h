@@ -2,6 +2,15 @@
 #define _DIGITIZER_H_ 1
 
 #include "base.h"
+#include "BlockPool.h"
+#include "WaitPoint.h"
+#include "Metrics.h"
+#include "DeadTime.h"
+#include "ThreadPlacement.h"
+#include "PollPolicy.h"
+#include "RegisterShadow.h"
+#include <functional>
+#include <thread>
 
 #define THRESHOLD_MASK (0x80003FFF)
 
@@ -12,25 +21,135 @@ public:
     }
 };
 
+/* Readout interface shared by the CAEN board and the software emulator.
+ * ReadBuffer fills a readout buffer with one block transfer worth of V1724
+ * events and returns how many events it holds. ReadBlock does the same into
+ * a block from this board's pool, which stays out of the pool for as long
+ * as anything references it.
+ * Between StartReadout and StopReadout a dedicated thread keeps reading
+ * blocks and queueing them for PopBlock, so the link transfers of different
+ * boards overlap with each other and with event building. While it runs,
+ * the thread is the only one talking to the board, so software triggers go
+ * through RequestSWTrigger. With a DeadTime given, the thread also checks
+ * after every transfer with events, and now and then without, whether the
+ * board's event buffer is full and records how long it stays that way.
+ * With HugePages, AllocateBlocks asks for readout buffers on huge pages,
+ * locked in memory.
+ * SetPolling decides what the thread does when a transfer comes back empty:
+ * read again at once (busy), sleep as long as its PollPolicy says
+ * (adaptive), or have the board raise an interrupt once it holds IRQEvents
+ * events and wait for that, at most MaxWaitNs (interrupt). A board that
+ * can't interrupt is polled adaptively instead. Sleeps end early for
+ * StopReadout and software triggers.
+ * Boards on different links can be programmed at the same time; Link tells
+ * which ones share one, -1 for a board that shares it with none.
+*/
 class Digitizer {
 public:
-    Digitizer();
-    Digitizer(int LinkNumber, int ConetNode, int BaseAddress);
-    ~Digitizer();
+    Digitizer() : m_bRunning(false), m_bHugePages(false), m_Mode(PollPolicy::busy), m_iIRQEvents(1), m_abReadout(false), m_abSWTrigger(false), m_abFailed(false), m_pDataReady(nullptr), m_pDeadTime(nullptr) {}
+    virtual ~Digitizer() {}
+    virtual void ProgramDigitizer(ConfigSettings_t& CS) = 0;
+    virtual void SetRegisterCache(const string& Dir) {} // before ProgramDigitizer
+    virtual int Link() const {return -1;}
+    virtual unsigned int ReadBuffer(char* buffer, unsigned int& BufferSize) = 0;
+    void AllocateBlocks(int NumBlocks, bool HugePages = false); // after ProgramDigitizer
+    BlockRef ReadBlock();
+    void SetPolling(PollPolicy::mode_t Mode, long MinWaitNs, long MaxWaitNs, unsigned int IRQEvents); // before StartReadout
+    void StartReadout(WaitPoint* pDataReady, DeadTime* pDeadTime = nullptr);
+    void StopReadout(); // blocks already read stay queued
+    pthread_t ReadoutThread() {return m_ReadoutThread.native_handle();} // to place it, while it runs
+    bool PopBlock(BlockRef& block) {return m_Queue->Pop(block);}
+    void ClearBlocks() {if (m_Queue) m_Queue->Clear();}
+    void RequestSWTrigger() {m_abSWTrigger = true; m_Wake.Notify();}
+    bool HasFailed() {return m_abFailed;}
+    virtual void StartAcquisition() = 0;
+    virtual void StopAcquisition() = 0;
+    virtual void SWTrigger() = 0;
+    virtual bool IsFull() {return false;} // no more room for events on the board
+    bool IsRunning() {return m_bRunning;}
+
+protected:
+    virtual char* MallocReadoutBuffer(unsigned int& AllocSize) = 0;
+    virtual void FreeReadoutBuffer(char* buffer) = 0;
+    virtual bool EnableInterrupts(unsigned int NumEvents) {return false;} // false if the board can't
+    virtual void DisableInterrupts() {}
+    virtual bool WaitForInterrupt(long lTimeoutNs) {return false;} // false on timeout
+
+    bool m_bRunning;
+    bool m_bHugePages;
+    unique_ptr<BlockPool> m_Pool; // derived classes release this first thing in their destructors
+
+private:
+    void ReadoutLoop();
+    void Idle(PollPolicy::mode_t Mode, long lWaitNs);
+
+    PollPolicy::mode_t m_Mode;
+    PollPolicy m_Poll; // readout thread
+    unsigned int m_iIRQEvents;
+    WaitPoint m_Wake;
+
+    static const long s_TimerSlackNs = (1000);
+    static const long s_FullCheckNs = (100000000); // between IsFull checks without a transfer
+
+    unique_ptr<BlockQueue> m_Queue;
+    thread m_ReadoutThread;
+    atomic<bool> m_abReadout;
+    atomic<bool> m_abSWTrigger;
+    atomic<bool> m_abFailed;
+    WaitPoint* m_pDataReady;
+    DeadTime* m_pDeadTime;
+};
+
+/* With a register cache directory, the board keeps a RegisterShadow of what
+ * it was programmed with there, and the scratch register holds that
+ * shadow's stamp. ProgramDigitizer then only resets the board when the
+ * stamp doesn't match or a register write was dropped from the config, and
+ * otherwise only makes the settings that changed. Once the library has set
+ * anything, what it wrote may overlap the direct register writes, so those
+ * are all made again, reading registers only where needed.
+*/
+class V1724 : public Digitizer {
+public:
+    V1724(int LinkNumber, int ConetNode, int BaseAddress);
+    ~V1724();
     void ProgramDigitizer(ConfigSettings_t& CS); // will need stuff for syncing
-    unsigned int ReadBuffer(unsigned int& BufferSize);
-    const char* GetBuffer() {return buffer;}
+    void SetRegisterCache(const string& Dir);
+    int Link() const {return m_iLink;}
+    unsigned int ReadBuffer(char* buffer, unsigned int& BufferSize);
     void StartAcquisition();
     void StopAcquisition();
     void SWTrigger() {CAEN_DGTZ_SendSWtrigger(m_iHandle);}
-    bool IsRunning() {return m_bRunning;}
+    bool IsFull();
+
+protected:
+    char* MallocReadoutBuffer(unsigned int& AllocSize);
+    void FreeReadoutBuffer(char* buffer);
+    bool EnableInterrupts(unsigned int NumEvents);
+    void DisableInterrupts();
+    bool WaitForInterrupt(long lTimeoutNs);
 
 private:
     CAEN_DGTZ_ErrorCode WriteRegister(GW_t GW, bool bForce = false);
+    bool Warm(const ConfigSettings_t& CS); // if the board still holds the shadow and needs no reset
+    CAEN_DGTZ_ErrorCode Apply(const string& setting, WORD value, const function<CAEN_DGTZ_ErrorCode()>& Set);
+    CAEN_DGTZ_ErrorCode ApplyWrite(const string& setting, const GW_t& GW);
 
     int m_iHandle;
-    bool m_bRunning;
-    char* buffer;
+    int m_iLink;
+    int m_iNode;
+    int m_iBaseAddress;
+
+    RegisterShadow m_Shadow;
+    string m_sShadowPath; // empty for no cache
+    bool m_bReapply; // the library set something, so direct writes are made again
+    int m_iWritten;
+    int m_iUnchanged;
+
+    static const unsigned int s_AcquisitionStatus = (0x8104);
+    static const unsigned int s_EventFull = (0x10);
+    static const uint8_t s_IRQLevel = (1);
+    static const uint32_t s_IRQStatusID = (0xAAAA);
+    static const unsigned int s_Scratch = (0xEF20);
 };
 
 #endif // _DIGITIZER_H_ defined
@@ -2,46 +2,143 @@
 #define _EVENT_H_ 1
 
 #include "base.h"
+#include "EventBuilder.h"
+#include "FileWriter.h"
+#include "Compressor.h"
+#include "SampleCodec.h"
+#include "ChannelParser.h"
 #include <atomic>
 
 #define NUM_CH 8
+#define MAX_BOARDS 4 // the 32-bit channel mask in the event header
 
 /* Event header format:
  * word0: Event number
  * word1: channel mask
- * word2: bit[31] = zle, bits [0:30] = event size (total bytes on disk, header plus body)
+ * word2: bit[31] = zle, bit[30] = incomplete (some board had no fragment), bit[29] = body packed with SampleCodec,
+ *        bit[28] = prescaled (kept although the software filter would drop it),
+ *        bits [0:27] = event size (total bytes on disk, header plus body)
  * word3: timestamp (bits [32:63])
  * word4: timestamp (bits [0:31])
 */
 
+struct BodySpan {
+    const char* data;
+    unsigned int size;
+};
+
+/* What PulseFinder saw in an event. Areas are ADC counts times samples of
+ * the summed waveform, times are the sample of the peak's maximum.
+*/
+struct PulseSummary {
+    enum {class_none = 0, class_s1, class_s2, class_s1_s2, num_classes};
+    unsigned short n_s1;
+    unsigned short n_s2;
+    unsigned int channels_hit; // mask, like the header's
+    float s1_area; // largest S1
+    float s2_area; // largest S2
+    int s1_time; // -1 without an S1
+    int s2_time; // -1 without an S2
+    int max_height; // highest peak of the summed waveform
+    int Class() const {return (n_s1 ? class_s1 : class_none) | (n_s2 ? class_s2 : class_none);}
+};
+
+/* Add copies each fragment's body into the event, into storage of its own
+ * or, given one, into a stretch of StoredBytes(fragments) bytes that the
+ * caller owns (the EventRing's byte ring), where the header goes in front
+ * of the body so that Write takes both in one piece. AddView only keeps
+ * pointers into the readout blocks plus a reference on each block, so the
+ * blocks stay out of their pool until Clear is called after the event is
+ * written. Channels are placed in the mask by each fragment's board.
+ * Decode walks the size and control words of every board body and lists
+ * each channel's segments, in sample order, without touching the samples;
+ * a non-ZLE channel is one segment covering the whole record. Segments
+ * stay valid until Pack or Clear.
+ * The ticks are MetricsClock stamps for the latency metrics: when the
+ * earliest of the event's blocks was read out, when the event went into
+ * the ring and when it was decoded.
+*/
 class Event {
 public:
     Event();
     ~Event();
-    void Add(const vector<WORD*>& headers, const vector<WORD*>& bodies, bool IsFirstEvent = false); // should handle multiple digitizers (up to 32 total channels)
-    void Decode();
-    int Write(ofstream& fout, unsigned int& EvNum);
+    void Add(const FragmentSet& fragments, bool IsFirstEvent = false); // handles multiple digitizers (up to 32 total channels)
+    void Add(const FragmentSet& fragments, char* pStorage, bool IsFirstEvent = false);
+    static unsigned int StoredBytes(const FragmentSet& fragments); // header and body
+    BodySpan TakeStorage() {BodySpan s{m_pStorage, m_iStorageSize}; m_pStorage = nullptr; m_iStorageSize = 0; return s;} // for whoever gave it
+    void AddView(const FragmentSet& fragments, bool IsFirstEvent = false);
+    bool Decode(); // false if a body doesn't parse
+    SegmentRange Channel(int ch) const {return SegmentRange{m_vSegments.data() + m_ChannelStart[ch], m_vSegments.data() + m_ChannelStart[ch+1]};}
+    unsigned int ChannelMask() const {return m_Header[1];}
+    unsigned long Timestamp() const {return ((unsigned long)m_Header[3] << 32) | m_Header[4];}
+    long TriggerTime() const {return m_lTriggerTime;} // of the earliest fragment, in board clock ticks
+    WORD Flags() const {return m_Header[2] & ~s_EventSizeMask;}
+    bool IsIncomplete() const {return m_Header[2] & s_IncompleteFlag;}
+    PulseSummary& Summary() {return m_Summary;}
+    const PulseSummary& Summary() const {return m_Summary;}
+    int FilterDecision() const {return m_iFilterDecision;}
+    void SetFilterDecision(int Decision, bool IsPrescaled);
+    bool StartsRun() const {return m_bStartsRun;}
+    void SetStartsRun(bool StartsRun) {m_bStartsRun = StartsRun;}
+    long ReadoutTicks() const {return m_lReadoutTicks;}
+    long InsertTicks() const {return m_lInsertTicks;}
+    void SetInsertTicks(long lTicks) {m_lInsertTicks = lTicks;}
+    long DecodedTicks() const {return m_lDecodedTicks;}
+    void SetDecodedTicks(long lTicks) {m_lDecodedTicks = lTicks;}
+    void Pack(); // replaces the body with its SampleCodec encoding, one segment per board; in given storage only if it gets smaller
+    int Write(FileWriter& writer, unsigned int& EvNum);
+    int Gather(vector<struct iovec>& vIov, unsigned int& EvNum); // appends what Write would write; valid until Clear
+    int Write(Compressor& compressor, unsigned int& EvNum);
+    void Clear(); // drops the body, any block references and the summary
     static void SetUnixTS(long ts);
 
 private:
+    int MakeHeader(const FragmentSet& fragments, bool IsFirstEvent); // returns body bytes
+    void CopyBodies(const FragmentSet& fragments, char* pBody);
+
+    struct BoardBody {
+        const WORD* body;
+        unsigned int words;
+        int board;
+        unsigned int mask;
+        bool zle;
+    };
+
     array<WORD, 5> m_Header;
+    long m_lTriggerTime;
     vector<char> m_Body;
+    vector<char> m_Packed;
+    char* m_pStorage; // given to Add, until taken back; not touched by Clear
+    unsigned int m_iStorageSize;
+    unsigned int m_iStoredBytes; // of it, in use
+    vector<BodySpan> m_vSpans;
+    vector<BlockRef> m_vBlocks;
+    vector<BoardBody> m_vBoardBodies;
+    vector<Segment> m_vSegments; // grouped by channel
+    array<unsigned int, MAX_BOARDS*NUM_CH+1> m_ChannelStart; // channel ch is [m_ChannelStart[ch], m_ChannelStart[ch+1])
+    PulseSummary m_Summary;
+    int m_iFilterDecision; // an EventFilter::decision_t, keep unless a filter says otherwise
+    bool m_bStartsRun; // the first event of a run that was rolled over to
+    long m_lReadoutTicks;
+    long m_lInsertTicks;
+    long m_lDecodedTicks;
 
-    static int s_TimestampRollovers;
-    static long s_LastTimestamp;
     static long s_FirstEventTimestamp;
-    static int s_FirstEventNumber;
     static atomic<long> s_UnixTSStart;
 
+    static thread_local vector<char> s_vPackScratch;
+
+    static const unsigned int s_HeaderBytes = (5*sizeof(WORD));
+    static const unsigned int s_BoardSizeMask = (0xFFFFFFF);
     static const unsigned int s_EventSizeMask = (0xFFFFFFF);
-    static const unsigned int s_BoardIDMask = (0xF8000000);
     static const unsigned int s_ZLEMask = (0x1000000);
     static const unsigned int s_ChannelMaskMask = (0xFF);
-    static const unsigned int s_CounterMask = (0xFFFFFF);
-    static const unsigned int s_BoardIDShift = (0x18);
-    static const unsigned int s_TimestampOffset = (0x80000000);
     static const unsigned int s_NsPerTriggerClock = (0x14);
     static const unsigned int s_HeaderStartIndicator = (0xC0000000);
+    static const unsigned int s_ZLEFlag = (0x80000000);
+    static const unsigned int s_IncompleteFlag = (0x40000000);
+    static const unsigned int s_PackedFlag = (0x20000000);
+    static const unsigned int s_PrescaledFlag = (0x10000000);
 };
 
 #endif // _EVENT_H_ defined
@@ -0,0 +1,72 @@
+#ifndef _EVENTBUILDER_H_
+#define _EVENTBUILDER_H_ 1
+
+#include "base.h"
+#include "BlockPool.h"
+#include <deque>
+#include <chrono>
+
+/* One board's part of an event, still sitting in its readout block. */
+struct Fragment {
+    WORD* header; // 4-word board header, the body follows it
+    int board; // position in the digitizer list
+    long timestamp; // trigger time tag with rollovers, in clock ticks
+    BlockRef block;
+};
+
+struct FragmentSet {
+    vector<Fragment> fragments; // ordered by board
+    long timestamp; // of the earliest fragment
+    unsigned int number; // event number within the run
+    bool incomplete; // some board had no fragment in the window
+};
+
+/* Matches fragments from all boards by trigger time tag. Each board's
+ * blocks are split into fragments and queued per board, and an event is
+ * built from the earliest fragment plus every other board's next fragment
+ * within the window. A board without a matching fragment is only declared
+ * missing once it has sent something later than the window, or after the
+ * timeout if it has gone quiet, so boards that fall behind by a block are
+ * simply waited for. Incomplete events are still emitted, flagged. A
+ * fragment that comes after its event was built without it (its board
+ * fell behind by more than the timeout) goes out on its own, also flagged,
+ * and counts as an orphan rather than as another incomplete event.
+*/
+class EventBuilder {
+public:
+    EventBuilder(int NumBoards, long lWindowNs, long lTimeoutMs);
+    void AddBlock(int board, BlockRef& block);
+    bool Next(FragmentSet& event, bool bFlush = false); // false if nothing can be built yet
+    void Reset(); // drops everything held, at the start of a run
+    void NewRun(); // restarts the counters but keeps what is queued, for a rollover
+    unsigned long Incomplete() const {return m_lIncomplete;} // events built in time with a board missing
+    unsigned long Orphans() const {return m_lOrphans;} // fragments that missed their event
+    long WindowNs() const {return m_lWindow * s_NsPerTriggerClock;}
+
+private:
+    struct Pending {
+        Fragment fragment;
+        chrono::steady_clock::time_point arrival;
+    };
+    struct BoardState {
+        deque<Pending> queue;
+        unsigned int LastTTT;
+        long rollovers;
+        long latest; // newest timestamp seen from this board, -1 if none
+    };
+
+    vector<BoardState> m_vBoards;
+    long m_lWindow; // clock ticks
+    chrono::milliseconds m_Timeout;
+    unsigned int m_iEventNumber;
+    long m_lLastBuilt; // timestamp of the last event built, -1 if none
+    unsigned long m_lIncomplete;
+    unsigned long m_lOrphans;
+
+    static const unsigned int s_BoardSizeMask = (0xFFFFFFF);
+    static const unsigned int s_TimestampMask = (0x7FFFFFFF);
+    static const long s_TimestampOffset = (0x80000000l);
+    static const unsigned int s_NsPerTriggerClock = (0x14);
+};
+
+#endif // _EVENTBUILDER_H_ defined
@@ -0,0 +1,32 @@
+#ifndef _EVENTFILTER_H_
+#define _EVENTFILTER_H_ 1
+
+#include "Event.h"
+
+/* Software trigger on the pulse finder's summary. An event is kept if
+ * enough channels are hit and its largest peak is big enough, in area
+ * and in height of the summed waveform. Of the events that fail, one in
+ * Prescale is kept anyway and marked as prescaled (0 drops them all).
+ * One filter is shared by all decode threads.
+*/
+class EventFilter {
+public:
+    enum decision_t {
+        keep = 0,
+        prescale,
+        drop,
+        num_decisions
+    };
+
+    EventFilter(int MinChannels, int MinArea, int MinHeight, int Prescale);
+    decision_t Decide(const PulseSummary& summary);
+
+private:
+    int m_iMinChannels;
+    float m_fMinArea;
+    int m_iMinHeight;
+    int m_iPrescale;
+    atomic<long> m_alFailed;
+};
+
+#endif // _EVENTFILTER_H_ defined
@@ -0,0 +1,49 @@
+#ifndef _EVENTINDEX_H_
+#define _EVENTINDEX_H_ 1
+
+#include "base.h"
+#include <cstdint>
+
+/* Index file format, <run>/<run>.idx: one fixed-size little-endian record
+ * per written event, in the order they were written, so event i's record
+ * is at byte 40*i.
+ * offset is where the event header starts in its file; in compressed runs
+ * it is where the event body starts in its block's uncompressed payload,
+ * and block is the block's position in pax_info's "blocks" (0xFFFFFFFF
+ * in uncompressed runs).
+*/
+struct IndexRecord {
+    uint32_t event_number;
+    uint32_t file_number;
+    uint64_t offset;
+    uint64_t timestamp; // ns, as in the header
+    uint32_t size; // bytes of header plus body, as in the header
+    uint32_t channel_mask;
+    uint32_t flags; // the header's zle, incomplete, packed and prescaled bits
+    uint32_t block;
+};
+static_assert(sizeof(IndexRecord) == 40, "index records are 40 bytes on disk");
+
+/* Appends records to the index file in chunks, from the writer thread. */
+class EventIndex {
+public:
+    EventIndex();
+    ~EventIndex();
+    bool Open(const string& name);
+    void Add(const IndexRecord& record);
+    void Close(); // writes out what is buffered
+    long Records() const {return m_lRecords;}
+
+    static const uint32_t s_NoBlock = (0xFFFFFFFF);
+
+private:
+    void Flush();
+
+    ofstream m_File;
+    vector<IndexRecord> m_vBuffer;
+    long m_lRecords;
+
+    static const unsigned int s_BufferRecords = (4096);
+};
+
+#endif // _EVENTINDEX_H_ defined
@@ -0,0 +1,77 @@
+#ifndef _EVENTRING_H_
+#define _EVENTRING_H_ 1
+
+#include "ByteRing.h"
+#include "Event.h"
+#include "WaitPoint.h"
+#include <atomic>
+#include <chrono>
+
+/* Multi-stage ring of events. One producer inserts, any number of decoders
+ * claim slots by CAS on a shared cursor, and one writer releases them in
+ * sequence order once each slot's own sequence number says it has been
+ * decoded. Sequences only grow; the slot is seq & mask. Decoders and the
+ * writer take up to MaxCount consecutive events at once and hand the whole
+ * range on with one publish, so the shared cursors move once per batch.
+ * Claim* block (spin, then yield, then futex) for at most s_MaxWaitNs and
+ * return false on timeout or after Stop(), so callers can check their flags.
+ * Event bodies can live in the ring too: the producer claims their bytes
+ * after the slot, and they go back when the slot is written, so the ring
+ * holds as many events as fit in its bytes rather than a fixed count.
+*/
+class EventRing {
+public:
+    EventRing(int Capacity);
+    Event& operator[](long seq) {return m_vSlots[seq & m_lMask];}
+    int Capacity() const {return m_lMask+1;}
+
+    bool ClaimInsert(long& seq);
+    void PublishInsert(long seq);
+    bool ClaimDecode(long& first, long& count, long MaxCount = 1);
+    void PublishDecode(long first, long count = 1);
+    bool ClaimWrite(long& first, long& count, long MaxCount = 1); // the events after the last ones claimed
+    bool CanClaimWrite() const {return m_vDecoded[m_lWriteClaim & m_lMask].value.load(memory_order_acquire) == m_lWriteClaim;}
+    void PublishWrite(long first, long count = 1); // in the order claimed; also gives back the slots' bytes, if they have some
+
+    void AllocateBytes(size_t Bytes, bool bHugePages) {m_Bytes.Allocate(Bytes, bHugePages);} // only while empty
+    char* ClaimBytes(size_t Bytes); // producer, after ClaimInsert; nullptr on timeout, or if there are none
+    bool HasRoom(size_t Bytes) const {return (Bytes == 0) || m_Bytes.HasRoom(Bytes);}
+    size_t ByteCapacity() const {return m_Bytes.Capacity();}
+    size_t BytesUsed() const {return m_Bytes.Used();}
+
+    bool IsFull() const {return m_Insert.value.load(memory_order_relaxed) - m_Write.value.load(memory_order_acquire) > m_lMask;}
+    bool IsEmpty() const {return m_Write.value.load(memory_order_acquire) == m_Insert.value.load(memory_order_acquire);}
+    long ToDecode() const {return m_Insert.value.load(memory_order_relaxed) - m_Decode.value.load(memory_order_relaxed);}
+    long Occupancy() const {return m_Insert.value.load(memory_order_relaxed) - m_Write.value.load(memory_order_relaxed);}
+    long ToWrite() const {return m_Decode.value.load(memory_order_relaxed) - m_Write.value.load(memory_order_relaxed);}
+
+    void Stop(); // wakes and releases every waiting thread
+    void Reset(); // only while no thread is using the ring, drops all events
+
+private:
+    struct alignas(64) Sequence {
+        atomic<long> value;
+    };
+
+    template<typename Pred> bool WaitFor(WaitPoint& wp, Pred pred);
+
+    vector<Event> m_vSlots;
+    vector<Sequence> m_vDecoded; // per slot, seq of the last event decoded there
+    long m_lMask;
+    ByteRing m_Bytes;
+
+    Sequence m_Insert; // next seq to insert
+    Sequence m_Decode; // next seq to claim for decoding
+    Sequence m_Write; // next seq to write
+    long m_lWriteClaim; // writer only, ahead of m_Write while claimed events are being written
+    alignas(64) atomic<bool> m_abActive;
+
+    WaitPoint m_InsertWait;
+    WaitPoint m_DecodeWait;
+    WaitPoint m_WriteWait;
+
+    static const int s_SpinCount = (256);
+    static const long s_MaxWaitNs = (100000000);
+};
+
+#endif // _EVENTRING_H_ defined
@@ -0,0 +1,98 @@
+#ifndef _FILEWRITER_H_
+#define _FILEWRITER_H_ 1
+
+#include "base.h"
+#include "Metrics.h"
+#include "ThreadPlacement.h"
+#include <future>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+/* Batched writer for .ast files. Events are gathered into large aligned
+ * buffers and each full buffer is handed to the kernel through io_uring,
+ * so the writer thread only blocks when every buffer is still in flight.
+ * With Direct the files are opened O_DIRECT and bypass the page cache; the
+ * last buffer of a file is padded to the block size and truncated back when
+ * the file is finished. Without io_uring (old kernel, seccomp) the buffers
+ * go out with pwrite instead, as does a buffer io_uring refuses.
+ * While no file is open, after an Open that failed, writes are dropped and
+ * counted rather than buffered.
+ * PrepareNext opens and preallocates the next file in the background, so a
+ * rollover in Open only swaps descriptors.
+ * With HugePages the buffers are on huge pages and locked in memory.
+ * With a latency histogram set, every buffer's submit to completion time
+ * goes into it.
+*/
+class FileWriter {
+public:
+    FileWriter(unsigned int BufferBytes, int NumBuffers, bool bDirect, bool bHugePages = false);
+    ~FileWriter();
+    bool Open(const string& filename); // finishes the current file in the background
+    void PrepareNext(const string& filename);
+    void Write(const char* data, size_t size);
+    void Write(const struct iovec* iov, int iovcnt); // gathers them into the buffers in one go
+    void Close(); // waits for every write, drops an unused prepared file
+    bool IsOpen() const {return m_pFile != nullptr;}
+    bool UsesIoUring() const {return m_iRingFd >= 0;}
+    void SetLatencyHistogram(LatencyHistogram* pHistogram) {m_pLatency = pHistogram;}
+
+private:
+    struct File {
+        int fd;
+        long offset; // where the next buffer goes
+        long size; // bytes of real data
+        int inflight;
+        bool closing;
+    };
+    struct Buffer {
+        char* data;
+        unsigned int size;
+        bool busy;
+        long offset;
+        long submit_ticks;
+        shared_ptr<File> file;
+        struct iovec iov;
+    };
+
+    int OpenFile(const string& filename, long lPreallocate);
+    void Submit();
+    void Complete(int iBuffer, int res);
+    void Reap(bool bWait);
+    void Finish(File& file);
+    void DiscardNext();
+    bool SetupRing(unsigned int Entries);
+    void TeardownRing();
+
+    vector<Buffer> m_vBuffers;
+    unsigned int m_iBufferBytes;
+    int m_iCurrent;
+    bool m_bDirect;
+    bool m_bHugePages;
+    shared_ptr<File> m_pFile;
+    long m_lLastFileSize;
+    long m_lDropped;
+    future<int> m_NextFd;
+    string m_sNextName;
+    LatencyHistogram* m_pLatency;
+
+    int m_iRingFd;
+    bool m_bFixedBuffers;
+    void* m_pSQRing;
+    void* m_pCQRing;
+    size_t m_iSQRingSize;
+    size_t m_iCQRingSize;
+    size_t m_iSQEsSize;
+    struct io_uring_sqe* m_pSQEs;
+    struct io_uring_cqe* m_pCQEs;
+    unsigned int* m_pSQHead;
+    unsigned int* m_pSQTail;
+    unsigned int* m_pSQArray;
+    unsigned int m_iSQMask;
+    unsigned int* m_pCQHead;
+    unsigned int* m_pCQTail;
+    unsigned int m_iCQMask;
+
+    static const unsigned int s_Alignment = (4096);
+};
+
+#endif // _FILEWRITER_H_ defined
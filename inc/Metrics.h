@@ -0,0 +1,128 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_ 1
+
+#include "base.h"
+#include "DeadTime.h"
+#include <atomic>
+#include <thread>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+/* Cheap timestamps for the hot path: the TSC where there is one, in ticks
+ * that NsPerTick converts. Calibrated against steady_clock on first use.
+*/
+class MetricsClock {
+public:
+#ifdef __x86_64__
+    static long Ticks() {return __rdtsc();}
+#else
+    static long Ticks() {return chrono::steady_clock::now().time_since_epoch().count();}
+#endif
+    static double NsPerTick();
+};
+
+/* Latency histogram with HDR-style log-linear buckets: exact below 16 ns,
+ * then 8 buckets per power of two, so any value is within 12.5%. Every
+ * histogram has a single writer, which only does relaxed loads and stores;
+ * the scraper reads whatever is there.
+*/
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void Record(long lTicks) {
+        unsigned long ns = max(lTicks, 0l) * s_dNsPerTick;
+        int i = Bucket(ns);
+        m_Counts[i].store(m_Counts[i].load(memory_order_relaxed) + 1, memory_order_relaxed);
+        m_Sum.store(m_Sum.load(memory_order_relaxed) + ns, memory_order_relaxed);
+    }
+    void AddTo(vector<unsigned long>& vCounts, unsigned long& lSum) const; // for merging shards
+    static int Bucket(unsigned long ns) {
+        if (ns < 16) return ns;
+        int e = 63 - __builtin_clzl(ns);
+        return min(16 + (e-4)*8 + (int)((ns >> (e-3)) & 7), (int)s_Buckets-1);
+    }
+    static unsigned long UpperBound(int i); // largest ns in bucket i
+
+    static const unsigned int s_Buckets = (16 + 8*36); // up to 2^40 ns, about 18 minutes
+
+private:
+    array<atomic<unsigned long>, s_Buckets> m_Counts;
+    atomic<unsigned long> m_Sum; // ns
+
+    static double s_dNsPerTick;
+};
+
+/* Counters and latencies of the whole pipeline, for a Prometheus scraper.
+ * Each thread writes only its own shard, so the hot path is a handful of
+ * relaxed stores; Text adds the shards up. Serve answers every connection
+ * on a Unix socket with the current values as a minimal HTTP response, e.g.
+ * curl --unix-socket <path> http://localhost/metrics
+*/
+class Metrics {
+public:
+    Metrics(int NumBoards, int NumDecodeThreads, int NumWriteShards = 1);
+    ~Metrics();
+    bool Serve(const string& SocketPath);
+    string Text() const;
+    void SetDeadTime(DeadTime* pDeadTime) {m_pDeadTime = pDeadTime;}
+
+    // main thread
+    void BoardBytes(int board, unsigned int bytes) {s_add(m_vBoards[board].bytes, bytes); s_add(m_vBoards[board].blocks, 1);}
+    void Inserted(long lReadoutTicks, long lNow, long lOccupancy);
+    // decode thread iThread
+    void Decoded(int iThread, long lInsertTicks, long lNow) {
+        m_vDecoders[iThread].insert_to_decode.Record(lNow - lInsertTicks);
+        s_add(m_vDecoders[iThread].events, 1);
+    }
+    // writer thread
+    void Written(long lDecodedTicks, long lNow) {
+        m_Writer.decode_to_write.Record(lNow - lDecodedTicks);
+        s_add(m_Writer.events, 1);
+    }
+    void WrittenBytes(int shard, unsigned int bytes) {s_add(m_Writer.bytes, bytes); s_add(m_vShards[shard].bytes, bytes);}
+    // write shard threads
+    LatencyHistogram* FileWriteLatency(int shard) {return &m_vShards[shard].file_write;}
+
+private:
+    struct alignas(64) Board {
+        atomic<unsigned long> bytes{0};
+        atomic<unsigned long> blocks{0};
+    };
+    struct alignas(64) Decoder {
+        atomic<unsigned long> events{0};
+        LatencyHistogram insert_to_decode;
+    };
+    struct alignas(64) Inserter {
+        atomic<unsigned long> events{0};
+        atomic<long> occupancy{0};
+        atomic<long> high_water{0}; // most events ever in the ring
+        LatencyHistogram readout_to_insert;
+    };
+    struct alignas(64) Writer {
+        atomic<unsigned long> events{0};
+        atomic<unsigned long> bytes{0};
+        LatencyHistogram decode_to_write;
+    };
+    struct alignas(64) Shard {
+        atomic<unsigned long> bytes{0};
+        LatencyHistogram file_write;
+    };
+
+    static void s_add(atomic<unsigned long>& counter, unsigned long n) {counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);}
+    void Listen();
+
+    vector<Board> m_vBoards;
+    vector<Decoder> m_vDecoders;
+    Inserter m_Inserter;
+    Writer m_Writer;
+    vector<Shard> m_vShards;
+    DeadTime* m_pDeadTime;
+
+    int m_iListenFd;
+    string m_sSocketPath;
+    atomic<bool> m_abServe;
+    thread m_ListenThread;
+};
+
+#endif // _METRICS_H_ defined
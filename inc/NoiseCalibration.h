@@ -0,0 +1,59 @@
+#ifndef _NOISECALIBRATION_H_
+#define _NOISECALIBRATION_H_ 1
+
+#include "Event.h"
+
+/* Thresholds for one channel from the noise it saw. Thresholds are counts
+ * below iBaselineRef, as in pmt_config.json.
+*/
+struct NoiseResult {
+    int board;
+    int channel;
+    unsigned long samples;
+    float baseline;
+    float rms;
+    vector<float> rate; // Hz of samples at least t counts below iBaselineRef, for t up to s_MaxThreshold
+    int zle_threshold; // -1 if nothing up to s_MaxThreshold is quiet enough
+    int trigger_threshold;
+};
+
+/* ADC histograms of every channel for a noise run, so thresholds can be
+ * set without writing the data first. The decode threads each fill a
+ * NoiseHistogram and hand what they counted to the shared one after every
+ * event with atomic adds, only over the bins the event touched.
+ * A channel's recommended threshold is the lowest one that samples cross
+ * at no more than the given rate.
+*/
+class NoiseCalibration {
+public:
+    NoiseCalibration(float ZLERateHz, float TriggerRateHz);
+    void Add(int ch, unsigned int iFirst, unsigned int iLast, unsigned int* counts); // adds counts[iFirst, iLast) and zeroes them
+    void AddEvent() {m_alEvents++;}
+    long Events() const {return m_alEvents;}
+    vector<NoiseResult> Results() const;
+    void Reset();
+
+    static const unsigned int s_Bins = (1 << 14);
+    static const unsigned int s_MaxThreshold = (256);
+
+private:
+    vector<atomic<unsigned long>> m_vCounts; // ch*s_Bins + adc value
+    atomic<long> m_alEvents;
+    float m_fZLERateHz;
+    float m_fTriggerRateHz;
+
+    static const unsigned int s_NsPerSample = (10);
+};
+
+/* One decode thread's histograms. */
+class NoiseHistogram {
+public:
+    NoiseHistogram(NoiseCalibration* pCalibration);
+    void Fill(const Event& event); // call after Decode
+
+private:
+    NoiseCalibration* m_pCalibration;
+    vector<unsigned int> m_vCounts;
+};
+
+#endif // _NOISECALIBRATION_H_ defined
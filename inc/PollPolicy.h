@@ -0,0 +1,44 @@
+#ifndef _POLLPOLICY_H_
+#define _POLLPOLICY_H_ 1
+
+#include "base.h"
+
+/* How long a readout thread waits after a transfer, so it keeps up with the
+ * board at high rates and costs next to nothing when triggers stop. After a
+ * transfer with events it reads again at once, since more are likely
+ * waiting. After an empty one the wait doubles from MinWaitNs up to
+ * MaxWaitNs, but while events keep arriving at the rate seen so far it
+ * stays under a quarter of their spacing, so they wait on the board about
+ * as long as they take to come in. Once no event has come for twice that
+ * spacing the rate is taken as gone and only MaxWaitNs bounds the wait.
+*/
+class PollPolicy {
+public:
+    enum mode_t {busy = 0, adaptive, interrupt, num_modes};
+
+    PollPolicy(long MinWaitNs = s_DefaultMinWaitNs, long MaxWaitNs = s_DefaultMaxWaitNs);
+    void Reset(); // forgets the rate, at the start of readout
+    long Next(unsigned int NumEvents, long lNow); // ns to wait after a transfer that got NumEvents at lNow
+    double Rate() const {return m_dRate;} // events per second, as last seen
+    long MaxWaitNs() const {return m_lMaxWaitNs;}
+
+    static const long s_DefaultMinWaitNs = (10000);
+    static const long s_DefaultMaxWaitNs = (10000000);
+
+private:
+    long m_lMinWaitNs;
+    long m_lMaxWaitNs;
+    long m_lWaitNs; // the last wait after an empty transfer, 0 after one with events
+    long m_lLastEvents; // when the last events came, -1 before any
+    double m_dRate;
+
+    static constexpr double s_RateWeight = (0.25); // of the newest interval in the rate
+};
+
+const map<string, PollPolicy::mode_t> ReadoutMode {
+    {"busy", PollPolicy::busy},
+    {"adaptive", PollPolicy::adaptive},
+    {"interrupt", PollPolicy::interrupt}
+};
+
+#endif // _POLLPOLICY_H_ defined
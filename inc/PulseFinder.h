@@ -0,0 +1,32 @@
+#ifndef _PULSEFINDER_H_
+#define _PULSEFINDER_H_ 1
+
+#include "Event.h"
+
+/* Online pulse finding on decoded events. Each channel's baseline is the
+ * mean of the first samples of its first segment; the channel is flipped
+ * positive around it and added into a summed waveform, and counts as hit
+ * if it goes over the threshold. Peaks are the regions of the summed
+ * waveform over the threshold (dips shorter than s_MergeGap don't split
+ * them). A peak at least S2MinWidthNs wide at half height is an S2, any
+ * other an S1. The per-sample loops use AVX2 when the cpu has it.
+ * Keeps a scratch waveform, so each decode thread needs its own.
+*/
+class PulseFinder {
+public:
+    PulseFinder(unsigned int RecordLength, int Threshold, int S2MinWidthNs);
+    void Process(Event& event); // fills event.Summary(), call after Decode and before Pack
+
+private:
+    void FindPeaks(unsigned int iFirst, unsigned int iLast, PulseSummary& summary);
+
+    vector<int> m_vSum;
+    int m_iThreshold;
+    unsigned int m_iS2MinWidth; // samples
+
+    static const unsigned int s_BaselineSamples = (32);
+    static const unsigned int s_MergeGap = (10);
+    static const unsigned int s_NsPerSample = (10);
+};
+
+#endif // _PULSEFINDER_H_ defined
@@ -0,0 +1,38 @@
+#ifndef _REGISTERSHADOW_H_
+#define _REGISTERSHADOW_H_ 1
+
+#include "base.h"
+
+/* What a board was last programmed with, so programming it again only
+ * touches what changed. Every setting is kept under a name
+ * ("record_length", "ch3.dc_offset", "write.810c.7f000ff") with the value
+ * asked for. Registers written directly are also kept under their address
+ * with the whole register, so a masked write to a known register needs no
+ * read first. The library's setters change registers of their own, so
+ * after calling one the registers have to be forgotten.
+ * Saved to a file, it outlives the process; the stamp is what the board's
+ * scratch register was set to when it was saved, and tells whether the
+ * board still holds this state or was reset or power cycled since.
+*/
+class RegisterShadow {
+public:
+    RegisterShadow() : m_iStamp(0) {}
+    bool Load(const string& path); // false, and empty, if there is none or it is unreadable
+    bool Save(const string& path) const; // whole or not at all
+    void Clear() {m_Settings.clear(); m_Registers.clear(); m_iStamp = 0;}
+    bool Has(const string& setting, WORD value) const;
+    void Set(const string& setting, WORD value) {m_Settings[setting] = value;}
+    vector<string> Names(const string& prefix) const; // of the settings starting with it
+    bool Known(WORD addr, WORD& value) const;
+    void Write(WORD addr, WORD value) {m_Registers[addr] = value;}
+    void Forget() {m_Registers.clear();}
+    WORD Stamp() const {return m_iStamp;}
+    void SetStamp(WORD stamp) {m_iStamp = stamp;}
+
+private:
+    map<string, WORD> m_Settings;
+    map<WORD, WORD> m_Registers;
+    WORD m_iStamp;
+};
+
+#endif // _REGISTERSHADOW_H_ defined
@@ -0,0 +1,27 @@
+#ifndef _SAMPLECODEC_H_
+#define _SAMPLECODEC_H_ 1
+
+#include "base.h"
+
+/* Lossless packing of V1724 board bodies. Every 16-bit half word is stored
+ * as its zigzagged difference from iBaselineRef, in blocks of 32 that keep
+ * only as many bit planes as the largest value in the block needs. Noise
+ * around the baseline packs into 4 or 5 bits per sample; size and control
+ * words only make their own block wider, so any body round-trips.
+ * One segment per board body:
+ *   u32 raw bytes
+ *   per block of 32 half words: a width byte, then width u32 bit planes
+ *     (plane b holds bit b of all 32 values, value i in bit i)
+ *   the half words that don't fill a block, as they are
+ * Uses AVX2 when the cpu has it, with a scalar version of the same format.
+*/
+class SampleCodec {
+public:
+    static unsigned int MaxEncodedSize(unsigned int RawBytes) {return 4 + RawBytes + RawBytes/64;}
+    static unsigned int Encode(const char* in, unsigned int RawBytes, char* out); // returns bytes written
+    static bool Decode(const char* in, unsigned int InBytes, vector<char>& out); // appends every segment, false if corrupt
+    static bool UsesAVX2(); // the AVX2 version is selected
+    static bool SelectAVX2(bool bWanted); // scalar if false or no AVX2, returns whether AVX2 is used
+};
+
+#endif // _SAMPLECODEC_H_ defined
@@ -0,0 +1,59 @@
+#ifndef _THREADPLACEMENT_H_
+#define _THREADPLACEMENT_H_ 1
+
+#include "base.h"
+#include <pthread.h>
+#include <sched.h>
+
+/* Where each role of thread runs. A role's cpus are a list like "2,4-7",
+ * where an item can also be a NUMA node, "node1"; without one the role is
+ * left to the scheduler. A role can also run SCHED_FIFO at a priority from
+ * 1 to 99. Apply places a thread and logs where it ended up, as read back
+ * from the kernel, so what is reported is what was actually applied. A
+ * thread of a role without cpus gets the cpus the process started with,
+ * not those of the thread that made it.
+*/
+class ThreadPlacement {
+public:
+    enum role_t {
+        readout = 0, // the boards' readout threads
+        build, // the main thread, which builds events
+        decode,
+        write,
+        num_roles
+    };
+    static const char* Names[num_roles];
+
+    ThreadPlacement();
+    bool SetCpus(role_t role, const string& cpus); // false if the list doesn't parse or has no online cpu
+    void SetFifoPriority(role_t role, int Priority) {m_Priority[role] = Priority;} // 0 for the normal scheduler
+    void Apply(pthread_t th, role_t role, const string& name) const;
+    static string Topology(); // online cpus and NUMA nodes of this machine
+
+private:
+    static bool s_parse(const string& list, cpu_set_t& set);
+    static string s_list(const cpu_set_t& set);
+    static string s_read_line(const string& path);
+
+    cpu_set_t m_Default;
+    array<cpu_set_t, num_roles> m_Cpus;
+    array<bool, num_roles> m_bPinned;
+    array<int, num_roles> m_Priority;
+};
+
+/* Memory for the large buffers that are touched all the time: 2 MB pages
+ * if the kernel has some reserved (vm.nr_hugepages), transparent huge pages
+ * where it allows them otherwise, and locked so it never goes to swap.
+ * Lock does the last two for memory that was allocated elsewhere.
+*/
+class HugePages {
+public:
+    static char* Alloc(size_t Bytes); // nullptr if there is no memory at all
+    static void Free(char* p, size_t Bytes);
+    static void Lock(char* p, size_t Bytes);
+    static bool LockAll(); // every page of the process, now and later, if the memlock limit allows it
+
+    static const size_t s_PageBytes = (2 << 20);
+};
+
+#endif // _THREADPLACEMENT_H_ defined
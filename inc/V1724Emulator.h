@@ -0,0 +1,79 @@
+#ifndef _V1724EMULATOR_H_
+#define _V1724EMULATOR_H_ 1
+
+#include "Digitizer.h"
+#include <atomic>
+
+struct EmulatorSettings_t {
+    int BoardID;
+    double TriggerRate; // Hz, 0 means back-to-back acquisition windows
+    double ZLEOccupancy; // fraction of each channel kept in ZLE mode
+    double MissedTriggers; // fraction of triggers this board drops, to exercise the event builder
+};
+
+/* Software stand-in for a V1724. Produces the same block transfer buffers
+ * as CAEN_DGTZ_ReadData (4-word board headers, ZLE control words, 31-bit
+ * trigger time tag) so the rest of the pipeline can run without hardware.
+ * All emulators share one start time, like boards on a daisy chain, so
+ * every board reports the same trigger sequence, less any it was told to miss.
+ * Triggers come on a fixed schedule (TriggerRate), so the interrupt a V1724
+ * raises after a number of events is emulated by sleeping until that many
+ * are due.
+*/
+class V1724Emulator : public Digitizer {
+public:
+    V1724Emulator(const EmulatorSettings_t& ES);
+    ~V1724Emulator();
+    void ProgramDigitizer(ConfigSettings_t& CS);
+    unsigned int ReadBuffer(char* buffer, unsigned int& BufferSize);
+    void StartAcquisition();
+    void StopAcquisition();
+    void SWTrigger();
+
+protected:
+    char* MallocReadoutBuffer(unsigned int& AllocSize);
+    void FreeReadoutBuffer(char* buffer);
+    bool EnableInterrupts(unsigned int NumEvents) {m_iIRQEvents = NumEvents; return true;}
+    bool WaitForInterrupt(long lTimeoutNs);
+
+private:
+    unsigned int FillEvent(WORD* pOut, long lTriggerTime); // returns words written
+    double Spacing() const; // ns between triggers
+    unsigned int FillChannel(WORD* pOut, const vector<float>& vPulse, float fAmplitude);
+    unsigned int Random();
+
+    EmulatorSettings_t m_Settings;
+    unsigned int m_iRecordLength;
+    unsigned int m_iBlockTransfer;
+    unsigned int m_iEnableMask;
+    unsigned int m_iTriggerPosition;
+    bool m_bIsZLE;
+    size_t m_iBufferSize;
+
+    vector<unsigned short> m_vNoise;
+    vector<float> m_vS1Shape;
+    vector<float> m_vS2Shape;
+    long m_lRunStart;
+    long m_lEventsRead;
+    long m_lSWTriggersRead;
+    unsigned int m_iEventCounter;
+    unsigned int m_iIRQEvents;
+    unsigned int m_iRandomState;
+
+    static atomic<bool> s_abRunning;
+    static atomic<long> s_lRunStart;
+    static atomic<long> s_lSWTriggers;
+    static atomic<long> s_lLastSWTriggerTime;
+
+    static const unsigned int s_NsPerSample = (10);
+    static const unsigned int s_NsPerTriggerClock = (0x14); // same clock Event assumes
+    static const unsigned int s_TimestampMask = (0x7FFFFFFF);
+    static const unsigned int s_CounterMask = (0xFFFFFF);
+    static const unsigned int s_HeaderTag = (0xA0000000);
+    static const unsigned int s_BoardIDShift = (27);
+    static const unsigned int s_ZLEFlag = (0x1000000);
+    static const unsigned int s_GoodControlWord = (0x80000000);
+    static const unsigned int s_NoisePoolSize = (1 << 16);
+};
+
+#endif // _V1724EMULATOR_H_ defined
@@ -0,0 +1,23 @@
+#ifndef _WAITPOINT_H_
+#define _WAITPOINT_H_ 1
+
+#include "base.h"
+#include <atomic>
+
+/* Futex-backed wakeup point. Notify costs a fence and a load unless
+ * somebody is actually asleep on it.
+*/
+class WaitPoint {
+public:
+    WaitPoint() : m_aiEpoch(0), m_aiWaiters(0) {}
+    int Prepare(); // call before re-checking the condition
+    void Cancel() {m_aiWaiters--;}
+    void Wait(int iEpoch, long lTimeoutNs);
+    void Notify(bool bForce = false);
+
+private:
+    alignas(64) atomic<int> m_aiEpoch;
+    atomic<int> m_aiWaiters;
+};
+
+#endif // _WAITPOINT_H_ defined
@@ -0,0 +1,61 @@
+#ifndef _WRITESHARD_H_
+#define _WRITESHARD_H_ 1
+
+#include "base.h"
+#include "FileWriter.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/* One output directory of the run, with a FileWriter of its own. The writer
+ * thread queues jobs in the order they have to happen (gathered events,
+ * the switch to another file, closing) and gets a ticket for each. With a
+ * thread, the shard carries them out on it, so several shards fill their
+ * disks at once; without one, every job is done before it is queued. Once
+ * Done(ticket), the events of that job are in the write buffers and the
+ * memory they came from can be reused.
+*/
+class WriteShard {
+public:
+    WriteShard(const string& Dir, unsigned int BufferBytes, int NumBuffers, bool bDirect, bool bHugePages, bool bThreaded);
+    ~WriteShard();
+    const string& Dir() const {return m_sDir;}
+    FileWriter* Writer() {return &m_Writer;} // directly, only while nothing is queued
+    long Open(const string& filename, const string& nextname); // the next file is opened in the background
+    long Write(vector<struct iovec>& vIov); // takes the iovecs, vIov is left empty
+    long Close();
+    bool Done(long ticket) const {return m_alDone.load(memory_order_acquire) >= ticket;}
+    void Wait(long ticket);
+    void Sync() {Wait(m_lQueued);}
+    long Queued() const {return m_lQueued;} // the ticket of the last job
+    bool Failed() {return m_abFailed.exchange(false);} // whether an Open failed since the last call
+
+private:
+    enum job_t {write_job = 0, open_job, close_job};
+    struct Job {
+        job_t type;
+        string name;
+        string next;
+        vector<struct iovec> iov;
+    };
+
+    long Queue(Job&& job);
+    void Execute(Job& job);
+    void Run();
+
+    string m_sDir;
+    FileWriter m_Writer;
+    deque<Job> m_Jobs;
+    mutex m_Mutex;
+    condition_variable m_Work;
+    condition_variable m_Finished;
+    long m_lQueued; // writer thread
+    atomic<long> m_alDone;
+    atomic<bool> m_abFailed;
+    bool m_bStop;
+    thread m_Thread;
+};
+
+#endif // _WRITESHARD_H_ defined
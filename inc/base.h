@@ -26,6 +26,16 @@ const string config_dir("/depot/darkmatter/apps/asterix/obelix/config/");
 
 const int iBaselineRef(16000);
 
+// for the hand vectorized code, which picks its version once at startup
+inline bool CpuHasAVX2() {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
 struct GW_t {
     int board;
     WORD addr;
@@ -75,4 +85,9 @@ const map<string, bool> ZLE {
     {"no", false}
 };
 
+const map<string, bool> YesNo {
+    {"yes", true},
+    {"no", false}
+};
+
 #endif // _BASE_H_ defined
@@ -12,7 +12,7 @@ class KBHIT {
 public:
     KBHIT();
     ~KBHIT();
-    int kbhit();
+    int kbhit(int TimeoutMs = 0);
     void init();
     void deinit();
 
@@ -0,0 +1,315 @@
+#include "AstReader.h"
+#include "SampleCodec.h"
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zstd.h>
+#include <lz4.h>
+
+// compressed block header, see Compressor.h
+static const unsigned int s_BlockEventsMask = (0x3FFFFFFF);
+static const unsigned int s_BlockHeaderBytes = (16);
+
+static inline bool s_is_block(const WORD* pWord) {return (pWord[0] >> 30) == 2;}
+static inline unsigned long s_block_bytes(const WORD* pWord) {
+    return s_BlockHeaderBytes + (pWord[0] & s_BlockEventsMask)*sizeof(AstHeader) + pWord[2];
+}
+
+bool AstEvent::Set(const AstHeader* pHeader, const char* pStored, int FileNumber) {
+    m_pHeader = pHeader;
+    m_pStored = pStored;
+    m_iFileNumber = FileNumber;
+    m_vSpans.clear();
+    m_ChannelStart.fill(0);
+    if (!pHeader->IsPacked()) {
+        m_pBody = pStored;
+        m_iBodyBytes = StoredBytes();
+        return true;
+    }
+    m_Unpacked.clear();
+    try {
+        if (!SampleCodec::Decode(pStored, StoredBytes(), m_Unpacked)) return false;
+    } catch (exception& e) { // a length no real event has, too much to unpack
+        m_Unpacked.clear();
+        return false;
+    }
+    m_pBody = m_Unpacked.data();
+    m_iBodyBytes = m_Unpacked.size();
+    return true;
+}
+
+bool AstEvent::Decode() {
+    // the boards' bodies are back to back in board order, so the channels come in mask order
+    m_vSpans.clear();
+    m_ChannelStart.fill(0);
+    bool bGood = ChannelParser::Parse((const WORD*)m_pBody, m_iBodyBytes/sizeof(WORD), m_pHeader->channel_mask, m_pHeader->IsZLE(), 0,
+                                      m_vSpans, m_ChannelStart.data());
+    // channels without spans start where the next one does
+    for (unsigned ch = 1; ch < m_ChannelStart.size(); ch++) m_ChannelStart[ch] = max(m_ChannelStart[ch], m_ChannelStart[ch-1]);
+    return bGood;
+}
+
+AstFile::AstFile() : m_iFd(-1), m_pData(nullptr), m_iSize(0) {
+    Close();
+}
+
+AstFile::~AstFile() {
+    Close();
+}
+
+bool AstFile::Open(const string& name, int FileNumber) {
+    struct stat st;
+    Close();
+    m_iFd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_iFd < 0) {
+        BOOST_LOG_TRIVIAL(error) << "Could not open " << name << ": " << strerror(errno);
+        return false;
+    }
+    if (fstat(m_iFd, &st) != 0) return false;
+    m_iSize = st.st_size;
+    m_iFileNumber = FileNumber;
+    if (m_iSize == 0) return true;
+    void* pMap = mmap(nullptr, m_iSize, PROT_READ, MAP_PRIVATE, m_iFd, 0);
+    if (pMap == MAP_FAILED) {
+        BOOST_LOG_TRIVIAL(error) << "Could not map " << name << ": " << strerror(errno);
+        m_iSize = 0;
+        return false;
+    }
+    madvise(pMap, m_iSize, MADV_SEQUENTIAL);
+    m_pData = (const char*)pMap;
+    return true;
+}
+
+void AstFile::Close() {
+    if (m_pData) munmap((void*)m_pData, m_iSize);
+    if (m_iFd >= 0) close(m_iFd);
+    m_iFd = -1;
+    m_pData = nullptr;
+    m_iSize = 0;
+    m_iFileNumber = 0;
+    m_lPos = 0;
+    m_bCorrupt = false;
+    m_lBlockOffset = -1;
+    m_pBlockHeaders = nullptr;
+    m_iBlockEvents = m_iBlockNext = 0;
+    m_lBodyPos = 0;
+    m_pPayload = nullptr;
+    m_lPayloadBytes = 0;
+}
+
+bool AstFile::LoadBlock(unsigned long offset) {
+    const WORD* pWord((const WORD*)(m_pData + offset));
+    unsigned int iEvents(0), iCodec(0), iDiskBytes(0), iRawBytes(0);
+    unsigned long lHeaders(0);
+    size_t ret(0);
+    if (offset + s_BlockHeaderBytes > m_iSize) return false;
+    iEvents = pWord[0] & s_BlockEventsMask;
+    iCodec = pWord[1];
+    iDiskBytes = pWord[2];
+    iRawBytes = pWord[3];
+    lHeaders = offset + s_BlockHeaderBytes;
+    if (lHeaders + iEvents*sizeof(AstHeader) + iDiskBytes > m_iSize) return false;
+    m_pBlockHeaders = (const AstHeader*)(m_pData + lHeaders);
+    m_iBlockEvents = iEvents;
+    m_iBlockNext = 0;
+    m_lBodyPos = 0;
+    m_lBlockOffset = offset;
+    m_lPayloadBytes = iRawBytes;
+    const char* pPayload = m_pData + lHeaders + iEvents*sizeof(AstHeader);
+    if (iCodec == 0) { // stored as is
+        m_pPayload = pPayload;
+        return iDiskBytes == iRawBytes;
+    }
+    if (m_Block.size() < iRawBytes) m_Block.resize(iRawBytes);
+    if (iCodec == 1) {
+        ret = ZSTD_decompress(m_Block.data(), iRawBytes, pPayload, iDiskBytes);
+        if (ZSTD_isError(ret) || (ret != iRawBytes)) return false;
+    } else if (iCodec == 2) {
+        if (LZ4_decompress_safe(pPayload, m_Block.data(), iDiskBytes, iRawBytes) != (int)iRawBytes) return false;
+    } else return false;
+    m_pPayload = m_Block.data();
+    return true;
+}
+
+bool AstFile::Next(AstEvent& event) {
+    const AstHeader* pHeader(nullptr);
+    while (true) {
+        if (m_iBlockNext < m_iBlockEvents) {
+            pHeader = m_pBlockHeaders + m_iBlockNext++;
+            if (pHeader->Size() < sizeof(AstHeader)) break;
+            if (m_lBodyPos + pHeader->Size() - sizeof(AstHeader) > m_lPayloadBytes) break;
+            const char* pBody = m_pPayload + m_lBodyPos;
+            m_lBodyPos += pHeader->Size() - sizeof(AstHeader);
+            if (!event.Set(pHeader, pBody, m_iFileNumber)) break;
+            return true;
+        }
+        if (m_lPos + sizeof(WORD) > m_iSize) return false;
+        if (s_is_block((const WORD*)(m_pData + m_lPos))) {
+            if (!LoadBlock(m_lPos)) break;
+            m_lPos += s_block_bytes((const WORD*)(m_pData + m_lPos));
+            continue;
+        }
+        if (!ReadAt(m_lPos, event)) break;
+        m_lPos += event.Header().Size();
+        return true;
+    }
+    BOOST_LOG_TRIVIAL(error) << "Corrupt event or block near byte " << m_lPos << " of file " << m_iFileNumber;
+    m_bCorrupt = true;
+    m_lPos = m_iSize;
+    m_iBlockEvents = 0;
+    return false;
+}
+
+bool AstFile::ReadAt(unsigned long offset, AstEvent& event) {
+    const AstHeader* pHeader((const AstHeader*)(m_pData + offset));
+    if (offset + sizeof(AstHeader) > m_iSize) return false;
+    if ((pHeader->word0 >> 30) != 3) return false;
+    if ((pHeader->Size() < sizeof(AstHeader)) || (offset + pHeader->Size() > m_iSize)) return false;
+    return event.Set(pHeader, m_pData + offset + sizeof(AstHeader), m_iFileNumber);
+}
+
+bool AstFile::ReadInBlock(unsigned long BlockOffset, unsigned int EventNumber, AstEvent& event) {
+    unsigned long lBody(0);
+    if (((long)BlockOffset != m_lBlockOffset) && !LoadBlock(BlockOffset)) {
+        m_lBlockOffset = -1;
+        m_iBlockEvents = 0;
+        return false;
+    }
+    for (unsigned int i = 0; i < m_iBlockEvents; i++) {
+        if ((m_pBlockHeaders[i].Size() < sizeof(AstHeader)) || (lBody + m_pBlockHeaders[i].Size() - sizeof(AstHeader) > m_lPayloadBytes)) return false;
+        if (m_pBlockHeaders[i].Number() == EventNumber) return event.Set(m_pBlockHeaders + i, m_pPayload + lBody, m_iFileNumber);
+        lBody += m_pBlockHeaders[i].Size() - sizeof(AstHeader);
+    }
+    return false;
+}
+
+AstReader::AstReader() : m_iFileNumber(-1), m_pIndex(nullptr), m_iIndexBytes(0), m_lRecords(0), m_bInterleaved(false), m_lNextRecord(0) {}
+
+AstReader::~AstReader() {
+    Close();
+}
+
+void AstReader::Close() {
+    if (m_pIndex) munmap((void*)m_pIndex, m_iIndexBytes);
+    m_pIndex = nullptr;
+    m_iIndexBytes = 0;
+    m_lRecords = 0;
+    m_bInterleaved = false;
+    m_lNextRecord = 0;
+    m_File.Close();
+    m_iFileNumber = -1;
+    m_vFiles.clear();
+    m_vMapped.clear();
+    m_vBlocks.clear();
+}
+
+bool AstReader::Open(const string& RunDir) {
+    struct stat st;
+    char sNumber[16];
+    string dir(RunDir);
+    while ((dir.size() > 1) && (dir.back() == '/')) dir.pop_back();
+    string run = dir.substr(dir.find_last_of('/') + 1);
+    Close(); // a reader can go from run to run
+    for (int i = 0; ; i++) {
+        sprintf(sNumber, "_%06i.ast", i);
+        string name = dir + "/" + run + sNumber;
+        if (stat(name.c_str(), &st) != 0) break;
+        m_vFiles.push_back(name);
+    }
+    if (m_vFiles.empty()) {
+        BOOST_LOG_TRIVIAL(error) << "No .ast files in " << dir;
+        return false;
+    }
+    // runs written before the index existed can still be read in order
+    int fd = open((dir + "/" + run + ".idx").c_str(), O_RDONLY | O_CLOEXEC);
+    if ((fd >= 0) && (fstat(fd, &st) == 0) && (st.st_size > 0)) {
+        void* pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMap != MAP_FAILED) {
+            m_pIndex = (const IndexRecord*)pMap;
+            m_iIndexBytes = st.st_size;
+            m_lRecords = st.st_size / sizeof(IndexRecord);
+        }
+    }
+    if (fd >= 0) close(fd);
+    // in a run written to one directory, the file numbers only ever go up
+    for (long r = 1; (r < m_lRecords) && !m_bInterleaved; r++) m_bInterleaved = m_pIndex[r].file_number < m_pIndex[r-1].file_number;
+    if (m_bInterleaved) m_vMapped.resize(m_vFiles.size());
+    return OpenFile(0);
+}
+
+bool AstReader::OpenFile(int FileNumber) {
+    m_iFileNumber = -1;
+    if ((FileNumber < 0) || (FileNumber >= (int)m_vFiles.size())) return false;
+    if (!m_File.Open(m_vFiles[FileNumber], FileNumber)) return false;
+    m_iFileNumber = FileNumber;
+    return true;
+}
+
+bool AstReader::Next(AstEvent& event) {
+    if (m_bInterleaved) return NextInIndex(event);
+    while (m_iFileNumber >= 0) {
+        if (m_File.Next(event)) return true;
+        if (!OpenFile(m_iFileNumber + 1)) return false;
+    }
+    return false;
+}
+
+bool AstReader::NextInIndex(AstEvent& event) {
+    if (m_lNextRecord >= m_lRecords) return false;
+    const IndexRecord& record = m_pIndex[m_lNextRecord];
+    if (record.file_number >= m_vMapped.size()) return false;
+    unique_ptr<AstFile>& file = m_vMapped[record.file_number];
+    if (!file) {
+        file.reset(new AstFile());
+        if (!file->Open(m_vFiles[record.file_number], record.file_number)) return false;
+    }
+    if (!file->ReadAt(record.offset, event)) {
+        BOOST_LOG_TRIVIAL(error) << "Event " << record.event_number << " is not where the index says, in file " << record.file_number;
+        return false;
+    }
+    m_lNextRecord++;
+    return true;
+}
+
+bool AstReader::FindBlocks() {
+    WORD aWords[5];
+    unsigned long lPos(0), lSize(0);
+    struct stat st;
+    m_vBlocks.clear();
+    for (unsigned f = 0; f < m_vFiles.size(); f++) {
+        // only the block and event headers are read, the payloads are skipped
+        int fd = open(m_vFiles[f].c_str(), O_RDONLY | O_CLOEXEC);
+        if ((fd < 0) || (fstat(fd, &st) != 0)) return false;
+        lSize = st.st_size;
+        for (lPos = 0; lPos + sizeof(aWords) <= lSize; ) {
+            if (pread(fd, aWords, sizeof(aWords), lPos) != sizeof(aWords)) break;
+            if (s_is_block(aWords)) {
+                m_vBlocks.push_back(make_pair((int)f, lPos));
+                lPos += s_block_bytes(aWords);
+            } else if ((aWords[2] & 0xFFFFFFF) >= sizeof(AstHeader)) lPos += aWords[2] & 0xFFFFFFF;
+            else break;
+        }
+        close(fd);
+    }
+    return true;
+}
+
+bool AstReader::Find(unsigned int EventNumber, AstEvent& event) {
+    if (!m_pIndex) return false;
+    // records are in the order events were written, so by event number
+    const IndexRecord* pRecord = lower_bound(m_pIndex, m_pIndex + m_lRecords, EventNumber,
+                                             [](const IndexRecord& r, unsigned int n) {return r.event_number < n;});
+    if ((pRecord == m_pIndex + m_lRecords) || (pRecord->event_number != EventNumber)) return false;
+    if (pRecord->block != EventIndex::s_NoBlock) {
+        if (m_vBlocks.empty() && !FindBlocks()) return false;
+        if (pRecord->block >= m_vBlocks.size()) return false;
+        if ((m_iFileNumber != m_vBlocks[pRecord->block].first) && !OpenFile(m_vBlocks[pRecord->block].first)) return false;
+        return m_File.ReadInBlock(m_vBlocks[pRecord->block].second, EventNumber, event);
+    }
+    if ((m_iFileNumber != (int)pRecord->file_number) && !OpenFile(pRecord->file_number)) return false;
+    return m_File.ReadAt(pRecord->offset, event);
+}
@@ -0,0 +1,134 @@
+#ifndef _ASTREADER_H_
+#define _ASTREADER_H_ 1
+
+#include "base.h"
+#include "EventIndex.h"
+#include "ChannelParser.h"
+#include <cstdint>
+
+/* The event header as it is on disk, see Event.h. */
+struct AstHeader {
+    uint32_t word0; // event number | 0xC0000000
+    uint32_t channel_mask;
+    uint32_t word2; // flags and size
+    uint32_t timestamp_high;
+    uint32_t timestamp_low;
+
+    unsigned int Number() const {return word0 & 0x3FFFFFFF;}
+    unsigned int Size() const {return word2 & 0xFFFFFFF;} // header plus body, as stored
+    bool IsZLE() const {return word2 & 0x80000000;}
+    bool IsIncomplete() const {return word2 & 0x40000000;}
+    bool IsPacked() const {return word2 & 0x20000000;}
+    bool IsPrescaled() const {return word2 & 0x10000000;}
+    unsigned long Timestamp() const {return ((unsigned long)timestamp_high << 32) | timestamp_low;}
+};
+static_assert(sizeof(AstHeader) == 20, "event headers are 5 words");
+
+/* Consecutive samples of one channel, as Event::Decode gives them. */
+using SampleSpan = Segment;
+using SpanRange = SegmentRange;
+
+/* One event handed out by AstFile or AstReader. The header and the stored
+ * body point into the mapped file, or into the reader's copy of the
+ * decompressed block for compressed runs. Body() is the V1724 body with
+ * the board headers stripped, unpacked first if the event is packed.
+ * Everything stays valid until the reader moves on.
+*/
+class AstEvent {
+public:
+    const AstHeader& Header() const {return *m_pHeader;}
+    const char* Stored() const {return m_pStored;} // the body as it is on disk (before compression)
+    unsigned int StoredBytes() const {return m_pHeader->Size() - sizeof(AstHeader);}
+    const char* Body() const {return m_pBody;}
+    unsigned int BodyBytes() const {return m_iBodyBytes;}
+    int FileNumber() const {return m_iFileNumber;}
+    bool Decode(); // lists every channel's spans, false if the body doesn't parse
+    SpanRange Channel(int ch) const {return SpanRange{m_vSpans.data() + m_ChannelStart[ch], m_vSpans.data() + m_ChannelStart[ch+1]};}
+
+private:
+    friend class AstFile;
+    bool Set(const AstHeader* pHeader, const char* pStored, int FileNumber); // false if a packed body doesn't unpack
+
+    const AstHeader* m_pHeader = nullptr;
+    const char* m_pStored = nullptr;
+    const char* m_pBody = nullptr;
+    unsigned int m_iBodyBytes = 0;
+    int m_iFileNumber = -1;
+    vector<char> m_Unpacked;
+    vector<SampleSpan> m_vSpans; // grouped by channel
+    array<unsigned int, 33> m_ChannelStart{};
+};
+
+/* One .ast file, mapped read-only. Next walks the events in the order they
+ * were written, plain events in place and compressed blocks one at a time.
+*/
+class AstFile {
+public:
+    AstFile();
+    ~AstFile();
+    bool Open(const string& name, int FileNumber = 0);
+    void Close();
+    bool Next(AstEvent& event); // false at the end of the file or if it is corrupt
+    bool ReadAt(unsigned long offset, AstEvent& event); // a plain event at offset
+    bool ReadInBlock(unsigned long BlockOffset, unsigned int EventNumber, AstEvent& event);
+    bool IsCorrupt() const {return m_bCorrupt;}
+    size_t Size() const {return m_iSize;}
+
+private:
+    bool LoadBlock(unsigned long offset); // decompresses the block at offset into m_Block
+
+    int m_iFd;
+    const char* m_pData;
+    size_t m_iSize;
+    int m_iFileNumber;
+    unsigned long m_lPos; // next thing to read
+    bool m_bCorrupt;
+
+    // the block being read
+    long m_lBlockOffset; // -1 if none
+    const AstHeader* m_pBlockHeaders;
+    unsigned int m_iBlockEvents;
+    unsigned int m_iBlockNext;
+    unsigned long m_lBodyPos; // in the payload
+    const char* m_pPayload;
+    unsigned long m_lPayloadBytes;
+    vector<char> m_Block;
+};
+
+/* All the files of a run directory, <dir>/<run>_NNNNNN.ast in order, and
+ * the run's index if it has one, for Find. A run written to several
+ * directories has its events spread over files that were filled at the same
+ * time; Next then goes through the index, so the events still come in the
+ * order they were written.
+*/
+class AstReader {
+public:
+    AstReader();
+    ~AstReader();
+    bool Open(const string& RunDir); // false without any .ast file, closes the run that was open
+    void Close();
+    bool Next(AstEvent& event);
+    bool Find(unsigned int EventNumber, AstEvent& event); // through the index
+    const vector<string>& Files() const {return m_vFiles;}
+    bool HasIndex() const {return m_pIndex != nullptr;}
+    bool IsInterleaved() const {return m_bInterleaved;}
+    long Records() const {return m_lRecords;}
+
+private:
+    bool OpenFile(int FileNumber);
+    bool FindBlocks(); // block offsets, in the order of pax_info's table
+    bool NextInIndex(AstEvent& event);
+
+    vector<string> m_vFiles;
+    AstFile m_File;
+    int m_iFileNumber; // open in m_File, -1 if none
+    const IndexRecord* m_pIndex;
+    size_t m_iIndexBytes;
+    long m_lRecords;
+    bool m_bInterleaved;
+    long m_lNextRecord; // for NextInIndex
+    vector<unique_ptr<AstFile>> m_vMapped; // for NextInIndex, each file once it is needed
+    vector<pair<int, unsigned long>> m_vBlocks; // file number, offset
+};
+
+#endif // _ASTREADER_H_ defined
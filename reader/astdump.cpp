@@ -0,0 +1,191 @@
+// Looks into the .ast files of runs without going through python.
+// usage: astdump headers <run dir> [first event] [last event]
+//        astdump count <run dir> [<run dir> ...]
+//        astdump find <run dir> <event>
+//        astdump extract <run dir> <first event> <last event> <out.ast>
+// count and extract read the files of a run in parallel, extract only if
+// the run was written to one directory, so that its events stay in order.
+// extract writes the events as plain events, packed ones stay packed.
+#include "AstReader.h"
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cinttypes>
+
+struct FileCount {
+    long events;
+    long incomplete;
+    long packed;
+    long prescaled;
+    long bytes;
+    bool corrupt;
+};
+
+static void Usage() {
+    cerr << "usage: astdump headers <run dir> [first event] [last event]\n"
+         << "       astdump count <run dir> [<run dir> ...]\n"
+         << "       astdump find <run dir> <event>\n"
+         << "       astdump extract <run dir> <first event> <last event> <out.ast>\n";
+}
+
+// calls work(i) for every i in [0, n) on up to one thread per core
+template<typename F>
+static void ForEach(unsigned int n, F work) {
+    atomic<unsigned int> next(0);
+    vector<thread> vThreads(min(n, max(thread::hardware_concurrency(), 1u)));
+    for (auto& th : vThreads) th = thread([&] {
+        for (unsigned int i = next++; i < n; i = next++) work(i);
+    });
+    for (auto& th : vThreads) th.join();
+}
+
+static void PrintHeader(const AstEvent& event) {
+    const AstHeader& h = event.Header();
+    printf("%10u %20lu 0x%08x %9u %3i %s%s%s%s\n", h.Number(), h.Timestamp(), h.channel_mask, h.Size(), event.FileNumber(),
+           h.IsZLE() ? "zle " : "", h.IsIncomplete() ? "incomplete " : "", h.IsPacked() ? "packed " : "", h.IsPrescaled() ? "prescaled" : "");
+}
+
+static int Headers(const string& dir, unsigned int iFirst, unsigned int iLast) {
+    AstReader reader;
+    AstEvent event;
+    if (!reader.Open(dir)) return 1;
+    printf("%10s %20s %10s %9s %3s %s\n", "event", "timestamp_ns", "mask", "bytes", "file", "flags");
+    while (reader.Next(event)) {
+        if (event.Header().Number() < iFirst) continue;
+        if (event.Header().Number() > iLast) break;
+        PrintHeader(event);
+    }
+    return 0;
+}
+
+static int Count(const vector<string>& vDirs) {
+    int ret(0);
+    for (auto& dir : vDirs) {
+        AstReader reader;
+        if (!reader.Open(dir)) {
+            ret = 1;
+            continue;
+        }
+        const vector<string>& vFiles = reader.Files();
+        vector<FileCount> vCounts(vFiles.size(), FileCount{0, 0, 0, 0, 0, false});
+        ForEach(vFiles.size(), [&](unsigned int f) {
+            AstFile file;
+            AstEvent event;
+            FileCount& c = vCounts[f];
+            if (!file.Open(vFiles[f], f)) {
+                c.corrupt = true;
+                return;
+            }
+            c.bytes = file.Size();
+            while (file.Next(event)) {
+                c.events++;
+                c.incomplete += event.Header().IsIncomplete();
+                c.packed += event.Header().IsPacked();
+                c.prescaled += event.Header().IsPrescaled();
+            }
+            c.corrupt = file.IsCorrupt();
+        });
+        FileCount total{0, 0, 0, 0, 0, false};
+        for (unsigned f = 0; f < vFiles.size(); f++) {
+            FileCount& c = vCounts[f];
+            printf("%s: %li events, %li bytes%s\n", vFiles[f].c_str(), c.events, c.bytes, c.corrupt ? ", corrupt" : "");
+            total.events += c.events;
+            total.incomplete += c.incomplete;
+            total.packed += c.packed;
+            total.prescaled += c.prescaled;
+            total.bytes += c.bytes;
+            total.corrupt |= c.corrupt;
+        }
+        printf("%s: %li events (%li incomplete, %li packed, %li prescaled) in %zu files, %li bytes",
+               dir.c_str(), total.events, total.incomplete, total.packed, total.prescaled, vFiles.size(), total.bytes);
+        if (reader.HasIndex()) printf(", %li in the index", reader.Records());
+        printf("\n");
+        if (total.corrupt || (reader.HasIndex() && (reader.Records() != total.events))) ret = 1;
+    }
+    return ret;
+}
+
+static int Find(const string& dir, unsigned int iEvent) {
+    AstReader reader;
+    AstEvent event;
+    if (!reader.Open(dir)) return 1;
+    if (!reader.HasIndex()) {
+        cerr << dir << " has no index\n";
+        return 1;
+    }
+    if (!reader.Find(iEvent, event)) {
+        cerr << "Event " << iEvent << " is not in " << dir << "\n";
+        return 1;
+    }
+    PrintHeader(event);
+    if (!event.Decode()) {
+        cerr << "The body of event " << iEvent << " doesn't parse\n";
+        return 1;
+    }
+    for (int ch = 0; ch < 32; ch++) {
+        if (!(event.Header().channel_mask & (1u << ch))) continue;
+        printf("  channel %2i:", ch);
+        for (auto& span : event.Channel(ch)) printf(" [%u, %u)", span.start, span.start + span.length);
+        printf("\n");
+    }
+    return 0;
+}
+
+static void Select(const AstEvent& event, unsigned int iFirst, unsigned int iLast, vector<char>& vSelected) {
+    if ((event.Header().Number() < iFirst) || (event.Header().Number() > iLast)) return;
+    const char* pHeader = (const char*)&event.Header();
+    vSelected.insert(vSelected.end(), pHeader, pHeader + sizeof(AstHeader));
+    vSelected.insert(vSelected.end(), event.Stored(), event.Stored() + event.StoredBytes());
+}
+
+static int Extract(const string& dir, unsigned int iFirst, unsigned int iLast, const string& out) {
+    AstReader reader;
+    if (!reader.Open(dir)) return 1;
+    const vector<string>& vFiles = reader.Files();
+    vector<vector<char>> vSelected(vFiles.size());
+    vector<char> vCorrupt(vFiles.size(), 0);
+    if (reader.IsInterleaved()) {
+        AstEvent event;
+        long lRead(0);
+        for (; reader.Next(event); lRead++) Select(event, iFirst, iLast, vSelected[0]);
+        vCorrupt[0] = lRead < reader.Records();
+    } else ForEach(vFiles.size(), [&](unsigned int f) {
+        AstFile file;
+        AstEvent event;
+        if (!file.Open(vFiles[f], f)) {
+            vCorrupt[f] = 1;
+            return;
+        }
+        while (file.Next(event)) Select(event, iFirst, iLast, vSelected[f]);
+        vCorrupt[f] = file.IsCorrupt();
+    });
+    FILE* pOut = fopen(out.c_str(), "wb");
+    if (!pOut) {
+        cerr << "Could not open " << out << "\n";
+        return 1;
+    }
+    long lBytes(0);
+    for (auto& v : vSelected) {
+        fwrite(v.data(), 1, v.size(), pOut);
+        lBytes += v.size();
+    }
+    fclose(pOut);
+    printf("%li bytes of events %u to %u written to %s\n", lBytes, iFirst, iLast, out.c_str());
+    for (unsigned f = 0; f < vFiles.size(); f++) if (vCorrupt[f]) return 1;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        Usage();
+        return 2;
+    }
+    string command(argv[1]);
+    if (command == "headers") return Headers(argv[2], argc > 3 ? strtoul(argv[3], nullptr, 10) : 0,
+                                             argc > 4 ? strtoul(argv[4], nullptr, 10) : 0xFFFFFFFF);
+    if (command == "count") return Count(vector<string>(argv + 2, argv + argc));
+    if ((command == "find") && (argc == 4)) return Find(argv[2], strtoul(argv[3], nullptr, 10));
+    if ((command == "extract") && (argc == 6)) return Extract(argv[2], strtoul(argv[3], nullptr, 10), strtoul(argv[4], nullptr, 10), argv[5]);
+    Usage();
+    return 2;
+}
@@ -0,0 +1,80 @@
+#include "BlockPool.h"
+#include <chrono>
+
+void BlockRef::Reset() {
+    if (m_pBlock && (--m_pBlock->refs == 0)) m_pBlock->pool->Release(m_pBlock);
+    m_pBlock = nullptr;
+}
+
+BlockPool::BlockPool(int NumBlocks, function<char*(unsigned int&)> Alloc, function<void(char*)> Free) : m_Free(Free) {
+    for (int i = 0; i < NumBlocks; i++) {
+        m_vBlocks.push_back(unique_ptr<Block>(new Block));
+        Block* pBlock = m_vBlocks.back().get();
+        pBlock->capacity = 0;
+        pBlock->data = Alloc(pBlock->capacity);
+        pBlock->size = 0;
+        pBlock->NumEvents = 0;
+        pBlock->read_ticks = 0;
+        pBlock->refs = 0;
+        pBlock->pool = this;
+        m_vFree.push_back(pBlock);
+    }
+}
+
+BlockPool::~BlockPool() {
+    if (Free() != Size()) BOOST_LOG_TRIVIAL(error) << "Readout blocks still in use at shutdown";
+    for (auto& b : m_vBlocks) m_Free(b->data);
+}
+
+BlockRef BlockPool::Acquire(long lTimeoutMs) {
+    unique_lock<mutex> lock(m_Mutex);
+    if (!m_CV.wait_for(lock, chrono::milliseconds(lTimeoutMs), [&]{return !m_vFree.empty();})) return BlockRef();
+    Block* pBlock = m_vFree.back();
+    m_vFree.pop_back();
+    pBlock->size = 0;
+    pBlock->NumEvents = 0;
+    return BlockRef(pBlock);
+}
+
+void BlockPool::Release(Block* pBlock) {
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_vFree.push_back(pBlock);
+    }
+    m_CV.notify_one();
+}
+
+int BlockPool::Free() {
+    lock_guard<mutex> lock(m_Mutex);
+    return m_vFree.size();
+}
+
+BlockQueue::BlockQueue(int Capacity) {
+    long lSize(1);
+    while (lSize < Capacity) lSize <<= 1;
+    m_vSlots.resize(lSize);
+    m_lMask = lSize-1;
+    m_lHead = 0;
+    m_lTail = 0;
+}
+
+bool BlockQueue::Push(BlockRef& block) {
+    long lHead = m_lHead.load(memory_order_relaxed);
+    if (lHead - m_lTail.load(memory_order_acquire) > m_lMask) return false;
+    m_vSlots[lHead & m_lMask] = move(block);
+    m_lHead.store(lHead+1, memory_order_release);
+    return true;
+}
+
+bool BlockQueue::Pop(BlockRef& block) {
+    long lTail = m_lTail.load(memory_order_relaxed);
+    if (lTail == m_lHead.load(memory_order_acquire)) return false;
+    block = move(m_vSlots[lTail & m_lMask]);
+    m_lTail.store(lTail+1, memory_order_release);
+    return true;
+}
+
+void BlockQueue::Clear() {
+    BlockRef block;
+    while (Pop(block)) block.Reset();
+}
@@ -0,0 +1,53 @@
+#include "ByteRing.h"
+#include "ThreadPlacement.h"
+
+void ByteRing::Allocate(size_t Bytes, bool bHugePages) {
+    Free();
+    Reset();
+    if (Bytes == 0) return;
+    Bytes = (Bytes + 63) & ~(size_t)63;
+    m_pData = bHugePages ? HugePages::Alloc(Bytes) : (char*)aligned_alloc(64, Bytes);
+    if (m_pData == nullptr) throw bad_alloc();
+    m_iCapacity = Bytes;
+    m_bHugePages = bHugePages;
+}
+
+void ByteRing::Free() {
+    if (m_pData == nullptr) return;
+    if (m_bHugePages) HugePages::Free(m_pData, m_iCapacity);
+    else free(m_pData);
+    m_pData = nullptr;
+    m_iCapacity = 0;
+}
+
+void ByteRing::Reset() {
+    m_Head.store(0, memory_order_relaxed);
+    m_Tail.store(0, memory_order_relaxed);
+}
+
+bool ByteRing::HasRoom(size_t Bytes) const {
+    size_t iHead = m_Head.load(memory_order_relaxed), iTail = m_Tail.load(memory_order_acquire);
+    if ((Bytes == 0) || (iHead == iTail)) return Bytes <= m_iCapacity;
+    return iHead + Skip(iHead, Bytes) + Bytes - iTail <= m_iCapacity;
+}
+
+char* ByteRing::Reserve(size_t Bytes) {
+    size_t iHead = m_Head.load(memory_order_relaxed), iTail = m_Tail.load(memory_order_acquire), iSkip(0);
+    if ((Bytes == 0) || (Bytes > m_iCapacity)) return nullptr;
+    if ((iHead == iTail) && (Skip(iHead, Bytes) > 0)) {
+        // empty, so the consumer won't touch the tail until this is released: both go to the next lap
+        iHead = iTail = (iHead / m_iCapacity + 1) * m_iCapacity;
+        m_Tail.store(iTail, memory_order_relaxed);
+    }
+    iSkip = Skip(iHead, Bytes);
+    if (iHead + iSkip + Bytes - iTail > m_iCapacity) return nullptr;
+    m_Head.store(iHead + iSkip + Bytes, memory_order_release);
+    return m_pData + (iHead + iSkip) % m_iCapacity;
+}
+
+void ByteRing::Release(const char* p, size_t Bytes) {
+    size_t iTail = m_Tail.load(memory_order_relaxed);
+    // a stretch that isn't where the tail is was moved to the start of the next lap
+    if (p != m_pData + iTail % m_iCapacity) iTail += m_iCapacity - iTail % m_iCapacity;
+    m_Tail.store(iTail + Bytes, memory_order_release);
+}
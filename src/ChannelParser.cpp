@@ -0,0 +1,40 @@
+#include "ChannelParser.h"
+
+bool ChannelParser::Parse(const WORD* body, unsigned int words, unsigned int mask, bool IsZLE, int FirstChannel,
+                          vector<Segment>& segments, unsigned int* ChannelStart) {
+    const WORD* pWord(body);
+    const WORD* pEnd(body + words);
+    const WORD* pChannelEnd(nullptr);
+    unsigned int iChannelWords(0), iSample(0), iLength(0);
+    int iNumChannels = __builtin_popcount(mask), ch(0);
+    if (iNumChannels == 0) return true;
+    if (!IsZLE && (words % iNumChannels != 0)) return false;
+    iChannelWords = words / iNumChannels;
+
+    for (int c = 0; c < 32; c++) {
+        if (!(mask & (1u << c))) continue;
+        ch = FirstChannel + c;
+        ChannelStart[ch] = segments.size();
+        if (!IsZLE) {
+            segments.push_back(Segment{0, 2*iChannelWords, (const unsigned short*)pWord});
+            pWord += iChannelWords;
+        } else {
+            if (pWord >= pEnd) return false;
+            iChannelWords = *pWord & s_ZLELengthMask;
+            pChannelEnd = pWord + iChannelWords;
+            if ((iChannelWords == 0) || (pChannelEnd > pEnd)) return false;
+            iSample = 0;
+            for (pWord++; pWord < pChannelEnd; ) {
+                iLength = *pWord & s_ZLELengthMask;
+                if (*pWord++ & s_GoodControlWord) {
+                    if (pWord + iLength > pChannelEnd) return false;
+                    segments.push_back(Segment{iSample, 2*iLength, (const unsigned short*)pWord});
+                    pWord += iLength;
+                }
+                iSample += 2*iLength;
+            }
+        }
+        ChannelStart[ch+1] = segments.size();
+    }
+    return true;
+}
@@ -0,0 +1,148 @@
+#include "Compressor.h"
+#include <zstd.h>
+#include <lz4.h>
+
+const map<string, Compressor::codec_t> Compressor::Codecs {
+    {"none", Compressor::codec_none},
+    {"zstd", Compressor::codec_zstd},
+    {"lz4", Compressor::codec_lz4}
+};
+
+Compressor::Compressor(FileWriter* pWriter, codec_t Codec, int Level, int NumThreads, unsigned int BlockBytes) :
+    m_pWriter(pWriter), m_Codec(Codec), m_iLevel(Level), m_iBlockBytes(BlockBytes) {
+    m_iFileNumber = 0;
+    m_lFileOffset = 0;
+    m_iBlockNumber = 0;
+    m_iBodyOffset = 0;
+    m_bRun = true;
+    // one block filling, one being written, and one per worker
+    for (int i = 0; i < NumThreads + 2; i++) {
+        m_vJobs.push_back(unique_ptr<Job>(new Job));
+        m_vJobs.back()->raw.reserve(m_iBlockBytes);
+        m_vFree.push_back(m_vJobs.back().get());
+    }
+    m_pFilling = m_vFree.back();
+    m_vFree.pop_back();
+    m_pFilling->n_events = 0;
+    for (int i = 0; i < NumThreads; i++) m_vWorkers.push_back(thread(&Compressor::Work, this));
+}
+
+Compressor::~Compressor() {
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_bRun = false;
+    }
+    m_WorkCV.notify_all();
+    for (auto& th : m_vWorkers) if (th.joinable()) th.join();
+}
+
+void Compressor::AddHeader(const char* header, unsigned int HeaderBytes) {
+    if (m_pFilling->raw.size() >= m_iBlockBytes) Seal();
+    if (m_pFilling->n_events == 0) m_pFilling->first_event = *(const WORD*)header & 0x3FFFFFFF;
+    m_pFilling->headers.insert(m_pFilling->headers.end(), header, header + HeaderBytes);
+    m_pFilling->n_events++;
+    m_iBodyOffset = m_pFilling->raw.size();
+}
+
+void Compressor::AddBody(const char* body, unsigned int BodyBytes) {
+    m_pFilling->raw.insert(m_pFilling->raw.end(), body, body + BodyBytes);
+}
+
+void Compressor::Seal() {
+    if (m_pFilling->n_events == 0) return;
+    m_pFilling->done = false;
+    m_InFlight.push_back(m_pFilling);
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_ToDo.push_back(m_pFilling);
+    }
+    m_WorkCV.notify_one();
+    m_iBlockNumber++;
+    WriteReady(false);
+    while (m_vFree.empty()) WriteReady(true);
+    m_pFilling = m_vFree.back();
+    m_vFree.pop_back();
+    m_pFilling->headers.clear();
+    m_pFilling->raw.clear();
+    m_pFilling->n_events = 0;
+}
+
+void Compressor::WriteReady(bool bWait) {
+    array<WORD, 4> BlockHeader;
+    const char* pPayload(nullptr);
+    while (!m_InFlight.empty()) {
+        Job* pJob = m_InFlight.front();
+        {
+            unique_lock<mutex> lock(m_Mutex);
+            if (!pJob->done && !bWait) return;
+            m_DoneCV.wait(lock, [&]{return pJob->done;});
+        }
+        bWait = false; // the rest only if they happen to be done too
+        pPayload = (pJob->codec == codec_none) ? pJob->raw.data() : pJob->packed.data();
+        BlockHeader[0] = s_BlockStartIndicator | pJob->n_events;
+        BlockHeader[1] = pJob->codec;
+        BlockHeader[2] = pJob->packed_bytes;
+        BlockHeader[3] = pJob->raw.size();
+        m_pWriter->Write((char*)BlockHeader.data(), BlockHeader.size()*sizeof(WORD));
+        m_pWriter->Write(pJob->headers.data(), pJob->headers.size());
+        m_pWriter->Write(pPayload, pJob->packed_bytes);
+        m_vBlocks.push_back(BlockInfo{m_iFileNumber, m_lFileOffset, pJob->first_event, pJob->n_events,
+                                      (unsigned int)pJob->raw.size(), (unsigned int)pJob->packed_bytes});
+        m_lFileOffset += BlockHeader.size()*sizeof(WORD) + pJob->headers.size() + pJob->packed_bytes;
+        m_InFlight.pop_front();
+        m_vFree.push_back(pJob);
+    }
+}
+
+void Compressor::Flush() {
+    Seal();
+    while (!m_InFlight.empty()) WriteReady(true);
+}
+
+void Compressor::NewFile(int FileNumber) {
+    m_iFileNumber = FileNumber;
+    m_lFileOffset = 0;
+}
+
+void Compressor::Work() {
+    ZSTD_CCtx* pContext = (m_Codec == codec_zstd) ? ZSTD_createCCtx() : nullptr;
+    Job* pJob(nullptr);
+    size_t iBound(0), ret(0);
+    while (true) {
+        {
+            unique_lock<mutex> lock(m_Mutex);
+            m_WorkCV.wait(lock, [&]{return !m_ToDo.empty() || !m_bRun;});
+            if (m_ToDo.empty()) break;
+            pJob = m_ToDo.front();
+            m_ToDo.pop_front();
+        }
+        ret = 0;
+        if (m_Codec == codec_zstd) {
+            iBound = ZSTD_compressBound(pJob->raw.size());
+            if (pJob->packed.size() < iBound) pJob->packed.resize(iBound);
+            ret = ZSTD_compressCCtx(pContext, pJob->packed.data(), iBound, pJob->raw.data(), pJob->raw.size(), m_iLevel);
+            if (ZSTD_isError(ret)) {
+                BOOST_LOG_TRIVIAL(error) << "zstd: " << ZSTD_getErrorName(ret);
+                ret = 0;
+            }
+        } else if (m_Codec == codec_lz4) {
+            iBound = LZ4_compressBound(pJob->raw.size());
+            if (pJob->packed.size() < iBound) pJob->packed.resize(iBound);
+            ret = max(LZ4_compress_default(pJob->raw.data(), pJob->packed.data(), pJob->raw.size(), iBound), 0);
+        }
+        // blocks that don't get smaller are stored as they are
+        if ((ret > 0) && (ret < pJob->raw.size())) {
+            pJob->codec = m_Codec;
+            pJob->packed_bytes = ret;
+        } else {
+            pJob->codec = codec_none;
+            pJob->packed_bytes = pJob->raw.size();
+        }
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            pJob->done = true;
+        }
+        m_DoneCV.notify_one();
+    }
+    if (pContext) ZSTD_freeCCtx(pContext);
+}
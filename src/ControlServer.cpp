@@ -0,0 +1,123 @@
+#include "ControlServer.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+bool ControlServer::Listen(const string& SocketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (SocketPath.size() >= sizeof(addr.sun_path)) {
+        BOOST_LOG_TRIVIAL(error) << "Control socket path too long: " << SocketPath;
+        return false;
+    }
+    strcpy(addr.sun_path, SocketPath.c_str());
+    m_iListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(SocketPath.c_str()); // left over from a crash
+    if ((m_iListenFd < 0) || (bind(m_iListenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(m_iListenFd, 4) != 0)) {
+        BOOST_LOG_TRIVIAL(error) << "Could not listen for commands on " << SocketPath << ": " << strerror(errno);
+        if (m_iListenFd >= 0) close(m_iListenFd);
+        m_iListenFd = -1;
+        return false;
+    }
+    m_sSocketPath = SocketPath;
+    m_abListen = true;
+    m_ListenThread = thread(&ControlServer::Accept, this);
+    BOOST_LOG_TRIVIAL(info) << "Listening for commands on " << SocketPath;
+    return true;
+}
+
+string ControlServer::Post(const string& line) {
+    size_t iStart = line.find_first_not_of(" \t"), iEnd = line.find_first_of(" \t", iStart);
+    Request request{"", "", "", false};
+    if (iStart == string::npos) return "error: empty command";
+    request.command = line.substr(iStart, iEnd - iStart);
+    if ((iEnd != string::npos) && ((iStart = line.find_first_not_of(" \t", iEnd)) != string::npos))
+        request.arg = line.substr(iStart, line.find_last_not_of(" \t") + 1 - iStart);
+    unique_lock<mutex> lock(m_Mutex);
+    if (m_bClosed) return "error: shutting down";
+    m_Requests.push_back(&request);
+    m_aiPending.fetch_add(1, memory_order_release);
+    m_pWake->Notify();
+    m_Answered.wait(lock, [&]{return request.done;});
+    return request.reply;
+}
+
+void ControlServer::Serve(const Handler& handler) {
+    unique_lock<mutex> lock(m_Mutex);
+    while (!m_Requests.empty()) {
+        Request* pRequest = m_Requests.front();
+        m_Requests.pop_front();
+        m_aiPending.fetch_sub(1, memory_order_relaxed);
+        lock.unlock();
+        string reply = handler(pRequest->command, pRequest->arg);
+        lock.lock();
+        pRequest->reply = reply;
+        pRequest->done = true;
+        m_Answered.notify_all();
+    }
+}
+
+void ControlServer::Close() {
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_bClosed = true;
+        for (auto pRequest : m_Requests) {
+            pRequest->reply = "error: shutting down";
+            pRequest->done = true;
+        }
+        m_Requests.clear();
+        m_aiPending = 0;
+    }
+    m_Answered.notify_all();
+    m_abListen = false;
+    if (m_ListenThread.joinable()) m_ListenThread.join();
+    if (m_iListenFd >= 0) {
+        close(m_iListenFd);
+        unlink(m_sSocketPath.c_str());
+        m_iListenFd = -1;
+    }
+}
+
+void ControlServer::Accept() {
+    vector<struct pollfd> vFds{{m_iListenFd, POLLIN, 0}};
+    vector<string> vPartial{""}; // what each client sent after its last newline
+    char buffer[1024];
+    while (m_abListen) {
+        if (poll(vFds.data(), vFds.size(), 200) <= 0) continue;
+        for (size_t i = vFds.size(); i-- > 1; ) {
+            if (vFds[i].revents == 0) continue;
+            ssize_t ret = read(vFds[i].fd, buffer, sizeof(buffer));
+            bool bDrop = (ret <= 0);
+            if (ret > 0) vPartial[i].append(buffer, ret);
+            for (size_t iEol; !bDrop && ((iEol = vPartial[i].find('\n')) != string::npos); ) {
+                string line = vPartial[i].substr(0, iEol);
+                vPartial[i].erase(0, iEol + 1);
+                if (!line.empty() && (line.back() == '\r')) line.pop_back();
+                if (line.find_first_not_of(" \t") == string::npos) continue;
+                string reply = Post(line) + "\n";
+                for (size_t iSent = 0; !bDrop && (iSent < reply.size()); ) {
+                    ret = send(vFds[i].fd, reply.data() + iSent, reply.size() - iSent, MSG_NOSIGNAL);
+                    if (ret <= 0) bDrop = true;
+                    else iSent += ret;
+                }
+            }
+            if (vPartial[i].size() > s_MaxLine) bDrop = true;
+            if (!bDrop) continue;
+            close(vFds[i].fd);
+            vFds.erase(vFds.begin() + i);
+            vPartial.erase(vPartial.begin() + i);
+        }
+        if (vFds[0].revents & POLLIN) {
+            int fd = accept4(m_iListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                vFds.push_back({fd, POLLIN, 0});
+                vPartial.push_back("");
+            }
+        }
+    }
+    for (size_t i = 1; i < vFds.size(); i++) close(vFds[i].fd);
+}
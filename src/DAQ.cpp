@@ -4,6 +4,9 @@
 
 #include <sstream>
 #include <iomanip>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
 #include <bsoncxx/json.hpp>
 #include <bsoncxx/document/value.hpp>
 #include <bsoncxx/document/view.hpp>
@@ -19,6 +22,13 @@ static void s_signal_handler(int signal_value) {
     cout << "\nInterrupted!\n";
 }
 
+static double s_get_number(const document::element& el) {
+    // json numbers come out as int32, int64 or double depending on how they were typed
+    if (el.type() == bsoncxx::type::k_double) return el.get_double().value;
+    if (el.type() == bsoncxx::type::k_int64) return el.get_int64().value;
+    return el.get_int32().value;
+}
+
 static void s_catch_signals() {
     struct sigaction action;
     action.sa_handler = s_signal_handler;
@@ -28,7 +38,7 @@ static void s_catch_signals() {
     sigaction(SIGTERM, &action, nullptr);
 }
 
-DAQ::DAQ(int BufferLength) : m_iBufferLength(BufferLength) {
+DAQ::DAQ(int BufferLength) try : m_Ring(BufferLength), m_Control(&m_DataReady) {
     int rc = sqlite3_open_v2(runs_db_addr.c_str(), &m_RunsDB, SQLITE_OPEN_READWRITE, NULL);
     if (rc != SQLITE_OK) {
         BOOST_LOG_TRIVIAL(fatal) << "Could not connect to runs database. SQLITE complains with error " << sqlite3_errmsg(m_RunsDB);
@@ -37,17 +47,22 @@ DAQ::DAQ(int BufferLength) : m_iBufferLength(BufferLength) {
 
     m_WriteThread = thread(&DAQ::DoesNothing, this);
 
-    try {
-        m_vBuffer.assign(BufferLength, Event());
-    } catch (exception& e) {
-        BOOST_LOG_TRIVIAL(fatal) << "Could not allocate memory for " << BufferLength << " events!";
-        throw bad_alloc();
-    }
-
     rc = sqlite3_prepare_v2(m_RunsDB,
                             "INSERT INTO runs (name, start_time, end_time, runtime, events, \
-                            source, raw_size, comments) VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+                            source, raw_size, comments, live_time, dead_time, live_fraction) \
+                            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
                             -1, &m_InsertStmt, NULL);
+    if (rc == SQLITE_OK) {
+        m_BindIndex["live_time"] = 9;
+        m_BindIndex["dead_time"] = 10;
+        m_BindIndex["live_fraction"] = 11;
+    } else { // a runs table from before the live time columns, see the README
+        BOOST_LOG_TRIVIAL(warning) << "The runs table has no live time columns, runs are entered without them";
+        rc = sqlite3_prepare_v2(m_RunsDB,
+                                "INSERT INTO runs (name, start_time, end_time, runtime, events, \
+                                source, raw_size, comments) VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
+                                -1, &m_InsertStmt, NULL);
+    }
     m_BindIndex["name"] = 1;
     m_BindIndex["start_time"] = 2;
     m_BindIndex["end_time"] = 3;
@@ -61,34 +76,48 @@ DAQ::DAQ(int BufferLength) : m_iBufferLength(BufferLength) {
         throw DAQException();
     } else BOOST_LOG_TRIVIAL(debug) << "Database statement prepared";
 
-    m_iInsertPtr = 0;
-    m_iDecodePtr = 0;
-    m_iWritePtr = 0;
-
-    m_iToDecode = 0;
-    m_iToWrite = 0;
-
     m_aiEventsInCurrentFile = 0;
     m_aiEventsInRun = 0;
+    m_aiDecodeErrors = 0;
+    for (auto& c : m_EventClasses) c.fill(0);
+    m_iShard = 0;
+    m_iFileSetEvents = 0;
+    m_lRunBytes = 0;
+    m_lRunFirstTrigger = -1;
 
     m_abSaveWaveforms = false;
     m_bTestRun = true;
     m_abRunThreads = true;
-    m_abSuppressOutput = false;
+    m_abTerminal = false;
+    m_abWriteFailed = false;
+    m_bWarnedOversize = false;
+    m_bTagNextEvent = false;
+    m_abRollOverPending = false;
 
     m_tStart = chrono::high_resolution_clock::now();
     Event::SetUnixTS(m_tStart.time_since_epoch().count());
 
     s_catch_signals();
 
+} catch (bad_alloc& e) {
+    BOOST_LOG_TRIVIAL(fatal) << "Could not allocate memory for " << BufferLength << " events!";
+    throw;
 }
 
 DAQ::~DAQ() {
+    StopTerminal();
     m_abRunThreads = false;
     m_abRun = false;
+    m_Ring.Stop();
     for (auto& th : m_DecodeThreads) if (th.joinable()) th.join();
     if (m_WriteThread.joinable()) m_WriteThread.join();
     EndRun();
+    if (m_FinishThread.joinable()) m_FinishThread.join();
+    for (auto& dig : digis) dig->StopReadout();
+    for (auto& dig : digis) dig->ClearBlocks();
+    if (m_Builder) m_Builder->Reset();
+    m_Fragments.fragments.clear();
+    m_Ring.Reset(); // events may still hold readout blocks
     for (auto& dig : digis) dig.reset();
     sqlite3_finalize(m_InsertStmt);
     sqlite3_close_v2(m_RunsDB);
@@ -97,13 +126,17 @@ DAQ::~DAQ() {
 }
 
 void DAQ::Setup(const string& filename) {
+    auto tSetup = chrono::steady_clock::now();
+    decltype(tSetup) tConnected, tConfigured, tProgrammed;
     BOOST_LOG_TRIVIAL(info) << "Parsing config file " << filename << "...";
     string pmt_config_file(filename.substr(0, filename.find_last_of('/')) + "/pmt_config.json");
-    int link_number(0), conet_node(0), base_address(0), board(-1);
+    int link_number(0), conet_node(0), base_address(0);
     ChannelSettings_t ChanSet;
+    EmulatorSettings_t EmuSet;
     GW_t GW;
-    string json_string(""), str("");
+    string json_string(""), str(""), backend("");
     ifstream fin(filename, ifstream::in);
+    document::value config_doc{document::view{}};
     document::view config_dict{};
     if (!fin.is_open()) {
         BOOST_LOG_TRIVIAL(fatal) << "Could not open " << filename;
@@ -111,8 +144,8 @@ void DAQ::Setup(const string& filename) {
     } else BOOST_LOG_TRIVIAL(debug) << "Opened " << filename;
     while (getline(fin, str)) json_string += str;
     try {
-        document::value temp = bsoncxx::from_json(json_string);
-        config_dict = temp.view();
+        config_doc = bsoncxx::from_json(json_string);
+        config_dict = config_doc.view();
     } catch (exception& e) {
         BOOST_LOG_TRIVIAL(fatal) << "Error parsing " << filename << ". Is it valid json? " << e.what();
         throw DAQException();
@@ -123,11 +156,27 @@ void DAQ::Setup(const string& filename) {
     try { 
         config.RawDataDir = config_dict["raw_data_dir"]["value"].get_utf8().value.to_string();
         for (auto& d : config_dict["digitizers"].get_array().value) {
-            link_number = d["link_number"].get_int32();
-            conet_node = d["conet_node"].get_int32();
-            base_address = d["base_address"].get_int32();
+            backend = d["backend"] ? d["backend"].get_utf8().value.to_string() : "caen";
+            if (digis.size() == MAX_BOARDS) {
+                BOOST_LOG_TRIVIAL(fatal) << "Too many digitizers, an event has room for " << MAX_BOARDS;
+                throw DAQException();
+            }
             try {
-                digis.push_back(unique_ptr<Digitizer>(new Digitizer(link_number, conet_node, base_address)));
+                if (backend == "caen") {
+                    link_number = d["link_number"].get_int32();
+                    conet_node = d["conet_node"].get_int32();
+                    base_address = d["base_address"].get_int32();
+                    digis.push_back(unique_ptr<Digitizer>(new V1724(link_number, conet_node, base_address)));
+                } else if (backend == "emulator") {
+                    EmuSet.BoardID = digis.size();
+                    EmuSet.TriggerRate = d["trigger_rate"] ? s_get_number(d["trigger_rate"]) : 100.;
+                    EmuSet.ZLEOccupancy = d["zle_occupancy"] ? s_get_number(d["zle_occupancy"]) : 0.1;
+                    EmuSet.MissedTriggers = d["missed_triggers"] ? s_get_number(d["missed_triggers"]) : 0.;
+                    digis.push_back(unique_ptr<Digitizer>(new V1724Emulator(EmuSet)));
+                } else {
+                    BOOST_LOG_TRIVIAL(fatal) << "Unknown digitizer backend '" << backend << "', options are 'caen' and 'emulator'";
+                    throw DAQException();
+                }
                 CS.push_back(ConfigSettings_t{});
             } catch (exception& e) {
                 BOOST_LOG_TRIVIAL(fatal) << "Could not allocate digitizer! " << e.what();
@@ -140,8 +189,8 @@ void DAQ::Setup(const string& filename) {
             GW.addr = stoi(gw["register"].get_utf8().value.to_string(), nullptr, 16);
             GW.data = stoi(gw["data"].get_utf8().value.to_string(), nullptr, 16);
             GW.mask = stoi(gw["mask"].get_utf8().value.to_string(), nullptr, 16);
-            if (board == -1) for (auto& cs : CS) cs.GenericWrites.push_back(GW);
-            else CS[board].GenericWrites.push_back(GW);
+            if (GW.board == -1) for (auto& cs : CS) cs.GenericWrites.push_back(GW);
+            else CS.at(GW.board).GenericWrites.push_back(GW);
             config.GWs.push_back(GW);
             BOOST_LOG_TRIVIAL(debug) << "Found GW " << setbase(16) << GW.board << '.' << GW.addr << '.' << GW.data << '.' << GW.mask << setbase(10);
         }
@@ -149,6 +198,7 @@ void DAQ::Setup(const string& filename) {
         BOOST_LOG_TRIVIAL(fatal) << "Error in config file block 1: " << e.what();
         throw DAQException();
     }
+    tConnected = chrono::steady_clock::now();
 
     try {
         for (auto& cs : CS) {
@@ -167,11 +217,108 @@ void DAQ::Setup(const string& filename) {
         config.BlockTransfer = config_dict["block_transfer"]["value"].get_int32();
         config.IsZLE = ZLE.at(config_dict["is_zle"]["value"].get_utf8().value.to_string());
 	config.PostTrigger = config_dict["post_trigger"]["value"].get_int32();
+        config.ZeroCopy = config_dict["zero_copy"] ? YesNo.at(config_dict["zero_copy"]["value"].get_utf8().value.to_string()) : false;
+        config.ReadoutBlocks = config_dict["readout_blocks"] ? config_dict["readout_blocks"]["value"].get_int32() : (config.ZeroCopy ? 32 : 2);
+        if (config.ReadoutBlocks < 2) {
+            BOOST_LOG_TRIVIAL(warning) << "Need at least 2 readout blocks per board to overlap transfers";
+            config.ReadoutBlocks = 2;
+        }
+        config.DirectIO = config_dict["direct_io"] ? YesNo.at(config_dict["direct_io"]["value"].get_utf8().value.to_string()) : false;
+        config.WriteBufferMB = config_dict["write_buffer_mb"] ? config_dict["write_buffer_mb"]["value"].get_int32() : 4;
+        config.PackSamples = config_dict["pack_samples"] ? YesNo.at(config_dict["pack_samples"]["value"].get_utf8().value.to_string()) : false;
+        config.FindPulses = config_dict["find_pulses"] ? YesNo.at(config_dict["find_pulses"]["value"].get_utf8().value.to_string()) : false;
+        config.PulseThreshold = config_dict["pulse_threshold"] ? config_dict["pulse_threshold"]["value"].get_int32() : 40;
+        config.S2MinWidthNs = config_dict["s2_min_width_ns"] ? config_dict["s2_min_width_ns"]["value"].get_int32() : 200;
+        config.Filter = config_dict["filter"] ? YesNo.at(config_dict["filter"]["value"].get_utf8().value.to_string()) : false;
+        config.FilterMinChannels = config_dict["filter_min_channels"] ? config_dict["filter_min_channels"]["value"].get_int32() : 2;
+        config.FilterMinArea = config_dict["filter_min_area"] ? config_dict["filter_min_area"]["value"].get_int32() : 0;
+        config.FilterMinHeight = config_dict["filter_min_height"] ? config_dict["filter_min_height"]["value"].get_int32() : 0;
+        config.FilterPrescale = config_dict["filter_prescale"] ? config_dict["filter_prescale"]["value"].get_int32() : 0;
+        if (config.Filter && !config.FindPulses) {
+            BOOST_LOG_TRIVIAL(info) << "The filter needs the pulse finder, turning it on";
+            config.FindPulses = true;
+        }
+        config.NoiseCalibration = config_dict["noise_calibration"] ? YesNo.at(config_dict["noise_calibration"]["value"].get_utf8().value.to_string()) : false;
+        config.NoiseZLERateHz = config_dict["noise_zle_rate_hz"] ? s_get_number(config_dict["noise_zle_rate_hz"]["value"]) : 200.;
+        config.NoiseTriggerRateHz = config_dict["noise_trigger_rate_hz"] ? s_get_number(config_dict["noise_trigger_rate_hz"]["value"]) : 1.;
+        config.MaxEventsPerRun = config_dict["max_events_per_run"] ? config_dict["max_events_per_run"]["value"].get_int32() : 1000000;
+        config.MaxRunSeconds = config_dict["max_run_seconds"] ? config_dict["max_run_seconds"]["value"].get_int32() : 3600;
+        if (config.NoiseCalibration && config.IsZLE)
+            BOOST_LOG_TRIVIAL(warning) << "Noise calibration on ZLE data only sees the samples around pulses";
+        config.Compression = config_dict["compression"] ? config_dict["compression"]["value"].get_utf8().value.to_string() : "none";
+        Compressor::Codecs.at(config.Compression); // throws on an unknown codec
+        config.CompressionLevel = config_dict["compression_level"] ? config_dict["compression_level"]["value"].get_int32() : 1;
+        config.CompressionThreads = config_dict["compression_threads"] ? config_dict["compression_threads"]["value"].get_int32() : 2;
+        config.CompressionBlockKB = config_dict["compression_block_kb"] ? config_dict["compression_block_kb"]["value"].get_int32() : 4096;
+        config.CompressionThreads = max(config.CompressionThreads, 1);
+        config.BuilderWindowNs = config_dict["builder_window_ns"] ? config_dict["builder_window_ns"]["value"].get_int32() : 100;
+        config.BuilderTimeoutMs = config_dict["builder_timeout_ms"] ? config_dict["builder_timeout_ms"]["value"].get_int32() : 1000;
+        config.MetricsSocket = config_dict["metrics_socket"] ? config_dict["metrics_socket"]["value"].get_utf8().value.to_string() : "";
+        config.ControlSocket = config_dict["control_socket"] ? config_dict["control_socket"]["value"].get_utf8().value.to_string() : "";
+        config.RegisterCacheDir = config_dict["register_cache_dir"] ? config_dict["register_cache_dir"]["value"].get_utf8().value.to_string() : "";
+        if (!config.RegisterCacheDir.empty()) {
+            struct stat st;
+            if ((stat(config.RegisterCacheDir.c_str(), &st) != 0) || !S_ISDIR(st.st_mode)) {
+                BOOST_LOG_TRIVIAL(fatal) << "No directory " << config.RegisterCacheDir << " for the register cache";
+                throw DAQException();
+            }
+        }
+        config.HugePages = config_dict["hugepages"] ? YesNo.at(config_dict["hugepages"]["value"].get_utf8().value.to_string()) : false;
+        config.EventBufferMB = config_dict["event_buffer_mb"] ? config_dict["event_buffer_mb"]["value"].get_int32() : 512;
+        config.ShardDirs = {config.RawDataDir};
+        if (config_dict["shard_dirs"]) for (auto& d : config_dict["shard_dirs"]["value"].get_array().value) {
+            // absolute, since the run directory links to the files there
+            string dir = d.get_utf8().value.to_string();
+            char* real = realpath(dir.c_str(), nullptr);
+            if (real == nullptr) {
+                BOOST_LOG_TRIVIAL(fatal) << "No directory " << dir << ": " << strerror(errno);
+                throw DAQException();
+            }
+            config.ShardDirs.push_back(string(real) + "/");
+            free(real);
+        }
+        str = config_dict["readout_mode"] ? config_dict["readout_mode"]["value"].get_utf8().value.to_string() : "adaptive";
+        config.ReadoutMode = ReadoutMode.at(str);
+        config.PollMinUs = config_dict["poll_min_us"] ? config_dict["poll_min_us"]["value"].get_int32() : PollPolicy::s_DefaultMinWaitNs/1000;
+        config.PollMaxUs = config_dict["poll_max_us"] ? config_dict["poll_max_us"]["value"].get_int32() : PollPolicy::s_DefaultMaxWaitNs/1000;
+        config.IRQEvents = config_dict["irq_events"] ? config_dict["irq_events"]["value"].get_int32() : 1;
+        if ((config.PollMinUs < 1) || (config.PollMaxUs < config.PollMinUs) || (config.IRQEvents < 1)) {
+            BOOST_LOG_TRIVIAL(fatal) << "Need 1 <= poll_min_us <= poll_max_us and irq_events >= 1";
+            throw DAQException();
+        }
+        for (int r = 0; r < ThreadPlacement::num_roles; r++) {
+            string key = string(ThreadPlacement::Names[r]) + "_cpus";
+            string cpus = config_dict[key] ? config_dict[key]["value"].get_utf8().value.to_string() : "";
+            if (!m_Placement.SetCpus((ThreadPlacement::role_t)r, cpus)) {
+                BOOST_LOG_TRIVIAL(fatal) << "No online cpus in " << key << " \"" << cpus << "\"";
+                throw DAQException();
+            }
+        }
+        m_Placement.SetFifoPriority(ThreadPlacement::readout, config_dict["readout_priority"] ? config_dict["readout_priority"]["value"].get_int32() : 0);
 	BOOST_LOG_TRIVIAL(debug) << "Events per file: " << config.EventsPerFile;
         BOOST_LOG_TRIVIAL(debug) << "Record length: " << config.RecordLength;
         BOOST_LOG_TRIVIAL(debug) << "Block transfer: " << config.BlockTransfer;
         BOOST_LOG_TRIVIAL(debug) << "Is ZLE: " << config.IsZLE;
 	BOOST_LOG_TRIVIAL(debug) << "Post Trigger Expected: " << config.PostTrigger;
+        BOOST_LOG_TRIVIAL(debug) << "Zero copy: " << config.ZeroCopy << ", readout blocks: " << config.ReadoutBlocks;
+        BOOST_LOG_TRIVIAL(debug) << "Direct IO: " << config.DirectIO << ", write buffers: " << config.WriteBufferMB << " MB";
+        for (unsigned s = 0; s < config.ShardDirs.size(); s++) BOOST_LOG_TRIVIAL(debug) << "Shard " << s << ": " << config.ShardDirs[s];
+        BOOST_LOG_TRIVIAL(debug) << "Event buffer: " << (config.ZeroCopy ? 0 : config.EventBufferMB) << " MB, " << m_Ring.Capacity() << " events";
+        BOOST_LOG_TRIVIAL(debug) << "Pack samples: " << config.PackSamples << (SampleCodec::UsesAVX2() ? " (avx2)" : "");
+        BOOST_LOG_TRIVIAL(debug) << "Find pulses: " << config.FindPulses << ", threshold " << config.PulseThreshold
+            << ", S2 width " << config.S2MinWidthNs << " ns";
+        BOOST_LOG_TRIVIAL(debug) << "Filter: " << config.Filter << ", " << config.FilterMinChannels << " channels, area "
+            << config.FilterMinArea << ", height " << config.FilterMinHeight << ", prescale " << config.FilterPrescale;
+        BOOST_LOG_TRIVIAL(debug) << "Noise calibration: " << config.NoiseCalibration << ", ZLE rate " << config.NoiseZLERateHz
+            << " Hz, trigger rate " << config.NoiseTriggerRateHz << " Hz";
+        BOOST_LOG_TRIVIAL(debug) << "Compression: " << config.Compression << " level " << config.CompressionLevel << ", "
+            << config.CompressionThreads << " threads, " << config.CompressionBlockKB << " kB blocks";
+        BOOST_LOG_TRIVIAL(debug) << "Builder window: " << config.BuilderWindowNs << " ns, timeout: " << config.BuilderTimeoutMs << " ms";
+        BOOST_LOG_TRIVIAL(debug) << "Readout: " << str << ", polling every " << config.PollMinUs << "-" << config.PollMaxUs << " us, interrupt every " << config.IRQEvents << " events";
+        BOOST_LOG_TRIVIAL(debug) << "Metrics socket: " << (config.MetricsSocket.empty() ? "none" : config.MetricsSocket);
+        BOOST_LOG_TRIVIAL(debug) << "Control socket: " << (config.ControlSocket.empty() ? "none" : config.ControlSocket);
+        BOOST_LOG_TRIVIAL(debug) << "Register cache: " << (config.RegisterCacheDir.empty() ? "none, boards are reset" : config.RegisterCacheDir);
+        BOOST_LOG_TRIVIAL(info) << "Topology: " << ThreadPlacement::Topology() << (config.HugePages ? ", huge pages" : "");
 
     } catch (exception& e) {
         BOOST_LOG_TRIVIAL(fatal) << "Error in config file block 2: " << e.what();
@@ -194,7 +341,8 @@ void DAQ::Setup(const string& filename) {
     while (getline(fin, str)) json_string += str;
     fin.close();
     try {
-        config_dict = bsoncxx::from_json(json_string);
+        config_doc = bsoncxx::from_json(json_string);
+        config_dict = config_doc.view();
     } catch (exception& e) {
         BOOST_LOG_TRIVIAL(fatal) << "Error parsing " << pmt_config_file << ". Is it valid json? " << e.what();
         throw DAQException();
@@ -207,12 +355,12 @@ void DAQ::Setup(const string& filename) {
             ChanSet.Enabled             = cs["enabled"].get_int32();
             ChanSet.DCoffset            = cs["dc_offset"].get_int32();
             ChanSet.TriggerThreshold    = cs["trigger_threshold"].get_int32();
-            ChanSet.TriggerMode         = CS[board].ChTriggerMode;
+            ChanSet.TriggerMode         = CS.at(ChanSet.Board).ChTriggerMode;
             ChanSet.ZLEThreshold        = cs["zle_threshold"].get_int32();
             ChanSet.ZLE_N_LFWD          = cs["zle_lfwd_samples"].get_int32();
             ChanSet.ZLE_N_LBK           = cs["zle_lbk_samples"].get_int32();
-            if (ChanSet.Enabled) CS[ChanSet.Board].EnableMask |= (1 << ChanSet.Channel);
-            CS[ChanSet.Board].ChannelSettings.push_back(ChanSet);
+            if (ChanSet.Enabled) CS.at(ChanSet.Board).EnableMask |= (1 << ChanSet.Channel);
+            CS.at(ChanSet.Board).ChannelSettings.push_back(ChanSet);
             config.ChannelSettings.push_back(ChanSet);
             BOOST_LOG_TRIVIAL(debug) << "Board " << ChanSet.Board << " ch " << ChanSet.Channel << " dc " << ChanSet.DCoffset << " trig " << ChanSet.TriggerThreshold
                 << " ZLE " << ChanSet.ZLEThreshold;
@@ -222,45 +370,285 @@ void DAQ::Setup(const string& filename) {
         throw DAQException();
     }
 
-    for (unsigned i = 0; i < digis.size(); i++) {
-        digis[i]->ProgramDigitizer(CS[i]);
-        buffers.push_back(digis[i]->GetBuffer());
+    tConfigured = chrono::steady_clock::now();
+    ProgramDigitizers(CS);
+    tProgrammed = chrono::steady_clock::now();
+    m_Builder.reset(new EventBuilder(digis.size(), config.BuilderWindowNs, config.BuilderTimeoutMs));
+    if (config.Filter) m_Filter.reset(new EventFilter(config.FilterMinChannels, config.FilterMinArea, config.FilterMinHeight, config.FilterPrescale));
+    else m_Filter.reset();
+    if (config.NoiseCalibration) m_Calibration.reset(new NoiseCalibration(config.NoiseZLERateHz, config.NoiseTriggerRateHz));
+    else m_Calibration.reset();
+    if ((config.Compression != "none") && (config.ShardDirs.size() > 1)) {
+        // blocks are numbered through one stream of files
+        BOOST_LOG_TRIVIAL(warning) << "Compressed runs are only written to " << config.RawDataDir << ", ignoring shard_dirs";
+        config.ShardDirs.resize(1);
+    }
+    m_Compressor.reset();
+    m_vShards.clear();
+    try {
+        for (auto& dir : config.ShardDirs)
+            m_vShards.emplace_back(new WriteShard(dir, config.WriteBufferMB << 20, m_iWriteBuffers, config.DirectIO, config.HugePages, config.ShardDirs.size() > 1));
+        if (config.Compression != "none")
+            m_Compressor.reset(new Compressor(m_vShards[0]->Writer(), Compressor::Codecs.at(config.Compression), config.CompressionLevel,
+                                              config.CompressionThreads, config.CompressionBlockKB << 10));
+    } catch (bad_alloc& e) {
+        BOOST_LOG_TRIVIAL(fatal) << "Could not allocate " << m_iWriteBuffers << " write buffers of " << config.WriteBufferMB << " MB for each of "
+            << config.ShardDirs.size() << " directories";
+        throw DAQException();
+    }
+    m_vOpenFile.assign(m_vShards.size(), 0);
+    m_vFileOffset.assign(m_vShards.size(), 0);
+    m_vWriteIov.assign(m_vShards.size(), vector<struct iovec>());
+    try { // zero copy events point into the readout blocks instead
+        m_Ring.AllocateBytes(config.ZeroCopy ? 0 : ((size_t)max(config.EventBufferMB, 0) << 20), config.HugePages);
+    } catch (bad_alloc& e) {
+        BOOST_LOG_TRIVIAL(fatal) << "Could not allocate an event buffer of " << config.EventBufferMB << " MB";
+        throw DAQException();
     }
-    BOOST_LOG_TRIVIAL(debug) << "Setup done";
+    m_bWarnedOversize = false;
+    m_Metrics.reset(new Metrics(digis.size(), m_DecodeThreads.size(), m_vShards.size()));
+    for (unsigned s = 0; s < m_vShards.size(); s++) m_vShards[s]->Writer()->SetLatencyHistogram(m_Metrics->FileWriteLatency(s));
+    m_Metrics->SetDeadTime(&m_DeadTime);
+    if (!config.MetricsSocket.empty() && !m_Metrics->Serve(config.MetricsSocket)) throw DAQException();
+    if (config.HugePages && HugePages::LockAll()) BOOST_LOG_TRIVIAL(info) << "All memory locked";
+    auto tDone = chrono::steady_clock::now();
+    auto ms = [](decltype(tSetup) t0, decltype(tSetup) t1){return chrono::duration_cast<chrono::milliseconds>(t1 - t0).count();};
+    BOOST_LOG_TRIVIAL(info) << "Setup done in " << ms(tSetup, tDone) << " ms: connecting " << ms(tSetup, tConnected)
+        << ", config " << ms(tConnected, tConfigured) << ", programming " << ms(tConfigured, tProgrammed) << ", buffers " << ms(tProgrammed, tDone);
+}
+
+void DAQ::ProgramDigitizers(vector<ConfigSettings_t>& CS) {
+    // one thread per link, since the boards on a link share it
+    map<int, vector<unsigned>> links;
+    vector<exception_ptr> errors(digis.size());
+    vector<thread> threads;
+    for (unsigned i = 0; i < digis.size(); i++) links[digis[i]->Link() < 0 ? -1 - (int)i : digis[i]->Link()].push_back(i);
+    for (auto& link : links) threads.emplace_back([&](const vector<unsigned>& boards) {
+        for (auto i : boards) {
+            try {
+                auto t0 = chrono::steady_clock::now();
+                digis[i]->SetRegisterCache(config.RegisterCacheDir);
+                digis[i]->ProgramDigitizer(CS[i]);
+                digis[i]->AllocateBlocks(config.ReadoutBlocks, config.HugePages);
+                digis[i]->SetPolling(config.ReadoutMode, config.PollMinUs*1000l, config.PollMaxUs*1000l, config.IRQEvents);
+                BOOST_LOG_TRIVIAL(debug) << "Board " << i << " set up in "
+                    << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - t0).count() << " ms";
+            } catch (...) {
+                errors[i] = current_exception();
+                return;
+            }
+        }
+    }, link.second);
+    for (auto& t : threads) t.join();
+    for (auto& e : errors) if (e) rethrow_exception(e);
 }
 
 void DAQ::StartRun() {
     m_tStart = chrono::high_resolution_clock::now(); // nanosecond precision!
     Event::SetUnixTS(m_tStart.time_since_epoch().count());
     m_abIsFirstEvent = true;
+    config.RunName = MakeRunDirectory();
+    m_sRunName = config.RunName;
+    BOOST_LOG_TRIVIAL(info) << "Starting run " << config.RunName;
+    m_tRunStart = m_tStart;
+    m_DeadTime.Take(m_tStart.time_since_epoch().count()); // whatever came before belongs to no run
+    OpenRun();
+}
+
+string DAQ::MakeRunDirectory() {
     time_t rawtime;
     time(&rawtime);
     char temp[32];
     strftime(temp, sizeof(temp), "%Y%m%d_%H%M", localtime(&rawtime));
-    config.RunName = temp;
-    BOOST_LOG_TRIVIAL(info) << "Starting run " << config.RunName;
+    string name(temp);
+    // with rollovers, runs can start less than a minute apart
+    for (int i = 1; mkdir((config.RawDataDir + name).c_str(), 0755) != 0; i++) {
+        if (errno != EEXIST) {
+            BOOST_LOG_TRIVIAL(fatal) << "Could not create " << config.RawDataDir << name << ": " << strerror(errno);
+            throw DAQException();
+        }
+        name = string(temp) + "_" + to_string(i);
+    }
+    for (unsigned s = 1; s < config.ShardDirs.size(); s++) {
+        if ((mkdir((config.ShardDirs[s] + name).c_str(), 0755) != 0) && (errno != EEXIST)) {
+            BOOST_LOG_TRIVIAL(fatal) << "Could not create " << config.ShardDirs[s] << name << ": " << strerror(errno);
+            throw DAQException();
+        }
+    }
+    return name;
+}
 
-    m_vFileInfos.push_back(file_info{0,0,0,0});
-    string command = "mkdir " + config.RawDataDir + config.RunName;
-    int ret;
-    ret = system(command.c_str());
-    BOOST_LOG_TRIVIAL(debug) << "What is this, it's unused: " << ret;
-    stringstream fullfilename;
-    fullfilename << config.RawDataDir << config.RunName << "/" << config.RunName << "_" << setw(6) << setfill('0') << m_vFileInfos.size()-1 << flush << ".ast";
-    fout.open(fullfilename.str(), ofstream::binary | ofstream::out);
-    if (!fout.is_open()) {
-        BOOST_LOG_TRIVIAL(fatal) << "Could not open " << fullfilename.str();
+void DAQ::OpenRun() {
+    // if a run is open, its last files finish in the background
+    OpenFiles();
+    for (auto& shard : m_vShards) {
+        shard->Sync();
+        if (shard->Failed()) {
+            BOOST_LOG_TRIVIAL(fatal) << "Could not open the first files of run " << config.RunName;
+            throw DAQException();
+        }
+    }
+    if (m_Compressor) m_Compressor->NewFile(0);
+    m_lRunBytes = 0;
+    m_lRunFirstTrigger = -1;
+    m_lIncomplete = 0;
+    if (!m_Index.Open(config.RawDataDir + config.RunName + "/" + config.RunName + ".idx")) {
+        BOOST_LOG_TRIVIAL(fatal) << "Could not open the index of run " << config.RunName;
         throw DAQException();
-    } else BOOST_LOG_TRIVIAL(debug) << "Opened " << fullfilename.str();
+    }
+    if (m_Calibration) m_Calibration->Reset();
+    m_aiEventsInCurrentFile = 0;
+    m_aiEventsInRun = 0;
+}
+
+DAQ::RunSummary DAQ::CloseRun(chrono::high_resolution_clock::time_point tEnd) {
+    RunSummary summary;
+    if (m_Compressor) m_Compressor->Flush();
+    m_Index.Close();
+    summary.name = config.RunName;
+    {
+        lock_guard<mutex> lock(m_RunMutex);
+        summary.comment = m_sRunComment;
+        summary.test_run = m_bTestRun;
+    }
+    summary.start = m_tRunStart;
+    summary.end = tEnd;
+    summary.first_trigger = m_lRunFirstTrigger;
+    summary.files.swap(m_vFileInfos);
+    summary.events = m_Index.Records();
+    summary.bytes = m_lRunBytes;
+    summary.incomplete = m_lIncomplete;
+    summary.orphans = 0;
+    summary.decode_errors = m_aiDecodeErrors.exchange(0);
+    summary.classes = m_EventClasses;
+    for (auto& c : m_EventClasses) c.fill(0);
+    if (m_Compressor) {
+        summary.blocks = m_Compressor->Blocks();
+        m_Compressor->ClearBlocks();
+    }
+    summary.noise_events = 0;
+    summary.deadtime = DeadTime::Summary{};
+    if (m_Calibration) {
+        summary.noise_events = m_Calibration->Events();
+        summary.noise = m_Calibration->Results();
+    }
+    return summary;
+}
+
+void DAQ::RollOver() {
+    if (m_abRollOverPending) return; // the writer hasn't reached the last one yet
+    RunStart next;
+    m_DeadTime.Begin(DeadTime::rollover);
+    next.name = MakeRunDirectory();
+    next.start = chrono::high_resolution_clock::now();
+    next.orphans = m_Builder->Orphans();
+    next.deadtime = m_DeadTime.Take(next.start.time_since_epoch().count());
+    m_Builder->NewRun();
+    {
+        lock_guard<mutex> lock(m_RunMutex);
+        m_NewRuns.push_back(next);
+    }
+    m_tStart = next.start;
+    m_sRunName = next.name;
+    m_bTagNextEvent = true;
+    m_abRollOverPending = true;
+    m_DeadTime.End(DeadTime::rollover);
+    BOOST_LOG_TRIVIAL(info) << "Rolling over to run " << next.name;
+}
+
+void DAQ::SwitchRun() {
+    RunStart next;
+    m_DeadTime.Begin(DeadTime::rollover);
+    {
+        lock_guard<mutex> lock(m_RunMutex);
+        next = m_NewRuns.front();
+        m_NewRuns.pop_front();
+    }
+    RunSummary summary = CloseRun(next.start);
+    summary.orphans = next.orphans;
+    summary.deadtime = next.deadtime;
+    // one run's metadata at a time, so the database sees them in order
+    if (m_FinishThread.joinable()) m_FinishThread.join();
+    m_FinishThread = thread(&DAQ::WriteRunSummary, this, move(summary));
+    config.RunName = next.name;
+    m_tRunStart = next.start;
+    OpenRun();
+    m_abRollOverPending = false;
+    m_DeadTime.End(DeadTime::rollover);
+}
+
+void DAQ::WriteNoiseThresholds(const string& RunName, const vector<NoiseResult>& vNoise) {
+    // the settings the run used, with the recommended thresholds where a channel had data
+    builder::basic::document doc{};
+    using builder::basic::sub_document;
+    using builder::basic::sub_array;
+    using builder::basic::kvp;
+    doc.append(kvp("channels", [&](sub_array subarr) {
+        for (auto cs : config.ChannelSettings) {
+            for (auto& n : vNoise) {
+                if ((n.board != cs.Board) || (n.channel != cs.Channel)) continue;
+                BOOST_LOG_TRIVIAL(info) << "Board " << n.board << " ch " << n.channel << ": baseline " << n.baseline << ", rms " << n.rms
+                    << ", zle threshold " << n.zle_threshold << ", trigger threshold " << n.trigger_threshold;
+                if (n.zle_threshold > 0) cs.ZLEThreshold = n.zle_threshold;
+                if (n.trigger_threshold > 0) cs.TriggerThreshold = n.trigger_threshold;
+                if ((n.zle_threshold < 0) || (n.trigger_threshold < 0))
+                    BOOST_LOG_TRIVIAL(warning) << "Board " << n.board << " ch " << n.channel << " is too noisy for a recommendation";
+            }
+            subarr.append([&](sub_document subdoc) {
+                subdoc.append(kvp("board", cs.Board));
+                subdoc.append(kvp("channel", cs.Channel));
+                subdoc.append(kvp("enabled", (int)cs.Enabled));
+                subdoc.append(kvp("dc_offset", (int)cs.DCoffset));
+                subdoc.append(kvp("trigger_threshold", (int)cs.TriggerThreshold));
+                subdoc.append(kvp("zle_threshold", (int)cs.ZLEThreshold));
+                subdoc.append(kvp("zle_lbk_samples", cs.ZLE_N_LBK));
+                subdoc.append(kvp("zle_lfwd_samples", cs.ZLE_N_LFWD));
+            });
+        }
+    }));
+    stringstream ss;
+    ss << config.RawDataDir << RunName << "/pmt_config.json";
+    ofstream fout(ss.str(), ofstream::out);
+    if (!fout.is_open()) {
+        BOOST_LOG_TRIVIAL(error) << "Could not open " << ss.str();
+        return;
+    }
+    fout << bsoncxx::to_json(doc.view());
+    fout.close();
+    BOOST_LOG_TRIVIAL(info) << "Recommended thresholds written to " << ss.str();
+}
+
+string DAQ::FileName(int FileNumber) {
+    return FileName(FileNumber, config.ShardDirs[FileNumber % config.ShardDirs.size()]);
+}
+
+string DAQ::FileName(int FileNumber, const string& Dir) {
+    char outfilename[256];
+    sprintf(outfilename, "%s%s/%s_%06i.ast", Dir.c_str(), config.RunName.c_str(), config.RunName.c_str(), FileNumber);
+    return outfilename;
 }
 
 void DAQ::EndRun() {
-    if (!fout.is_open()) return;
+    for (auto& shard : m_vShards) shard->Sync();
+    if (m_vShards.empty() || !m_vShards[0]->Writer()->IsOpen()) return;
     printf(" \n");
     BOOST_LOG_TRIVIAL(info) << "Ending run " << config.RunName;
-    if (fout.is_open()) fout.close();
-    chrono::high_resolution_clock::time_point tEnd = chrono::high_resolution_clock::now();
+    RunSummary summary = CloseRun(chrono::high_resolution_clock::now());
+    summary.orphans = m_Builder->Orphans();
+    summary.deadtime = m_DeadTime.Take(summary.end.time_since_epoch().count());
+    for (auto& shard : m_vShards) shard->Close();
+    for (auto& shard : m_vShards) shard->Sync();
+    if (m_FinishThread.joinable()) m_FinishThread.join();
+    if (!WriteRunSummary(move(summary))) BOOST_LOG_TRIVIAL(warning) << "Run " << config.RunName << " is on disk, but its summary is incomplete";
+    // a rollover that no event reached leaves an empty directory behind
+    for (auto& next : m_NewRuns) for (auto& dir : config.ShardDirs) rmdir((dir + next.name).c_str());
+    m_NewRuns.clear();
+    m_bTagNextEvent = false;
+    m_abRollOverPending = false;
+}
 
+bool DAQ::WriteRunSummary(RunSummary summary) {
+    bool bWritten(true);
     long run_size_bytes(0);
     int log_size(0);
     char run_size[16];
@@ -271,11 +659,23 @@ void DAQ::EndRun() {
     using builder::basic::kvp;
 
     doc.append(kvp("is_zle", config.IsZLE));
-    doc.append(kvp("run_name", config.RunName));
+    doc.append(kvp("run_name", summary.name));
     doc.append(kvp("post_trigger", config.PostTrigger));
-    doc.append(kvp("events", (int)m_vEventSizes.size()));
-    doc.append(kvp("start_time_ns", m_tStart.time_since_epoch().count()));
-    doc.append(kvp("end_time_ns", tEnd.time_since_epoch().count()));
+    doc.append(kvp("events", summary.events));
+    doc.append(kvp("start_time_ns", summary.start.time_since_epoch().count()));
+    doc.append(kvp("end_time_ns", summary.end.time_since_epoch().count()));
+    doc.append(kvp("first_trigger_clock", summary.first_trigger));
+    doc.append(kvp("builder_window_ns", m_Builder->WindowNs()));
+    doc.append(kvp("incomplete_events", summary.incomplete));
+    doc.append(kvp("orphan_fragments", summary.orphans));
+    long lRunNs = max((summary.end - summary.start).count(), 1l);
+    long lDeadNs = min(summary.deadtime.dead_ns, lRunNs);
+    doc.append(kvp("live_time_ns", lRunNs - lDeadNs));
+    doc.append(kvp("dead_time_ns", lDeadNs));
+    doc.append(kvp("live_fraction", (double)(lRunNs - lDeadNs)/lRunNs));
+    doc.append(kvp("dead_time_ns_by_cause", [&](sub_document subdoc) {
+        for (int c = 0; c < DeadTime::num_causes; c++) subdoc.append(kvp(DeadTime::Names[c], summary.deadtime.cause_ns[c]));
+    }));
 
 /*    doc.append(kvp("subdocument key", [&](sub_document subdoc) {
                        subdoc.append(kvp("subdoc key", "subdoc value"),
@@ -308,50 +708,132 @@ void DAQ::EndRun() {
     }));
 
     doc.append(kvp("file_info", [&](sub_array subarr) {
-        for (auto& f : m_vFileInfos) {
+        for (auto& f : summary.files) {
             subarr.append([&](sub_document subdoc) {
                 subdoc.append(kvp("file_number", (int)f[file_number]));
                 subdoc.append(kvp("first_event", (int)f[first_event]));
                 subdoc.append(kvp("last_event", (int)f[last_event]));
                 subdoc.append(kvp("n_events", (int)f[n_events]));
+                subdoc.append(kvp("shard", (int)f[shard]));
             });
         }
     }));
 
-    doc.append(kvp("event_size_bytes", [&](sub_array subarr) {
-        for (auto& i : m_vEventSizes) subarr.append((int)i);
+    doc.append(kvp("shards", [&](sub_array subarr) {
+        for (auto& dir : config.ShardDirs) subarr.append(dir);
     }));
-    doc.append(kvp("event_size_cum", [&](sub_array subarr) {
-        for (auto& i : m_vEventSizeCum) subarr.append((int)i);
+
+    doc.append(kvp("decode_errors", summary.decode_errors));
+    doc.append(kvp("pack_samples", config.PackSamples));
+    auto classes = [&](sub_document subdoc, const class_counts& counts) {
+        subdoc.append(kvp("none", counts[PulseSummary::class_none]));
+        subdoc.append(kvp("s1", counts[PulseSummary::class_s1]));
+        subdoc.append(kvp("s2", counts[PulseSummary::class_s2]));
+        subdoc.append(kvp("s1_s2", counts[PulseSummary::class_s1_s2]));
+    };
+    if (config.FindPulses) {
+        class_counts written;
+        for (int c = 0; c < PulseSummary::num_classes; c++)
+            written[c] = summary.classes[EventFilter::keep][c] + summary.classes[EventFilter::prescale][c];
+        doc.append(kvp("pulse_threshold", config.PulseThreshold));
+        doc.append(kvp("s2_min_width_ns", config.S2MinWidthNs));
+        doc.append(kvp("event_classes", [&](sub_document subdoc) {classes(subdoc, written);}));
+    }
+    if (config.Filter) {
+        doc.append(kvp("filter", [&](sub_document subdoc) {
+            subdoc.append(kvp("min_channels", config.FilterMinChannels));
+            subdoc.append(kvp("min_area", config.FilterMinArea));
+            subdoc.append(kvp("min_height", config.FilterMinHeight));
+            subdoc.append(kvp("prescale", config.FilterPrescale));
+            subdoc.append(kvp("keep", [&](sub_document d) {classes(d, summary.classes[EventFilter::keep]);}));
+            subdoc.append(kvp("prescaled", [&](sub_document d) {classes(d, summary.classes[EventFilter::prescale]);}));
+            subdoc.append(kvp("drop", [&](sub_document d) {classes(d, summary.classes[EventFilter::drop]);}));
+        }));
+    }
+    doc.append(kvp("compression", config.Compression));
+    if (m_Compressor) {
+        doc.append(kvp("compression_level", config.CompressionLevel));
+        doc.append(kvp("blocks", [&](sub_array subarr) {
+            for (auto& b : summary.blocks) {
+                subarr.append([&](sub_document subdoc) {
+                    subdoc.append(kvp("file_number", b.file_number));
+                    subdoc.append(kvp("offset", b.offset));
+                    subdoc.append(kvp("first_event", (int)b.first_event));
+                    subdoc.append(kvp("n_events", (int)b.n_events));
+                    subdoc.append(kvp("raw_bytes", (int)b.raw_bytes));
+                    subdoc.append(kvp("compressed_bytes", (int)b.compressed_bytes));
+                });
+            }
+        }));
+    }
+
+    if (m_Calibration) {
+        doc.append(kvp("noise_calibration", [&](sub_document subdoc) {
+            subdoc.append(kvp("events", summary.noise_events));
+            subdoc.append(kvp("zle_rate_hz", config.NoiseZLERateHz));
+            subdoc.append(kvp("trigger_rate_hz", config.NoiseTriggerRateHz));
+            subdoc.append(kvp("channels", [&](sub_array subarr) {
+                for (auto& n : summary.noise) {
+                    subarr.append([&](sub_document chdoc) {
+                        chdoc.append(kvp("board", n.board));
+                        chdoc.append(kvp("channel", n.channel));
+                        chdoc.append(kvp("samples", (long)n.samples));
+                        chdoc.append(kvp("baseline", n.baseline));
+                        chdoc.append(kvp("rms", n.rms));
+                        chdoc.append(kvp("zle_threshold", n.zle_threshold));
+                        chdoc.append(kvp("trigger_threshold", n.trigger_threshold));
+                        chdoc.append(kvp("rate_above_threshold_hz", [&](sub_array rates) {
+                            for (auto& r : n.rate) rates.append(r);
+                        }));
+                    });
+                }
+            }));
+        }));
+    }
+
+    doc.append(kvp("index", [&](sub_document subdoc) {
+        subdoc.append(kvp("file", summary.name + ".idx"));
+        subdoc.append(kvp("record_bytes", (int)sizeof(IndexRecord)));
+        subdoc.append(kvp("records", summary.events));
     }));
 
     stringstream ss;
-    ss << config.RawDataDir << config.RunName << "/pax_info.json";
+    ss << config.RawDataDir << summary.name << "/pax_info.json";
     ofstream fheader(ss.str(), ofstream::out);
-    if (!fheader.is_open()) {
-        BOOST_LOG_TRIVIAL(fatal) << "Could not open file header " << ss.str();
-        throw DAQException();
+    if (fheader.is_open()) {
+        fheader << bsoncxx::to_json(doc.view());
+        fheader.close();
+    }
+    if (!fheader) {
+        // this may be the finishing thread, so there is nobody to throw to; the run still goes into the database
+        BOOST_LOG_TRIVIAL(error) << "Could not write file header " << ss.str();
+        bWritten = false;
     }
-    fheader << bsoncxx::to_json(doc.view());
-    fheader.close();
+    if (m_Calibration) WriteNoiseThresholds(summary.name, summary.noise);
 
-    if (!m_bTestRun) {
-        for (auto& x : m_vEventSizes) run_size_bytes += x;
+    if (!summary.test_run) {
+        run_size_bytes = summary.bytes;
         log_size = log2(run_size_bytes)/10;
         log_size = max(log_size, 0);
         sprintf(run_size, "%li%c", max(1l, run_size_bytes >> 10*log_size), sBlockSize[log_size]);
-        sqlite3_bind_text(m_InsertStmt, m_BindIndex["name"], config.RunName.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int64(m_InsertStmt, m_BindIndex["start_time"], m_tStart.time_since_epoch().count());
-        sqlite3_bind_int64(m_InsertStmt, m_BindIndex["end_time"], tEnd.time_since_epoch().count());
-        sqlite3_bind_int64(m_InsertStmt, m_BindIndex["runtime"], chrono::duration_cast<chrono::duration<double>>(tEnd-m_tStart).count());
-        sqlite3_bind_int(m_InsertStmt, m_BindIndex["events"], m_vEventSizes.size());
+        sqlite3_bind_text(m_InsertStmt, m_BindIndex["name"], summary.name.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(m_InsertStmt, m_BindIndex["start_time"], summary.start.time_since_epoch().count());
+        sqlite3_bind_int64(m_InsertStmt, m_BindIndex["end_time"], summary.end.time_since_epoch().count());
+        sqlite3_bind_int64(m_InsertStmt, m_BindIndex["runtime"], chrono::duration_cast<chrono::duration<double>>(summary.end-summary.start).count());
+        sqlite3_bind_int(m_InsertStmt, m_BindIndex["events"], summary.events);
         sqlite3_bind_text(m_InsertStmt, m_BindIndex["source"], (config.IsZLE ? "none" : "LED"), -1, SQLITE_STATIC);
         sqlite3_bind_text(m_InsertStmt, m_BindIndex["raw_size"], run_size, -1, SQLITE_STATIC);
-        sqlite3_bind_text(m_InsertStmt, m_BindIndex["comments"], m_sRunComment.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(m_InsertStmt, m_BindIndex["comments"], summary.comment.c_str(), -1, SQLITE_STATIC);
+        if (m_BindIndex.count("live_time")) {
+            sqlite3_bind_double(m_InsertStmt, m_BindIndex["live_time"], (lRunNs - lDeadNs)*1e-9);
+            sqlite3_bind_double(m_InsertStmt, m_BindIndex["dead_time"], lDeadNs*1e-9);
+            sqlite3_bind_double(m_InsertStmt, m_BindIndex["live_fraction"], (double)(lRunNs - lDeadNs)/lRunNs);
+        }
 
         int rc = sqlite3_step(m_InsertStmt);
         if (rc != SQLITE_DONE) {
             BOOST_LOG_TRIVIAL(error) << "Couldn't add entry to runs databse, error code " << rc;
+            bWritten = false;
         } else BOOST_LOG_TRIVIAL(debug) << "Statement stepped";
         rc = sqlite3_reset(m_InsertStmt);
         if (rc != SQLITE_OK) {
@@ -362,52 +844,208 @@ void DAQ::EndRun() {
             BOOST_LOG_TRIVIAL(error) << "Couldn't clear bindings, error code " << rc;
         } else BOOST_LOG_TRIVIAL(debug) << "Bindings cleared";
     }
-
-    m_vEventSizes.clear();
-    m_vFileInfos.clear();
-    m_vEventSizeCum.clear();
-
-    m_aiEventsInCurrentFile = 0;
-    m_aiEventsInRun = 0;
-
-    // reset digitizer timestamps?
+    return bWritten;
 }
 
 void DAQ::StartAcquisition() {
     m_abRunThreads = false;
+    m_Ring.Stop();
     for (auto& th : m_DecodeThreads) if (th.joinable()) th.join();
     if (m_WriteThread.joinable()) m_WriteThread.join();
+    m_Ring.Reset();
+    m_Builder->Reset();
     digis.front()->StartAcquisition();
+    m_DeadTime.End(DeadTime::restart);
+    for (unsigned b = 0; b < digis.size(); b++) {
+        digis[b]->StartReadout(&m_DataReady, &m_DeadTime);
+        m_Placement.Apply(digis[b]->ReadoutThread(), ThreadPlacement::readout, "board " + to_string(b) + " readout");
+    }
     m_abRun = true;
-    ResetPointers();
     m_abIsFirstEvent = true;
     m_abRunThreads = true;
     if (m_abSaveWaveforms) StartRun();
-    for (auto& th : m_DecodeThreads) th = thread(&DAQ::DecodeEvent, this);
+    for (unsigned t = 0; t < m_DecodeThreads.size(); t++) {
+        m_DecodeThreads[t] = thread(&DAQ::DecodeEvent, this, t);
+        m_Placement.Apply(m_DecodeThreads[t].native_handle(), ThreadPlacement::decode, "decode thread " + to_string(t));
+    }
     m_WriteThread = thread(&DAQ::WriteEvent, this);
+    m_Placement.Apply(m_WriteThread.native_handle(), ThreadPlacement::write, "write thread");
 }
 
 void DAQ::StopAcquisition() {
+    unsigned int iNumEvents(0), iBytes(0);
+    m_DeadTime.Begin(DeadTime::restart); // until the boards start again, or the run ends
+    // the readout threads own the boards while they run
+    for (auto& dig : digis) dig->StopReadout();
     digis.front()->StopAcquisition();
+    // nothing more is coming, so whatever is still unmatched goes out as incomplete
+    while (((iNumEvents = BuildEvents(iBytes, true)) > 0) && (s_interrupted == 0)) {
+        m_lBuiltEvents += iNumEvents;
+        m_lBuiltBytes += iBytes;
+    }
+    for (auto& dig : digis) dig->ClearBlocks();
+    m_Fragments.fragments.clear();
+    if (m_Builder->Incomplete() + m_Builder->Orphans() > 0)
+        BOOST_LOG_TRIVIAL(warning) << m_Builder->Incomplete() << " incomplete events, " << m_Builder->Orphans() << " orphan fragments";
+    // let the decoders and writer finish what is already in the ring
+    while (!m_Ring.IsEmpty() && !m_DecodeThreads.empty() && (s_interrupted == 0)) this_thread::sleep_for(chrono::milliseconds(1));
     m_abRunThreads = false;
     m_abRun = false;
+    m_Ring.Stop();
     for (auto& th : m_DecodeThreads) if (th.joinable()) th.join();
     if (m_WriteThread.joinable()) m_WriteThread.join();
-    ResetPointers();
     if (m_abSaveWaveforms) EndRun();
 }
 
-void DAQ::GetNewRunComment() {
-    cout << "Enter new comment for run:\n";
-    kb.deinit();
-    getline(cin, m_sRunComment);
-    kb.init();
-    m_abSuppressOutput = false;
-}
-
-void DAQ::Readout() {
+void DAQ::Readout(bool bTerminal) {
+    unsigned int iNumEvents(0), iBufferSize(0);
+    int iDataEpoch(0), RunTime(0);
+    auto PrevCheckTime = chrono::system_clock::now();
+    chrono::system_clock::time_point ThisLoop;
+    const ControlServer::Handler handler = [this](const string& command, const string& arg) {return Command(command, arg);};
     cout << setbase(10) << flush;
+    if (!bTerminal && config.ControlSocket.empty()) {
+        BOOST_LOG_TRIVIAL(fatal) << "Without a terminal, obelix needs a control_socket to take commands";
+        throw DAQException();
+    }
+    if (!config.ControlSocket.empty() && !m_Control.Listen(config.ControlSocket)) throw DAQException();
+    m_Placement.Apply(pthread_self(), ThreadPlacement::build, "main thread");
+    m_abRun = false;
+    m_bQuit = false;
+    m_lBuiltEvents = 0;
+    m_lBuiltBytes = 0;
     BOOST_LOG_TRIVIAL(info) << "Ready to go";
+    m_abTerminal = bTerminal;
+    if (bTerminal) m_TerminalThread = thread(&DAQ::Terminal, this);
+
+    // nothing here touches the terminal: commands come through m_Control, and data or a command wakes the loop
+    while (!m_bQuit) {
+        iDataEpoch = m_DataReady.Prepare();
+        if (m_Control.Pending()) {
+            m_DataReady.Cancel();
+            m_Control.Serve(handler);
+            continue;
+        }
+        if (s_interrupted) {
+            m_DataReady.Cancel();
+            if (m_abRun) StopAcquisition();
+            break;
+        }
+        if (!m_abRun) {
+            m_DataReady.Wait(iDataEpoch, s_IdleWaitMs*1000000l);
+            continue;
+        }
+        // take what the readout threads have queued and put it in the buffer
+        iNumEvents = BuildEvents(iBufferSize);
+        if (iNumEvents == 0) m_DataReady.Wait(iDataEpoch, 10000000);
+        else m_DataReady.Cancel();
+        m_lBuiltEvents += iNumEvents;
+        m_lBuiltBytes += iBufferSize;
+        for (auto& dig : digis) if (dig->HasFailed()) throw DAQException();
+        if (m_abWriteFailed) throw DAQException();
+
+        ThisLoop = chrono::system_clock::now();
+        if (ThisLoop - PrevCheckTime < chrono::seconds(1)) continue;
+        PrevCheckTime = ThisLoop;
+        RunTime = chrono::duration_cast<chrono::seconds>(ThisLoop - m_tStart).count();
+        if ((RunTime >= config.MaxRunSeconds) || (m_aiEventsInRun >= config.MaxEventsPerRun)) {
+            if (m_abSaveWaveforms) RollOver();
+            else {
+                StopAcquisition();
+                StartAcquisition();
+            }
+        }
+    } // run loop
+    StopTerminal();
+} // Readout()
+
+void DAQ::StopTerminal() {
+    m_Control.Close(); // answers whatever is still waiting
+    m_abTerminal = false;
+    if (m_TerminalThread.joinable()) m_TerminalThread.join();
+}
+
+string DAQ::Command(const string& command, const string& arg) {
+    bool bValue(false);
+    // "write" and "testrun" toggle without an argument
+    if (((command == "write") || (command == "testrun")) && !arg.empty()) {
+        if (YesNo.count(arg) == 0) return "error: " + command + " takes yes or no";
+        bValue = YesNo.at(arg);
+    }
+    if (command == "start") {
+        if (m_abRun) return "error: already running";
+        StartAcquisition();
+    } else if (command == "stop") {
+        if (!m_abRun) return "error: not running";
+        StopAcquisition();
+    } else if (command == "trigger") {
+        if (!m_abRun) return "error: not running";
+        BOOST_LOG_TRIVIAL(info) << "Triggering";
+        digis.front()->RequestSWTrigger();
+    } else if (command == "write") {
+        if (m_abRun) {
+            BOOST_LOG_TRIVIAL(error) << "Please stop acquisition first";
+            return "error: stop acquisition first";
+        }
+        m_abSaveWaveforms = arg.empty() ? !m_abSaveWaveforms : bValue;
+        BOOST_LOG_TRIVIAL(info) << "Writing to disk " << (m_abSaveWaveforms ? "en" : "dis") << "abled";
+        if (m_abSaveWaveforms) StartAcquisition();
+    } else if (command == "testrun") {
+        lock_guard<mutex> lock(m_RunMutex);
+        m_bTestRun = arg.empty() ? !m_bTestRun : bValue;
+        BOOST_LOG_TRIVIAL(info) << "Test run " << (m_bTestRun ? "en" : "dis") << "abled";
+    } else if (command == "comment") {
+        lock_guard<mutex> lock(m_RunMutex);
+        m_sRunComment = arg;
+        BOOST_LOG_TRIVIAL(info) << "Run comment: " << arg;
+    } else if (command == "status") {
+        return Status();
+    } else if (command == "quit") {
+        if (m_abRun) StopAcquisition();
+        m_bQuit = true;
+    } else if (command == "help") {
+        return "commands: start, stop, trigger, write [yes|no], testrun [yes|no], comment <text>, status, quit";
+    } else return "error: unknown command " + command + ", try help";
+    return "ok";
+}
+
+string DAQ::Status() {
+    builder::basic::document doc{};
+    using builder::basic::kvp;
+    bool bTestRun(false);
+    string sComment("");
+    {
+        lock_guard<mutex> lock(m_RunMutex);
+        bTestRun = m_bTestRun;
+        sComment = m_sRunComment;
+    }
+    doc.append(kvp("running", (bool)m_abRun));
+    doc.append(kvp("writing", (bool)m_abSaveWaveforms));
+    doc.append(kvp("test_run", bTestRun));
+    doc.append(kvp("comment", sComment));
+    doc.append(kvp("run", (m_abRun && m_abSaveWaveforms) ? m_sRunName : ""));
+    doc.append(kvp("run_seconds", m_abRun ? (int64_t)chrono::duration_cast<chrono::seconds>(chrono::high_resolution_clock::now() - m_tStart).count() : 0));
+    doc.append(kvp("events_built", (int64_t)m_lBuiltEvents));
+    doc.append(kvp("bytes_built", (int64_t)m_lBuiltBytes));
+    doc.append(kvp("to_decode", (int64_t)m_Ring.ToDecode()));
+    doc.append(kvp("to_write", (int64_t)m_Ring.ToWrite()));
+    doc.append(kvp("events_in_file", m_aiEventsInCurrentFile.load()));
+    doc.append(kvp("events_in_run", m_aiEventsInRun.load()));
+    return bsoncxx::to_json(doc.view());
+}
+
+void DAQ::Terminal() {
+    char input('0');
+    string comment("");
+    long lPrevEvents(0), lPrevBytes(0), lBytes(0);
+    int iLogReadSize(0), OutputWidth(80);
+    double dLoopTime(0);
+    char sOutput[128];
+    const string sBlockSize = " kMGT";
+    const int iMaxLogSize = sBlockSize.size()-1;
+    auto PrevPrintTime = chrono::steady_clock::now();
+    chrono::steady_clock::time_point ThisLoop;
+    document::value status_doc{document::view{}};
     cout << "Commands:"
               << " [s] Start/stop\n"
               << " [t] Force trigger\n"
@@ -415,208 +1053,263 @@ void DAQ::Readout() {
               << " [T] Toggle automatic runs database interfacing\n"
               << " [c] Set run comment\n"
               << " [q] Quit\n";
-    unsigned int iNumEvents(0), iBufferSize(0), iTotalBuffer(0), iTotalEvents(0);
-    bool bTriggerNow(false), bQuit(false);
-    auto PrevPrintTime = chrono::system_clock::now();
-    chrono::system_clock::time_point ThisLoop;
-    int FileRunTime(0), iLogReadSize(0), OutputWidth(80);
-    char input('0');
-    double dLoopTime(0);
-    char sOutput[128];
-    const string sBlockSize = " kMGT";
-    const int iMaxLogSize = sBlockSize.size()-1;
-    thread tCommentThread = thread(&DAQ::DoesNothing, this);
     kb.init();
-    m_abRun = false;
-
-    while (!bQuit) {
-        if ((!m_abSuppressOutput) && (kb.kbhit())) {
+    while (m_abTerminal) {
+        if (kb.kbhit(s_IdleWaitMs)) {
             cin.get(input);
             switch(input) {
-                case 's' :
-                    m_abRun = !m_abRun;
-                    if (m_abRun) {
-                        StartAcquisition();
-                    } else {
-                        StopAcquisition();
-                    } break;
-                case 't' :
-                    bTriggerNow = true;
-                    break;
-                case 'w' :
-                    if (m_abRun) {
-                        BOOST_LOG_TRIVIAL(error) << "Please stop acquisition first with 's'";
-                    } else {
-                        m_abSaveWaveforms = !m_abSaveWaveforms;
-                        BOOST_LOG_TRIVIAL(info) << "Writing to disk " << (m_abSaveWaveforms ? "en" : "dis") << "abled";
-                    }
-                    if (m_abSaveWaveforms) StartAcquisition();
-                    break;
-                case 'T' :
-                    m_bTestRun = !m_bTestRun;
-                    BOOST_LOG_TRIVIAL(info) << "Test run " << (m_bTestRun ? "en" : "dis") << "abled";
-                    break;
-                case 'q' :
-                    if (m_abRun) StopAcquisition();
-                    bQuit = true;
-                    break;
+                case 's' : m_Control.Post(m_abRun ? "stop" : "start"); break;
+                case 't' : m_Control.Post("trigger"); break;
+                case 'w' : m_Control.Post("write"); break;
+                case 'T' : m_Control.Post("testrun"); break;
+                case 'q' : m_Control.Post("quit"); break;
                 case 'c' :
-                    if (tCommentThread.joinable()) tCommentThread.join();
-                    m_abSuppressOutput = true;
-                    tCommentThread = thread(&DAQ::GetNewRunComment, this);
+                    cout << "Enter new comment for run:\n";
+                    kb.deinit();
+                    // a whole line at a time now, unless obelix quits meanwhile
+                    while (m_abTerminal && !kb.kbhit(s_IdleWaitMs)) {}
+                    if (m_abTerminal && getline(cin, comment)) m_Control.Post("comment " + comment);
+                    kb.init();
+                    PrevPrintTime = chrono::steady_clock::now();
                     break;
                 default: break;
             }
             input = '0';
         }
-        if (!m_abRun) {
-            continue;
-        }
-        if (bTriggerNow) {
-            BOOST_LOG_TRIVIAL(info) << "Triggering";
-            digis.front()->SWTrigger();
-            bTriggerNow = false;
-        }
-        // read from digitizer into buffer
-        iNumEvents = 0;
-        for (auto& dig : digis) {
-            iNumEvents = dig->ReadBuffer(iBufferSize); // all digitizers should read same number of events, don't want to double-count
-            iTotalBuffer += iBufferSize;
-        }
-        iTotalEvents += iNumEvents;
-        if (iNumEvents > 0) AddEvents(buffers, iNumEvents);
-
-        ThisLoop = chrono::system_clock::now();
+        ThisLoop = chrono::steady_clock::now();
         dLoopTime = chrono::duration_cast<chrono::duration<double>>(ThisLoop - PrevPrintTime).count();
-        if ((dLoopTime > 1.0) && (!m_abSuppressOutput)) {
-            iLogReadSize = log2(iTotalBuffer)/10;
-            iLogReadSize = max(0, iLogReadSize);
-            iLogReadSize = min(iLogReadSize, iMaxLogSize);
-            FileRunTime = chrono::duration_cast<chrono::seconds>(ThisLoop - m_tStart).count();
-            if (m_abSaveWaveforms) sprintf(sOutput, "\rStatus: %4.1f %cB/s | %5f Hz | %4i sec | %i/%i | %6i/%6i ev |",
-                                                    (iTotalBuffer >> (iLogReadSize*10))/dLoopTime,
-                                                    sBlockSize[iLogReadSize],
-                                                    iTotalEvents/dLoopTime,
-                                                    FileRunTime,
-                                                    m_iToDecode.load(),
-                                                    m_iToWrite.load(),
-                                                    m_aiEventsInCurrentFile.load(),
-                                                    m_aiEventsInRun.load());
-            else sprintf(sOutput, "\rStatus: %4.1f %cB/s | %5f Hz | %4i sec | %i |",
-                                                    (iTotalBuffer >> (iLogReadSize*10))/dLoopTime,
-                                                    sBlockSize[iLogReadSize],
-                                                    iTotalEvents/dLoopTime,
-                                                    FileRunTime,
-                                                    m_iToDecode.load());
-            cout << left << setw(OutputWidth) << sOutput << flush;
-            iTotalBuffer = 0;
-            iTotalEvents = 0;
-            if ((FileRunTime >= m_fMaxFileRunTime) || (m_aiEventsInRun >= m_iMaxEventsInRun)) {
-                StopAcquisition();
-                StartAcquisition();
-            }
-            PrevPrintTime = chrono::system_clock::now();
-        } // print loop
-
-        if (s_interrupted) {
-            StopAcquisition();
-            bQuit = true;
+        if ((dLoopTime <= 1.0) || !m_abRun) continue;
+        try {
+            status_doc = bsoncxx::from_json(m_Control.Post("status"));
+        } catch (exception& e) {
+            continue; // refused, obelix is quitting
         }
-    } // run loop
-    if (tCommentThread.joinable()) tCommentThread.join();
+        auto status = status_doc.view();
+        PrevPrintTime = ThisLoop;
+        if (!status["running"].get_bool()) continue;
+        lBytes = s_get_number(status["bytes_built"]) - lPrevBytes;
+        lPrevBytes += lBytes;
+        iLogReadSize = log2(lBytes)/10;
+        iLogReadSize = max(0, iLogReadSize);
+        iLogReadSize = min(iLogReadSize, iMaxLogSize);
+        if (status["writing"].get_bool()) sprintf(sOutput, "\rStatus: %4.1f %cB/s | %5f Hz | %4i sec | %li/%li | %6i/%6i ev |",
+                                                (lBytes >> (iLogReadSize*10))/dLoopTime,
+                                                sBlockSize[iLogReadSize],
+                                                (s_get_number(status["events_built"]) - lPrevEvents)/dLoopTime,
+                                                (int)s_get_number(status["run_seconds"]),
+                                                (long)s_get_number(status["to_decode"]),
+                                                (long)s_get_number(status["to_write"]),
+                                                (int)s_get_number(status["events_in_file"]),
+                                                (int)s_get_number(status["events_in_run"]));
+        else sprintf(sOutput, "\rStatus: %4.1f %cB/s | %5f Hz | %4i sec | %li |",
+                                                (lBytes >> (iLogReadSize*10))/dLoopTime,
+                                                sBlockSize[iLogReadSize],
+                                                (s_get_number(status["events_built"]) - lPrevEvents)/dLoopTime,
+                                                (int)s_get_number(status["run_seconds"]),
+                                                (long)s_get_number(status["to_decode"]));
+        lPrevEvents = s_get_number(status["events_built"]);
+        cout << left << setw(OutputWidth) << sOutput << flush;
+    }
     kb.deinit();
-} // Readout()
+}
 
-void DAQ::AddEvents(vector<const char*>& buffer, unsigned int NumEvents) {
-    // this runs in the main thread
-    const unsigned int iSizeMask (0xFFFFFFF), iNumBytesHeader(4*sizeof(WORD));
-    vector<vector<WORD*> > vHeaders;
-    vector<vector<WORD*> > vBodies;
-    WORD* pHeader(nullptr);
-    WORD* pBody(nullptr);
-    vector<int> offset(buffer.size());
-    unsigned int iWordsInThisEvent(0);
-    bool bCallForHelp(true);
-    for (unsigned i = 0; i < NumEvents; i++) {
-        vHeaders.push_back(vector<WORD*>());
-        vBodies.push_back(vector<WORD*>());
-        for (unsigned int b = 0; b < buffer.size(); b++) {
-            iWordsInThisEvent = iSizeMask & *(WORD*)(buffer[b] + offset[b]);
-            pHeader = (WORD*)(buffer[b] + offset[b]);
-            pBody = (WORD*)(buffer[b] + offset[b] + iNumBytesHeader);
-            vHeaders.back().push_back(pHeader);
-            vBodies.back().push_back(pBody);
-            offset[b] += iWordsInThisEvent * sizeof(WORD);
+unsigned int DAQ::BuildEvents(unsigned int& iBytes, bool bFlush) {
+    unsigned int iNumEvents(0);
+    BlockRef block;
+    iBytes = 0;
+    for (unsigned b = 0; b < digis.size(); b++) {
+        while (digis[b]->PopBlock(block)) {
+            iBytes += block->size;
+            m_Metrics->BoardBytes(b, block->size);
+            m_Builder->AddBlock(b, block);
         }
-        m_vBuffer[m_iInsertPtr].Add(vHeaders.back(), vBodies.back(), m_abIsFirstEvent);
-        m_abIsFirstEvent = false;
-        m_iToDecode++;
-        while (m_abSaveWaveforms && (m_iWritePtr == (m_iInsertPtr+1)%m_iBufferLength) && (s_interrupted == 0) && (m_iToWrite != 0)) {
-            if (bCallForHelp) {
-                BOOST_LOG_TRIVIAL(warning) << "Deadtime warning";
-                bCallForHelp = false;
+    }
+    // boards that are behind keep their partners' fragments in the builder until they catch up
+    while (m_Builder->Next(m_Fragments, bFlush)) {
+        if (!AddEvent(m_Fragments)) break;
+        iNumEvents++;
+    }
+    m_Fragments.fragments.clear();
+    return iNumEvents;
+}
+
+bool DAQ::AddEvent(FragmentSet& fragments) {
+    // this runs in the main thread
+    long seq(0);
+    char* pStorage(nullptr);
+    unsigned int iBytes = (config.ZeroCopy || (m_Ring.ByteCapacity() == 0)) ? 0 : Event::StoredBytes(fragments);
+    if (iBytes > m_Ring.ByteCapacity()) { // can never fit, so this one gets its own memory
+        if (!m_bWarnedOversize) BOOST_LOG_TRIVIAL(warning) << "Event of " << iBytes << " bytes is larger than the event buffer";
+        m_bWarnedOversize = true;
+        iBytes = 0;
+    }
+    bool bFull = m_Ring.IsFull() || !m_Ring.HasRoom(iBytes), bClaimed(false);
+    if (bFull) {
+        BOOST_LOG_TRIVIAL(warning) << "Deadtime warning";
+        m_DeadTime.Begin(DeadTime::ring_full);
+    }
+    while (!(bClaimed = m_Ring.ClaimInsert(seq)) && !s_interrupted && m_abRunThreads) {}
+    if (bClaimed && (iBytes > 0)) {
+        while (((pStorage = m_Ring.ClaimBytes(iBytes)) == nullptr) && !s_interrupted && m_abRunThreads) {}
+        bClaimed = (pStorage != nullptr);
+    }
+    if (bFull) m_DeadTime.End(DeadTime::ring_full);
+    if (!bClaimed) return false;
+    if (m_bTagNextEvent) { // the new run's clock starts here
+        Event::SetUnixTS(m_tStart.time_since_epoch().count());
+        m_abIsFirstEvent = true;
+    }
+    if (config.ZeroCopy) m_Ring[seq].AddView(fragments, m_abIsFirstEvent);
+    else if (pStorage) m_Ring[seq].Add(fragments, pStorage, m_abIsFirstEvent);
+    else m_Ring[seq].Add(fragments, m_abIsFirstEvent);
+    m_Ring[seq].SetStartsRun(m_bTagNextEvent);
+    m_abIsFirstEvent = false;
+    m_bTagNextEvent = false;
+    m_Ring[seq].SetInsertTicks(MetricsClock::Ticks());
+    m_Metrics->Inserted(m_Ring[seq].ReadoutTicks(), m_Ring[seq].InsertTicks(), m_Ring.Occupancy() + 1);
+    m_Ring.PublishInsert(seq);
+    return true;
+}
+
+void DAQ::DecodeEvent(int iThread) {
+    long first(0), count(0);
+    PulseFinder finder(config.RecordLength, config.PulseThreshold, config.S2MinWidthNs);
+    EventFilter::decision_t decision(EventFilter::keep);
+    unique_ptr<NoiseHistogram> noise(m_Calibration ? new NoiseHistogram(m_Calibration.get()) : nullptr);
+    while ((m_abRunThreads) && (s_interrupted == 0)) {
+        if (!m_Ring.ClaimDecode(first, count, s_DecodeBatch)) continue;
+        for (long seq = first; seq < first+count; seq++) {
+            if (!m_Ring[seq].Decode()) {
+                // written as it came, without calibration, pulses, filtering or packing
+                m_aiDecodeErrors++;
+                BOOST_LOG_TRIVIAL(debug) << "Could not decode event at seq " << seq;
+            } else {
+                if (noise) noise->Fill(m_Ring[seq]);
+                if (config.FindPulses) finder.Process(m_Ring[seq]);
+                if (m_Filter) {
+                    decision = m_Filter->Decide(m_Ring[seq].Summary());
+                    m_Ring[seq].SetFilterDecision(decision, decision == EventFilter::prescale);
+                }
+                if (config.PackSamples && (decision != EventFilter::drop)) m_Ring[seq].Pack();
             }
-            this_thread::yield();
+            m_Ring[seq].SetDecodedTicks(MetricsClock::Ticks());
+            m_Metrics->Decoded(iThread, m_Ring[seq].InsertTicks(), m_Ring[seq].DecodedTicks());
         }
-        bCallForHelp = true;
-        m_iInsertPtr = (m_iInsertPtr+1) % m_iBufferLength;
+        BOOST_LOG_TRIVIAL(debug) << "Events decoded at seq " << first << " to " << first+count-1;
+        m_Ring.PublishDecode(first, count);
     }
 }
 
-void DAQ::DecodeEvent() {
-    while (m_abRun) {
-        while ((m_iToDecode == 0) && (m_abRunThreads) && (s_interrupted == 0)) this_thread::yield();
+void DAQ::WriteEvent() {
+    long first(0), count(0);
+    while ((m_abRunThreads) && (s_interrupted == 0)) {
+        // with nothing new to write, there is no point in going on before a batch is done
+        RetireWrites((m_InFlight.size() >= s_MaxInFlight*m_vShards.size()) || !m_Ring.CanClaimWrite());
+        if (!m_Ring.ClaimWrite(first, count, s_WriteBatch)) continue;
+        for (long seq = first; seq < first+count; seq++) SaveEvent(seq);
+        FlushWrites();
+        m_InFlight.push_back(WriteBatch{first, count, m_iShard, m_vShards[m_iShard]->Queued()});
+        BOOST_LOG_TRIVIAL(debug) << "Events written at seq " << first << " to " << first+count-1 << " by shard " << m_iShard;
+        m_iShard = (m_iShard + 1) % m_vShards.size();
+    }
+    while (!m_InFlight.empty()) RetireWrites(true);
+}
 
-        if ((!m_abRunThreads) || (s_interrupted)) return;
-        m_vBuffer[m_iDecodePtr].Decode();
-        BOOST_LOG_TRIVIAL(debug) << "Event decoded at ptr " << m_iDecodePtr;
-        m_iToDecode--;
-        m_iToWrite++;
-        m_iDecodePtr = (m_iDecodePtr+1) % m_iBufferLength;
+void DAQ::RetireWrites(bool bWait) {
+    while (!m_InFlight.empty()) {
+        WriteBatch& batch = m_InFlight.front();
+        if (bWait) m_vShards[batch.shard]->Wait(batch.ticket);
+        else if (!m_vShards[batch.shard]->Done(batch.ticket)) return;
+        // the batch was written from the slots, so they are only handed back now
+        for (long seq = batch.first; seq < batch.first+batch.count; seq++) m_Ring[seq].Clear();
+        m_Ring.PublishWrite(batch.first, batch.count);
+        m_InFlight.pop_front();
+        bWait = false;
     }
 }
 
-void DAQ::WriteEvent() {
-    while (m_abRun) {
-        while ((m_iToWrite == 0 || !m_abSaveWaveforms) && (m_abRunThreads) && (s_interrupted == 0)) this_thread::yield();
-        int NumBytes(0);
-        unsigned int EvNum(0);
-        char outfilename[256];
-
-        if ((!m_abRunThreads) || (s_interrupted)) return;
-
-        if (m_vFileInfos.back()[n_events] >= config.EventsPerFile) {
-            fout.close();
-            m_vFileInfos.push_back(file_info{0,0,0,0});
-            sprintf(outfilename, "%s%s/%s_%06i.ast", config.RawDataDir.c_str(), config.RunName.c_str(), config.RunName.c_str(), int(m_vFileInfos.size()-1));
-            fout.open(outfilename, ofstream::binary | ofstream::out);
-            m_vFileInfos.back()[file_number] = m_vFileInfos.size()-1;
+void DAQ::SaveEvent(long seq) {
+    int NumBytes(0);
+    unsigned int EvNum(0);
+    IndexRecord record;
+    m_Metrics->Written(m_Ring[seq].DecodedTicks(), MetricsClock::Ticks());
+    if (!m_abSaveWaveforms) return; // nothing to do but hand the slot back
+    if (m_Ring[seq].StartsRun()) {
+        FlushWrites();
+        SwitchRun();
+    }
+    // the run's timestamps count from this event's trigger, whatever is done with it
+    if (m_lRunFirstTrigger < 0) m_lRunFirstTrigger = m_Ring[seq].TriggerTime();
+    if (m_Ring[seq].IsIncomplete()) m_lIncomplete++;
+    if (m_Calibration) { // the histograms are all that's kept
+        m_aiEventsInRun = m_Calibration->Events();
+        return;
+    }
+    if (m_Ring[seq].FilterDecision() == EventFilter::drop) { // counted, but not written
+        m_EventClasses[EventFilter::drop][m_Ring[seq].Summary().Class()]++;
+        return;
+    }
+
+    if (m_iFileSetEvents >= config.EventsPerFile*m_vShards.size()) {
+        // the next files are already open, the old ones finish writing in the background
+        FlushWrites();
+        if (m_Compressor) m_Compressor->Flush();
+        OpenFiles();
+        // the open itself is quick, the next file was prepared in the background
+        for (auto& shard : m_vShards) {
+            shard->Sync();
+            if (shard->Failed() && !m_abWriteFailed) {
+                BOOST_LOG_TRIVIAL(fatal) << "Could not open the next file in " << shard->Dir() << ", stopping";
+                m_abWriteFailed = true;
+            }
         }
+        if (m_Compressor) m_Compressor->NewFile(m_vOpenFile[0]);
+    }
 
-        NumBytes = m_vBuffer[m_iWritePtr].Write(fout, EvNum);
+    file_info& file = m_vFileInfos[m_vOpenFile[m_iShard]];
+    NumBytes = m_Compressor ? m_Ring[seq].Write(*m_Compressor, EvNum) : m_Ring[seq].Gather(m_vWriteIov[m_iShard], EvNum);
+    m_EventClasses[m_Ring[seq].FilterDecision()][m_Ring[seq].Summary().Class()]++;
+    record.event_number = EvNum;
+    record.file_number = file[file_number];
+    record.offset = m_Compressor ? m_Compressor->BodyOffset() : m_vFileOffset[m_iShard];
+    record.timestamp = m_Ring[seq].Timestamp();
+    record.size = NumBytes;
+    record.channel_mask = m_Ring[seq].ChannelMask();
+    record.flags = m_Ring[seq].Flags();
+    record.block = m_Compressor ? m_Compressor->BlockNumber() : EventIndex::s_NoBlock;
+    m_Index.Add(record);
 
-        if (m_vFileInfos.back()[n_events] == 0) {
-            m_vFileInfos.back()[first_event] = EvNum;
-            m_vEventSizeCum.push_back(0);
-        } else {
-            m_vFileInfos.back()[last_event] = EvNum;
-            m_vEventSizeCum.push_back(m_vEventSizeCum.back() + m_vEventSizes.back());
-        }
-        m_vEventSizes.push_back(NumBytes);
+    if (file[n_events] == 0) file[first_event] = EvNum;
+    else file[last_event] = EvNum;
+    m_vFileOffset[m_iShard] += NumBytes;
+    m_lRunBytes += NumBytes;
+    m_Metrics->WrittenBytes(m_iShard, NumBytes);
 
-        m_vFileInfos.back()[n_events]++;
-        m_aiEventsInCurrentFile = m_vFileInfos.back()[n_events];
-        m_aiEventsInRun = m_vEventSizes.size();
-        m_iToWrite--;
-        BOOST_LOG_TRIVIAL(debug) << "Event written at ptr " << m_iWritePtr;
-        m_iWritePtr = (m_iWritePtr+1) % m_iBufferLength;
-    }
+    file[n_events]++;
+    m_iFileSetEvents++;
+    m_aiEventsInCurrentFile = file[n_events];
+    m_aiEventsInRun = m_Index.Records();
 }
 
-void DAQ::ResetPointers() {
-    m_iToDecode = 0;
-    m_iToWrite = 0;
-    m_iWritePtr.store(m_iInsertPtr.load());
-    m_iDecodePtr.store(m_iInsertPtr.load());
+void DAQ::FlushWrites() {
+    // what each shard got of the batch goes into its write buffers in one job
+    for (unsigned s = 0; s < m_vShards.size(); s++) if (!m_vWriteIov[s].empty()) m_vShards[s]->Write(m_vWriteIov[s]);
+}
+
+void DAQ::OpenFiles() {
+    // one file on every shard, numbered in turn, so a run's file numbers have no gaps
+    unsigned int iShards = m_vShards.size();
+    FlushWrites();
+    for (unsigned s = 0; s < iShards; s++) {
+        unsigned int iFile = m_vFileInfos.size();
+        m_vFileInfos.push_back(file_info{iFile, 0, 0, 0, s});
+        m_vOpenFile[s] = iFile;
+        m_vFileOffset[s] = 0;
+        m_vShards[s]->Open(FileName(iFile), FileName(iFile + iShards));
+        // readers find every file of the run in its directory
+        if ((s > 0) && (symlink(FileName(iFile).c_str(), FileName(iFile, config.RawDataDir).c_str()) != 0))
+            BOOST_LOG_TRIVIAL(warning) << "Could not link " << FileName(iFile) << " into " << config.RawDataDir << config.RunName << ": " << strerror(errno);
+    }
+    m_iFileSetEvents = 0;
 }
 
@@ -0,0 +1,64 @@
+#include "DeadTime.h"
+
+const char* DeadTime::Names[DeadTime::num_causes] = {"ring_full", "rollover", "restart", "board_full"};
+
+DeadTime::DeadTime() {
+    m_Open.fill(0);
+    m_Since.fill(0);
+    m_iOpen = 0;
+    m_lSince = 0;
+    m_Run = m_Total = Summary{{0, 0, 0, 0}, 0};
+}
+
+void DeadTime::Begin(cause_t cause, long lNow) {
+    lock_guard<mutex> lock(m_Mutex);
+    if (m_Open[cause]++ == 0) m_Since[cause] = lNow;
+    if (m_iOpen++ == 0) m_lSince = lNow;
+}
+
+void DeadTime::End(cause_t cause, long lNow) {
+    lock_guard<mutex> lock(m_Mutex);
+    if (m_Open[cause] == 0) return;
+    if (--m_Open[cause] == 0) {
+        long lNs = max(lNow - m_Since[cause], 0l);
+        m_Run.cause_ns[cause] += lNs;
+        m_Total.cause_ns[cause] += lNs;
+    }
+    if (--m_iOpen == 0) {
+        long lNs = max(lNow - m_lSince, 0l);
+        m_Run.dead_ns += lNs;
+        m_Total.dead_ns += lNs;
+    }
+}
+
+DeadTime::Summary DeadTime::Take(long lNow) {
+    return Collect(lNow, true);
+}
+
+DeadTime::Summary DeadTime::Totals(long lNow) {
+    return Collect(lNow, false);
+}
+
+DeadTime::Summary DeadTime::Collect(long lNow, bool bReset) {
+    lock_guard<mutex> lock(m_Mutex);
+    Summary ret = bReset ? m_Run : m_Total;
+    // open stretches count up to lNow; on a Take they go on from there
+    for (int c = 0; c < num_causes; c++) {
+        if (m_Open[c] == 0) continue;
+        long lNs = max(lNow - m_Since[c], 0l);
+        ret.cause_ns[c] += lNs;
+        if (!bReset) continue;
+        m_Total.cause_ns[c] += lNs;
+        m_Since[c] = max(m_Since[c], lNow);
+    }
+    if (m_iOpen > 0) {
+        long lNs = max(lNow - m_lSince, 0l);
+        ret.dead_ns += lNs;
+        if (bReset) {
+            m_Total.dead_ns += lNs;
+            m_lSince = max(m_lSince, lNow);
+        }
+    }
+    if (bReset) m_Run = Summary{{0, 0, 0, 0}, 0};
+    return ret;
+}
@@ -1,9 +1,120 @@
 #include "Digitizer.h"
 #include <iomanip>
+#include <chrono>
+#include <random>
+#include <set>
+#include <sstream>
+#include <sys/prctl.h>
 
-Digitizer::Digitizer() {}
+void Digitizer::AllocateBlocks(int NumBlocks, bool HugePages) {
+    m_bHugePages = HugePages;
+    try {
+        m_Pool.reset(new BlockPool(NumBlocks, [this](unsigned int& size){return MallocReadoutBuffer(size);},
+                                              [this](char* buffer){FreeReadoutBuffer(buffer);}));
+        m_Queue.reset(new BlockQueue(NumBlocks));
+    } catch (bad_alloc& e) {
+        BOOST_LOG_TRIVIAL(fatal) << "Unable to alloc " << NumBlocks << " readout buffers";
+        throw DigitizerException();
+    }
+}
+
+BlockRef Digitizer::ReadBlock() {
+    BlockRef block = m_Pool->Acquire();
+    if (!block) return block;
+    block->size = block->capacity;
+    block->NumEvents = ReadBuffer(block->data, block->size);
+    block->read_ticks = MetricsClock::Ticks();
+    if (block->NumEvents == 0) block.Reset();
+    return block;
+}
+
+void Digitizer::SetPolling(PollPolicy::mode_t Mode, long MinWaitNs, long MaxWaitNs, unsigned int IRQEvents) {
+    m_Mode = Mode;
+    m_Poll = PollPolicy(MinWaitNs, MaxWaitNs);
+    m_iIRQEvents = max(IRQEvents, 1u);
+}
+
+void Digitizer::StartReadout(WaitPoint* pDataReady, DeadTime* pDeadTime) {
+    StopReadout();
+    m_pDataReady = pDataReady;
+    m_pDeadTime = pDeadTime;
+    m_abFailed = false;
+    m_abReadout = true;
+    m_ReadoutThread = thread(&Digitizer::ReadoutLoop, this);
+}
 
-Digitizer::Digitizer(int LinkNumber, int ConetNode, int BaseAddress) {
+void Digitizer::StopReadout() {
+    m_abReadout = false;
+    m_Wake.Notify();
+    if (m_ReadoutThread.joinable()) m_ReadoutThread.join();
+}
+
+void Digitizer::ReadoutLoop() {
+    // the next transfer goes into a second block while the builder is still parsing the last one
+    BlockRef block;
+    bool bFull(false);
+    unsigned int NumEvents(0);
+    long lNow(0), lLastFullCheck(0);
+    PollPolicy::mode_t Mode(m_Mode);
+    m_Poll.Reset();
+    // the default slack lets a short sleep run 50 us over
+    if (Mode != PollPolicy::busy) prctl(PR_SET_TIMERSLACK, s_TimerSlackNs);
+    try {
+        if ((Mode == PollPolicy::interrupt) && !EnableInterrupts(m_iIRQEvents)) {
+            BOOST_LOG_TRIVIAL(warning) << "No interrupts from this board, polling it instead";
+            Mode = PollPolicy::adaptive;
+        }
+        while (m_abReadout) {
+            if (m_abSWTrigger.exchange(false)) SWTrigger();
+            block = ReadBlock();
+            lNow = chrono::steady_clock::now().time_since_epoch().count();
+            // IsFull reads a register, so empty polls only check now and then; they also
+            // cover the transfers skipped while the block pool is used up
+            if (m_pDeadTime && (block || (lNow - lLastFullCheck >= s_FullCheckNs))) {
+                lLastFullCheck = lNow;
+                if (IsFull() != bFull) {
+                    bFull = !bFull;
+                    if (bFull) m_pDeadTime->Begin(DeadTime::board_full);
+                    else m_pDeadTime->End(DeadTime::board_full);
+                }
+            }
+            NumEvents = block ? block->NumEvents : 0;
+            if (block) {
+                m_Queue->Push(block); // never full, it is as long as the pool
+                m_pDataReady->Notify();
+            }
+            if (Mode != PollPolicy::busy) Idle(Mode, m_Poll.Next(NumEvents, lNow));
+        }
+    } catch (exception& e) {
+        BOOST_LOG_TRIVIAL(fatal) << "Readout thread stopped: " << e.what();
+        m_abFailed = true;
+        m_pDataReady->Notify();
+    }
+    if (Mode == PollPolicy::interrupt) DisableInterrupts();
+    if (bFull) m_pDeadTime->End(DeadTime::board_full);
+}
+
+void Digitizer::Idle(PollPolicy::mode_t Mode, long lWaitNs) {
+    int iEpoch(0);
+    if (lWaitNs == 0) return;
+    if (Mode == PollPolicy::interrupt) {
+        // fewer than IRQEvents events are read once this times out
+        WaitForInterrupt(m_Poll.MaxWaitNs());
+        return;
+    }
+    iEpoch = m_Wake.Prepare();
+    if (m_abReadout && !m_abSWTrigger) m_Wake.Wait(iEpoch, lWaitNs);
+    else m_Wake.Cancel();
+}
+
+static string s_write_key(const GW_t& GW) {
+    stringstream ss;
+    ss << "write." << setbase(16) << GW.addr << "." << GW.mask;
+    return ss.str();
+}
+
+V1724::V1724(int LinkNumber, int ConetNode, int BaseAddress) : m_iLink(LinkNumber), m_iNode(ConetNode), m_iBaseAddress(BaseAddress),
+                                                              m_bReapply(false), m_iWritten(0), m_iUnchanged(0) {
     CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_OpenDigitizer(CAEN_DGTZ_OpticalLink, LinkNumber, ConetNode, BaseAddress, &m_iHandle);
     if (ret != CAEN_DGTZ_Success) {
         throw DigitizerException();
@@ -20,16 +131,18 @@ Digitizer::Digitizer(int LinkNumber, int ConetNode, int BaseAddress) {
     m_bRunning = false;
 }
 
-Digitizer::~Digitizer() {
+V1724::~V1724() {
+    StopReadout();
+    ClearBlocks();
     CAEN_DGTZ_SWStopAcquisition(m_iHandle);
-    CAEN_DGTZ_FreeReadoutBuffer(&buffer);
+    m_Pool.reset();
     CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_CloseDigitizer(m_iHandle);
     if (ret != CAEN_DGTZ_Success) {
         BOOST_LOG_TRIVIAL(error) << "Board" << m_iHandle << ": errors during shutdown";
     }
 }
 
-void Digitizer::StartAcquisition() {
+void V1724::StartAcquisition() {
 	CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Success;
 	ret = CAEN_DGTZ_SWStartAcquisition(m_iHandle);
 	if (ret != CAEN_DGTZ_Success) {
@@ -40,7 +153,7 @@ void Digitizer::StartAcquisition() {
     BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": acquisition started";
 }
 
-void Digitizer::StopAcquisition() {
+void V1724::StopAcquisition() {
 	CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Success;
     m_bRunning = false;
 	ret = CAEN_DGTZ_SWStopAcquisition(m_iHandle);
@@ -51,19 +164,34 @@ void Digitizer::StopAcquisition() {
     BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": acquisition stopped";
 }
 
-void Digitizer::ProgramDigitizer(ConfigSettings_t& CS) {
+void V1724::ProgramDigitizer(ConfigSettings_t& CS) {
     CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Success;
-    unsigned int val(0), AllocSize(0);
+    unsigned int val(0);
     unsigned int address(0), data(0);
+    string ch("");
+    auto tStart = chrono::steady_clock::now();
+    bool bWarm = Warm(CS);
 
-    // start with reset
-    ret = CAEN_DGTZ_Reset(m_iHandle);
-
-    if (ret != CAEN_DGTZ_Success) {
-        BOOST_LOG_TRIVIAL(fatal) << "Board " << m_iHandle << ": error resetting digitizer. Please reset manually and restart";
-        throw DigitizerException();
+    if (bWarm) {
+        // what a reset would have done besides the registers
+        CAEN_DGTZ_SWStopAcquisition(m_iHandle);
+        DisableInterrupts();
+        ret = CAEN_DGTZ_ClearData(m_iHandle);
+        if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error clearing data: " << ret;
+    } else {
+        ret = CAEN_DGTZ_Reset(m_iHandle);
+        if (ret != CAEN_DGTZ_Success) {
+            BOOST_LOG_TRIVIAL(fatal) << "Board " << m_iHandle << ": error resetting digitizer. Please reset manually and restart";
+            throw DigitizerException();
+        }
+        m_Shadow.Clear();
     }
-    ret = CAEN_DGTZ_SetRecordLength(m_iHandle, CS.RecordLength);
+    m_bReapply = false;
+    m_iWritten = m_iUnchanged = 0;
+    // half programmed, the board matches no shadow
+    if (!m_sShadowPath.empty()) CAEN_DGTZ_WriteRegister(m_iHandle, s_Scratch, 0);
+
+    ret = Apply("record_length", CS.RecordLength, [&]{return CAEN_DGTZ_SetRecordLength(m_iHandle, CS.RecordLength);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting record length: " << ret;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set record length: " << CS.RecordLength;
     ret = CAEN_DGTZ_GetRecordLength(m_iHandle, &val);
@@ -71,11 +199,12 @@ void Digitizer::ProgramDigitizer(ConfigSettings_t& CS) {
     if (val != CS.RecordLength) BOOST_LOG_TRIVIAL(warning) << "Board " << m_iHandle << ": record length, wanted " << CS.RecordLength << ", got " << val;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": record length, wanted " << CS.RecordLength << ", got " << val;
 
-    ret = CAEN_DGTZ_SetDecimationFactor(m_iHandle, 1);
+    ret = Apply("decimation", 1, [&]{return CAEN_DGTZ_SetDecimationFactor(m_iHandle, 1);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Problem setting decimation factor";
     else BOOST_LOG_TRIVIAL(debug) << "Set decimation factor";
 
-    ret = CAEN_DGTZ_SetPostTriggerSize(m_iHandle, CS.PostTrigger);
+    // in percent of the record length, so it has to follow it
+    ret = Apply("post_trigger", (CS.RecordLength << 8) | CS.PostTrigger, [&]{return CAEN_DGTZ_SetPostTriggerSize(m_iHandle, CS.PostTrigger);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting post trigger: " << ret;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set post trigger: " << CS.PostTrigger;
     ret = CAEN_DGTZ_GetPostTriggerSize(m_iHandle, &val);
@@ -83,84 +212,168 @@ void Digitizer::ProgramDigitizer(ConfigSettings_t& CS) {
     if (val != CS.PostTrigger) BOOST_LOG_TRIVIAL(warning) << "Board " << m_iHandle << ": post trigger, wanted " << CS.PostTrigger << ", got " << val;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": post trigger, wanted " << CS.PostTrigger << ", got " << val;
 
-    ret = CAEN_DGTZ_SetIOLevel(m_iHandle, CS.FPIO);
+    ret = Apply("io_level", CS.FPIO, [&]{return CAEN_DGTZ_SetIOLevel(m_iHandle, CS.FPIO);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting IO level: " << ret;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set IO level: " << CS.FPIO;
 
-    ret = CAEN_DGTZ_SetMaxNumEventsBLT(m_iHandle, CS.BlockTransfer);
+    ret = Apply("block_transfer", CS.BlockTransfer, [&]{return CAEN_DGTZ_SetMaxNumEventsBLT(m_iHandle, CS.BlockTransfer);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting block block transfer: " << ret;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set block transfer: " << CS.BlockTransfer;
 
-    ret = CAEN_DGTZ_SetAcquisitionMode(m_iHandle, CAEN_DGTZ_SW_CONTROLLED);
+    ret = Apply("acquisition_mode", CAEN_DGTZ_SW_CONTROLLED, [&]{return CAEN_DGTZ_SetAcquisitionMode(m_iHandle, CAEN_DGTZ_SW_CONTROLLED);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting aquisition mode: " << ret;
-    ret = CAEN_DGTZ_SetExtTriggerInputMode(m_iHandle, CS.ExtTriggerMode);
+    ret = Apply("external_trigger", CS.ExtTriggerMode, [&]{return CAEN_DGTZ_SetExtTriggerInputMode(m_iHandle, CS.ExtTriggerMode);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting external trigger mode: " << ret;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set external trigger mode: " << CS.ExtTriggerMode;
 
-    ret = CAEN_DGTZ_SetChannelEnableMask(m_iHandle, CS.EnableMask);
+    ret = Apply("enable_mask", CS.EnableMask, [&]{return CAEN_DGTZ_SetChannelEnableMask(m_iHandle, CS.EnableMask);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel mask: " << ret;
     ret = CAEN_DGTZ_GetChannelEnableMask(m_iHandle, &val);
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error checking channel mask: " << ret;
     if (val != CS.EnableMask) BOOST_LOG_TRIVIAL(warning) << "Board " << m_iHandle << ": desired " << CS.EnableMask << " mask, got " << val;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": desired " << CS.EnableMask << " mask, got " << val;
 
-    ret = CAEN_DGTZ_SetChannelSelfTrigger(m_iHandle, CS.ChTriggerMode, 0xFF);
+    ret = Apply("channel_trigger", CS.ChTriggerMode, [&]{return CAEN_DGTZ_SetChannelSelfTrigger(m_iHandle, CS.ChTriggerMode, 0xFF);});
     if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel trigger mode: " << ret;
     else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel trigger mode: " << CS.ChTriggerMode;
 
+    // for the whole board, and turned off again when a cached board had it on
+    ret = Apply("zero_suppression", CS.IsZLE ? CAEN_DGTZ_ZS_ZLE : CAEN_DGTZ_ZS_NO,
+                [&]{return CAEN_DGTZ_SetZeroSuppressionMode(m_iHandle, CS.IsZLE ? CAEN_DGTZ_ZS_ZLE : CAEN_DGTZ_ZS_NO);});
+    if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting zero suppression mode: " << ret;
+    else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set zero suppression mode: " << (CS.IsZLE ? "ZLE" : "none");
+
     for (auto& ch_set : CS.ChannelSettings) {
         if (!ch_set.Enabled)
             continue;
-        ret = CAEN_DGTZ_SetChannelDCOffset(m_iHandle, ch_set.Channel, ch_set.DCoffset);
+        ch = "ch" + to_string(ch_set.Channel) + ".";
+        ret = Apply(ch + "dc_offset", ch_set.DCoffset, [&]{return CAEN_DGTZ_SetChannelDCOffset(m_iHandle, ch_set.Channel, ch_set.DCoffset);});
         if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " DC offset: " << ret;
         else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " DC offset to " << ch_set.DCoffset;
 
-        ret = CAEN_DGTZ_SetChannelTriggerThreshold(m_iHandle, ch_set.Channel, iBaselineRef - ch_set.TriggerThreshold);
+        ret = Apply(ch + "trigger_threshold", iBaselineRef - ch_set.TriggerThreshold,
+                    [&]{return CAEN_DGTZ_SetChannelTriggerThreshold(m_iHandle, ch_set.Channel, iBaselineRef - ch_set.TriggerThreshold);});
         if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " trigger threshold: " << ret;
         else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " trigger threshold to " << ch_set.TriggerThreshold;
 
-        ret = CAEN_DGTZ_SetTriggerPolarity(m_iHandle, ch_set.Channel, CAEN_DGTZ_TriggerOnFallingEdge);
+        ret = Apply(ch + "trigger_polarity", CAEN_DGTZ_TriggerOnFallingEdge,
+                    [&]{return CAEN_DGTZ_SetTriggerPolarity(m_iHandle, ch_set.Channel, CAEN_DGTZ_TriggerOnFallingEdge);});
         if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " trigger polarity to falling:" << ret;
         else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " trigger polarity to falling";
 
-        ret = CAEN_DGTZ_SetChannelPulsePolarity(m_iHandle, ch_set.Channel, CAEN_DGTZ_PulsePolarityNegative);
+        ret = Apply(ch + "pulse_polarity", CAEN_DGTZ_PulsePolarityNegative,
+                    [&]{return CAEN_DGTZ_SetChannelPulsePolarity(m_iHandle, ch_set.Channel, CAEN_DGTZ_PulsePolarityNegative);});
         if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " pulse polarity to negative";
         else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " pulse polarity to negative";
 
         if (CS.IsZLE) {
-            ret = CAEN_DGTZ_SetZeroSuppressionMode(m_iHandle, CAEN_DGTZ_ZS_ZLE);
-            if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " ZLE mode: " << ret;
-            else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " ZLE mode";
-
-            ret = CAEN_DGTZ_SetChannelZSParams(m_iHandle, ch_set.Channel, CAEN_DGTZ_ZS_FINE, iBaselineRef - ch_set.ZLEThreshold, 0);
+            ret = Apply(ch + "zle_threshold", iBaselineRef - ch_set.ZLEThreshold,
+                        [&]{return CAEN_DGTZ_SetChannelZSParams(m_iHandle, ch_set.Channel, CAEN_DGTZ_ZS_FINE, iBaselineRef - ch_set.ZLEThreshold, 0);});
             if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " ZLE threshold: " << ret;
             else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " ZLE threshold";
 
             address = CAEN_DGTZ_CHANNEL_ZS_NSAMPLE_BASE_ADDRESS + (0x100 * ch_set.Channel);
             data = (ch_set.ZLE_N_LBK << 16) + ch_set.ZLE_N_LFWD;
             BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": writing 0x" << setbase(16) << data << " to 0x" << address;
-            ret = WriteRegister(GW_t{m_iHandle, address, data, 0xFFFFFFFF});
+            ret = ApplyWrite(ch + "zle_samples", GW_t{m_iHandle, address, data, 0xFFFFFFFF});
             if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": error setting channel " << ch_set.Channel << " ZLE parameters: " << ret;
             else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": set channel " << ch_set.Channel << " ZLE parameters";
         }
     }
 
     for (auto& GW : CS.GenericWrites) {
-        ret = WriteRegister(GW);
+        ret = ApplyWrite(s_write_key(GW), GW);
         if (ret != CAEN_DGTZ_Success) BOOST_LOG_TRIVIAL(error) << "Board " << m_iHandle << ": Error with register write: " << ret << setbase(16) << ", tried to write value 0x" << GW.data << " to 0x" << GW.addr << " with mask 0x" << GW.mask;
         else BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << " wrote " << setbase(16) << "0x" << GW.data << " to 0x" << GW.addr << " with mask 0x" << GW.mask << setbase(10);
     }
-    buffer = nullptr;
-    ret = CAEN_DGTZ_MallocReadoutBuffer(m_iHandle, &buffer, &AllocSize);
 
+    if (!m_sShadowPath.empty()) {
+        random_device rd;
+        WORD stamp(0);
+        do stamp = rd(); while ((stamp == 0) || (stamp == m_Shadow.Stamp()));
+        m_Shadow.SetStamp(stamp);
+        // saved first: a board stamped without its shadow saved would be trusted with an older one
+        if (!m_Shadow.Save(m_sShadowPath)) BOOST_LOG_TRIVIAL(warning) << "Board " << m_iHandle << ": could not save " << m_sShadowPath << ", it will be reset next time";
+        else if (CAEN_DGTZ_WriteRegister(m_iHandle, s_Scratch, stamp) != CAEN_DGTZ_Success)
+            BOOST_LOG_TRIVIAL(warning) << "Board " << m_iHandle << ": could not write the scratch register, it will be reset next time";
+    }
+    BOOST_LOG_TRIVIAL(info) << "Board " << m_iHandle << " ready with mask " << CS.EnableMask << ", " << (bWarm ? "kept its registers" : "reset")
+        << ", " << m_iWritten << " settings made, " << m_iUnchanged << " unchanged, in "
+        << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tStart).count() << " ms";
+}
+
+void V1724::SetRegisterCache(const string& Dir) {
+    stringstream ss;
+    if (Dir.empty()) {
+        m_sShadowPath = "";
+        return;
+    }
+    ss << Dir << (Dir.back() == '/' ? "" : "/") << "board_" << m_iLink << "_" << m_iNode << "_" << setbase(16) << m_iBaseAddress << ".regs";
+    m_sShadowPath = ss.str();
+}
+
+bool V1724::Warm(const ConfigSettings_t& CS) {
+    WORD stamp(0);
+    set<string> writes;
+    if (m_sShadowPath.empty() || !m_Shadow.Load(m_sShadowPath)) return false;
+    if ((CAEN_DGTZ_ReadRegister(m_iHandle, s_Scratch, &stamp) != CAEN_DGTZ_Success) || (stamp != m_Shadow.Stamp())) {
+        BOOST_LOG_TRIVIAL(info) << "Board " << m_iHandle << ": changed since " << m_sShadowPath << " was saved, resetting it";
+        return false;
+    }
+    // what a dropped write left in a register only a reset takes out
+    for (auto& GW : CS.GenericWrites) writes.insert(s_write_key(GW));
+    for (auto& name : m_Shadow.Names("write.")) if (writes.count(name) == 0) {
+        BOOST_LOG_TRIVIAL(info) << "Board " << m_iHandle << ": register write " << name.substr(6) << " is gone from the config, resetting it";
+        return false;
+    }
+    return true;
+}
+
+CAEN_DGTZ_ErrorCode V1724::Apply(const string& setting, WORD value, const function<CAEN_DGTZ_ErrorCode()>& Set) {
+    if (m_Shadow.Has(setting, value)) {
+        m_iUnchanged++;
+        return CAEN_DGTZ_Success;
+    }
+    CAEN_DGTZ_ErrorCode ret = Set();
+    // the library reads and writes registers of its own
+    m_Shadow.Forget();
+    m_bReapply = true;
+    if (ret == CAEN_DGTZ_Success) {
+        m_Shadow.Set(setting, value);
+        m_iWritten++;
+    }
+    return ret;
+}
+
+CAEN_DGTZ_ErrorCode V1724::ApplyWrite(const string& setting, const GW_t& GW) {
+    if (!m_bReapply && m_Shadow.Has(setting, GW.data)) {
+        m_iUnchanged++;
+        return CAEN_DGTZ_Success;
+    }
+    CAEN_DGTZ_ErrorCode ret = WriteRegister(GW);
+    if (ret == CAEN_DGTZ_Success) {
+        m_Shadow.Set(setting, GW.data);
+        m_iWritten++;
+    }
+    return ret;
+}
+
+char* V1724::MallocReadoutBuffer(unsigned int& AllocSize) {
+    char* buffer(nullptr);
+    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_MallocReadoutBuffer(m_iHandle, &buffer, &AllocSize);
     if (ret != CAEN_DGTZ_Success) {
         BOOST_LOG_TRIVIAL(fatal) << "Board " << m_iHandle << " unable to alloc readout buffer: " << ret << "\n";
         throw DigitizerException();
     }
-    BOOST_LOG_TRIVIAL(info) << "Board " << m_iHandle << " ready with mask " << CS.EnableMask << "\n";
+    if (m_bHugePages) HugePages::Lock(buffer, AllocSize); // the library allocates these itself
+    return buffer;
 }
 
-unsigned int Digitizer::ReadBuffer(unsigned int& BufferSize) {
+void V1724::FreeReadoutBuffer(char* buffer) {
+    CAEN_DGTZ_FreeReadoutBuffer(&buffer);
+}
+
+unsigned int V1724::ReadBuffer(char* buffer, unsigned int& BufferSize) {
     unsigned int NumEvents(0);
     CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Success;
     ret = CAEN_DGTZ_ReadData(m_iHandle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, buffer, &BufferSize);
@@ -179,17 +392,56 @@ unsigned int Digitizer::ReadBuffer(unsigned int& BufferSize) {
     return NumEvents;
 }
 
-CAEN_DGTZ_ErrorCode Digitizer::WriteRegister(GW_t GW, bool bForce) {
-    WORD temp = 0;
-    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_ReadRegister(m_iHandle, GW.addr, &temp);
+bool V1724::IsFull() {
+    WORD status(0);
+    if (CAEN_DGTZ_ReadRegister(m_iHandle, s_AcquisitionStatus, &status) != CAEN_DGTZ_Success) return false;
+    return status & s_EventFull;
+}
+
+bool V1724::EnableInterrupts(unsigned int NumEvents) {
+    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_SetInterruptConfig(m_iHandle, CAEN_DGTZ_ENABLE, s_IRQLevel, s_IRQStatusID,
+                                                           NumEvents, CAEN_DGTZ_IRQ_MODE_RORA);
     if (ret != CAEN_DGTZ_Success) {
-        BOOST_LOG_TRIVIAL(error) << "Error reading board " << m_iHandle << " register " << setbase(16) << "0x" << GW.addr << setbase(10);
-        if (!bForce) return ret;
+        BOOST_LOG_TRIVIAL(warning) << "Board " << m_iHandle << ": could not enable interrupts. Error " << ret;
+        return false;
+    }
+    BOOST_LOG_TRIVIAL(debug) << "Board " << m_iHandle << ": interrupt every " << NumEvents << " events";
+    return true;
+}
+
+void V1724::DisableInterrupts() {
+    CAEN_DGTZ_SetInterruptConfig(m_iHandle, CAEN_DGTZ_DISABLE, s_IRQLevel, s_IRQStatusID, 1, CAEN_DGTZ_IRQ_MODE_RORA);
+}
+
+bool V1724::WaitForInterrupt(long lTimeoutNs) {
+    // release on acknowledge: the request stays up until the events are read
+    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_IRQWait(m_iHandle, max(lTimeoutNs / 1000000, 1l));
+    if ((ret != CAEN_DGTZ_Success) && (ret != CAEN_DGTZ_Timeout)) {
+        BOOST_LOG_TRIVIAL(fatal) << "Board " << m_iHandle << ": error waiting for interrupt. Error " << ret;
+        throw DigitizerException();
+    }
+    return ret == CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode V1724::WriteRegister(GW_t GW, bool bForce) {
+    WORD temp = 0, old = 0;
+    CAEN_DGTZ_ErrorCode ret = CAEN_DGTZ_Success;
+    // only what this board wrote itself is trusted to be there, not what a read says
+    bool bKnown = m_Shadow.Known(GW.addr, old);
+    if (bKnown) temp = old;
+    else if (GW.mask != 0xFFFFFFFF) {
+        ret = CAEN_DGTZ_ReadRegister(m_iHandle, GW.addr, &temp);
+        if (ret != CAEN_DGTZ_Success) {
+            BOOST_LOG_TRIVIAL(error) << "Error reading board " << m_iHandle << " register " << setbase(16) << "0x" << GW.addr << setbase(10);
+            if (!bForce) return ret;
+        }
     }
 
     temp &= ~GW.mask;
     temp |= GW.data;
+    if (bKnown && (temp == old)) return CAEN_DGTZ_Success;
     ret = CAEN_DGTZ_WriteRegister(m_iHandle, GW.addr, temp);
+    if (ret == CAEN_DGTZ_Success) m_Shadow.Write(GW.addr, temp);
     return ret;
 }
 
@@ -1,72 +1,193 @@
 #include "Event.h"
 #include <cstring>
 
-int Event::s_TimestampRollovers = 0;
-long Event::s_LastTimestamp = 0;
 long Event::s_FirstEventTimestamp = 0;
-int Event::s_FirstEventNumber = 0;
 atomic<long> Event::s_UnixTSStart;
+thread_local vector<char> Event::s_vPackScratch;
 
-Event::Event() {}
+Event::Event() {
+    m_ChannelStart.fill(0);
+    m_lTriggerTime = 0;
+    m_Summary = PulseSummary{0, 0, 0, 0, 0, -1, -1, 0};
+    m_iFilterDecision = 0;
+    m_bStartsRun = false;
+    m_lReadoutTicks = m_lInsertTicks = m_lDecodedTicks = 0;
+    m_pStorage = nullptr;
+    m_iStorageSize = 0;
+    m_iStoredBytes = 0;
+}
 
 Event::~Event() {}
 
-void Event::Add(const vector<WORD*>& headers, const vector<WORD*>& bodies, bool IsFirstEvent) {
-    vector<unsigned int> EventSizes, ChannelMasks, BoardIDs;
+int Event::MakeHeader(const FragmentSet& fragments, bool IsFirstEvent) {
     unsigned long lTimestamp(0);
-    unsigned int iEventCounter(0), iTimestamp(0);
     bool bIsZLE(false);
     unsigned int iEventChannelMask(0);
     int iNumWordsBody(0), iNumWordsHeader(4);
     int iNumBytesEvent(0), iNumBytesBody(0);
-    for (auto& header : headers) {
-        EventSizes.push_back(header[0] & s_EventSizeMask);
-        iNumWordsBody += (EventSizes.back() - iNumWordsHeader);
-        BoardIDs.push_back((header[1] & s_BoardIDMask) >> s_BoardIDShift);
-        ChannelMasks.push_back(header[1] & s_ChannelMaskMask);
-        iEventCounter = header[2] & s_CounterMask;
-        bIsZLE = header[1] & s_ZLEMask;
-        iTimestamp = header[3];
-    }
-    if (IsFirstEvent) {
-        Event::s_FirstEventNumber = iEventCounter;
-        Event::s_FirstEventTimestamp = iTimestamp;
+    m_lReadoutTicks = 0;
+    for (auto& frag : fragments.fragments) {
+        if (frag.block && ((m_lReadoutTicks == 0) || (frag.block->read_ticks < m_lReadoutTicks))) m_lReadoutTicks = frag.block->read_ticks;
+        iNumWordsBody += ((frag.header[0] & s_BoardSizeMask) - iNumWordsHeader);
+        iEventChannelMask |= (frag.header[1] & s_ChannelMaskMask) << (NUM_CH*frag.board);
+        bIsZLE = frag.header[1] & s_ZLEMask;
     }
-    if (iTimestamp < s_LastTimestamp) s_TimestampRollovers++; // CAEN timestamp rolls over every 43 seconds
-    lTimestamp = iTimestamp + s_TimestampRollovers * s_TimestampOffset;
-    s_LastTimestamp = iTimestamp;
-    lTimestamp = s_UnixTSStart + (lTimestamp - Event::s_FirstEventTimestamp)*s_NsPerTriggerClock;
-    iEventCounter = iEventCounter - Event::s_FirstEventNumber;
-    for (unsigned i = 0; i < ChannelMasks.size(); i++) iEventChannelMask |= (ChannelMasks[i] << (NUM_CH*BoardIDs[i]));
+    if (IsFirstEvent) Event::s_FirstEventTimestamp = fragments.timestamp;
+    lTimestamp = s_UnixTSStart + (fragments.timestamp - Event::s_FirstEventTimestamp)*s_NsPerTriggerClock;
     iNumBytesBody = iNumWordsBody * sizeof(WORD);
     iNumBytesEvent = iNumBytesBody + m_Header.size()*sizeof(WORD);
 
+    m_Header[0] = fragments.number | Event::s_HeaderStartIndicator; // assuming we don't get 1 << 30 events in a run ;)
+    m_Header[1] = iEventChannelMask;
+    m_Header[2] = iNumBytesEvent | (bIsZLE ? s_ZLEFlag : 0) | (fragments.incomplete ? s_IncompleteFlag : 0);
+    m_Header[3] = lTimestamp >> 32;
+    m_Header[4] = lTimestamp & (0xFFFFFFFFl);
+    m_lTriggerTime = fragments.timestamp;
+    return iNumBytesBody;
+}
+
+unsigned int Event::StoredBytes(const FragmentSet& fragments) {
+    unsigned int iBytes(s_HeaderBytes);
+    for (auto& frag : fragments.fragments) iBytes += ((frag.header[0] & s_BoardSizeMask) - 4)*sizeof(WORD);
+    return iBytes;
+}
+
+void Event::Add(const FragmentSet& fragments, bool IsFirstEvent) {
+    int iNumBytesBody = MakeHeader(fragments, IsFirstEvent);
     try {
         m_Body.resize(iNumBytesBody);
     } catch (exception& e) {
         throw bad_alloc();
     }
-    char* cPtr(m_Body.data());
-    for (unsigned i = 0; i < headers.size(); i++) {
-        memcpy(cPtr, bodies[i], (EventSizes[i]-4)*sizeof(WORD));
-        cPtr += (EventSizes[i]-4)*sizeof(WORD);
+    m_iStoredBytes = 0;
+    CopyBodies(fragments, m_Body.data());
+}
+
+void Event::Add(const FragmentSet& fragments, char* pStorage, bool IsFirstEvent) {
+    int iNumBytesBody = MakeHeader(fragments, IsFirstEvent);
+    m_Body.clear();
+    m_pStorage = pStorage;
+    m_iStorageSize = m_iStoredBytes = s_HeaderBytes + iNumBytesBody;
+    CopyBodies(fragments, pStorage + s_HeaderBytes);
+}
+
+void Event::CopyBodies(const FragmentSet& fragments, char* pBody) {
+    unsigned int iNumBytesBoard(0);
+    char* cPtr(pBody);
+    m_vSpans.clear();
+    m_vBlocks.clear();
+    m_vBoardBodies.clear();
+    for (auto& frag : fragments.fragments) {
+        iNumBytesBoard = ((frag.header[0] & s_BoardSizeMask) - 4)*sizeof(WORD);
+        memcpy(cPtr, frag.header + 4, iNumBytesBoard);
+        m_vBoardBodies.push_back(BoardBody{(const WORD*)cPtr, iNumBytesBoard/(unsigned int)sizeof(WORD), frag.board,
+                                           frag.header[1] & s_ChannelMaskMask, (frag.header[1] & s_ZLEMask) != 0});
+        cPtr += iNumBytesBoard;
     }
-    m_Header[0] = iEventCounter | Event::s_HeaderStartIndicator; // assuming we don't get 1 << 30 events in a run ;)
-    m_Header[1] = iEventChannelMask;
-    m_Header[2] = bIsZLE ? iNumBytesEvent | (1 << 31) : iNumBytesEvent;
-    m_Header[3] = lTimestamp >> 32;
-    m_Header[4] = lTimestamp & (0xFFFFFFFFl);
 }
 
-void Event::Decode() {
-    // nothing here, but we have the option
+void Event::AddView(const FragmentSet& fragments, bool IsFirstEvent) {
+    MakeHeader(fragments, IsFirstEvent);
+    m_Body.clear();
+    m_iStoredBytes = 0;
+    m_vSpans.clear();
+    m_vBlocks.clear();
+    m_vBoardBodies.clear();
+    for (auto& frag : fragments.fragments) {
+        m_vSpans.push_back(BodySpan{(const char*)(frag.header + 4), ((frag.header[0] & s_BoardSizeMask) - 4)*(unsigned int)sizeof(WORD)});
+        m_vBlocks.push_back(frag.block);
+        m_vBoardBodies.push_back(BoardBody{frag.header + 4, (frag.header[0] & s_BoardSizeMask) - 4, frag.board,
+                                           frag.header[1] & s_ChannelMaskMask, (frag.header[1] & s_ZLEMask) != 0});
+    }
 }
 
-int Event::Write(ofstream& fout, unsigned int& EvNum) {
-    fout.write((char*)m_Header.data(), m_Header.size()*sizeof(WORD));
-    fout.write(m_Body.data(), m_Body.size());
+void Event::Clear() {
+    m_vSpans.clear();
+    m_vBlocks.clear();
+    m_vBoardBodies.clear();
+    m_vSegments.clear();
+    m_ChannelStart.fill(0);
+    m_Summary = PulseSummary{0, 0, 0, 0, 0, -1, -1, 0};
+    m_iFilterDecision = 0;
+    m_bStartsRun = false;
+    m_lReadoutTicks = m_lInsertTicks = m_lDecodedTicks = 0;
+    m_iStoredBytes = 0;
+}
+
+bool Event::Decode() {
+    bool bGood(true);
+    m_vSegments.clear();
+    m_ChannelStart.fill(0);
+    for (auto& b : m_vBoardBodies) {
+        if ((b.board < 0) || ((b.board+1)*NUM_CH >= (int)m_ChannelStart.size())) {
+            bGood = false;
+            continue;
+        }
+        bGood &= ChannelParser::Parse(b.body, b.words, b.mask, b.zle, b.board*NUM_CH, m_vSegments, m_ChannelStart.data());
+    }
+    // channels without segments start where the next one does
+    for (unsigned ch = 1; ch < m_ChannelStart.size(); ch++) m_ChannelStart[ch] = max(m_ChannelStart[ch], m_ChannelStart[ch-1]);
+    return bGood;
+}
+
+void Event::Pack() {
+    unsigned int iBound(0), iPackedBytes(0), iHeaderBytes(m_Header.size()*sizeof(WORD));
+    // in given storage the packed body is copied back over the original, so the scratch can be per thread
+    vector<char>& vPacked = (m_iStoredBytes > 0) ? s_vPackScratch : m_Packed;
+    for (auto& b : m_vBoardBodies) iBound += SampleCodec::MaxEncodedSize(b.words*sizeof(WORD));
+    if (vPacked.size() < iBound) vPacked.resize(iBound);
+    for (auto& b : m_vBoardBodies) iPackedBytes += SampleCodec::Encode((const char*)b.body, b.words*sizeof(WORD), vPacked.data() + iPackedBytes);
+    if (m_iStoredBytes > 0) {
+        if (iHeaderBytes + iPackedBytes > m_iStoredBytes) return; // incompressible, stays as it is
+        memcpy(m_pStorage + iHeaderBytes, vPacked.data(), iPackedBytes);
+        m_iStoredBytes = iHeaderBytes + iPackedBytes;
+    } else {
+        // the body is in m_Packed now, so readout blocks can go back early
+        swap(m_Body, m_Packed);
+        m_Body.resize(iPackedBytes);
+        m_vSpans.clear();
+        m_vBlocks.clear();
+    }
+    m_vBoardBodies.clear();
+    m_vSegments.clear();
+    m_ChannelStart.fill(0);
+    m_Header[2] = (m_Header[2] & ~s_EventSizeMask) | s_PackedFlag | (iHeaderBytes + iPackedBytes);
+}
+
+int Event::Write(FileWriter& writer, unsigned int& EvNum) {
+    static thread_local vector<struct iovec> s_vIov;
+    s_vIov.clear();
+    int iBytes = Gather(s_vIov, EvNum);
+    writer.Write(s_vIov.data(), s_vIov.size());
+    return iBytes;
+}
+
+int Event::Gather(vector<struct iovec>& vIov, unsigned int& EvNum) {
+    if (m_iStoredBytes > 0) {
+        // room for the header was left in front of the body, so it goes out in one piece
+        memcpy(m_pStorage, m_Header.data(), s_HeaderBytes);
+        vIov.push_back(iovec{m_pStorage, m_iStoredBytes});
+    } else {
+        vIov.push_back(iovec{m_Header.data(), m_Header.size()*sizeof(WORD)});
+        if (m_vSpans.empty()) vIov.push_back(iovec{m_Body.data(), m_Body.size()});
+        else for (auto& span : m_vSpans) vIov.push_back(iovec{(void*)span.data, span.size});
+    }
+    EvNum = m_Header[0] & (0x3FFFFFFF);
+    return m_Header[2] & s_EventSizeMask;
+}
+
+int Event::Write(Compressor& compressor, unsigned int& EvNum) {
+    compressor.AddHeader((char*)m_Header.data(), m_Header.size()*sizeof(WORD));
+    if (m_iStoredBytes > 0) compressor.AddBody(m_pStorage + s_HeaderBytes, m_iStoredBytes - s_HeaderBytes);
+    else if (m_vSpans.empty()) compressor.AddBody(m_Body.data(), m_Body.size());
+    else for (auto& span : m_vSpans) compressor.AddBody(span.data, span.size);
     EvNum = m_Header[0] & (0x3FFFFFFF);
-    return m_Header[2] & 0x7FFFFFFF;
+    return m_Header[2] & s_EventSizeMask;
+}
+
+void Event::SetFilterDecision(int Decision, bool IsPrescaled) {
+    m_iFilterDecision = Decision;
+    if (IsPrescaled) m_Header[2] |= s_PrescaledFlag;
 }
 
 void Event::SetUnixTS(long ts) {
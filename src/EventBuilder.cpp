@@ -0,0 +1,82 @@
+#include "EventBuilder.h"
+
+EventBuilder::EventBuilder(int NumBoards, long lWindowNs, long lTimeoutMs) : m_vBoards(NumBoards), m_Timeout(lTimeoutMs) {
+    m_lWindow = lWindowNs / s_NsPerTriggerClock;
+    Reset();
+}
+
+void EventBuilder::Reset() {
+    for (auto& b : m_vBoards) {
+        b.queue.clear();
+        b.LastTTT = 0;
+        b.rollovers = 0;
+        b.latest = -1;
+    }
+    m_lLastBuilt = -1;
+    NewRun();
+}
+
+void EventBuilder::NewRun() {
+    m_iEventNumber = 0;
+    m_lIncomplete = 0;
+    m_lOrphans = 0;
+}
+
+void EventBuilder::AddBlock(int board, BlockRef& block) {
+    BoardState& state = m_vBoards[board];
+    auto tNow = chrono::steady_clock::now();
+    unsigned int iOffset(0), iTTT(0);
+    WORD* pHeader(nullptr);
+    for (unsigned int i = 0; i < block->NumEvents; i++) {
+        pHeader = (WORD*)(block->data + iOffset);
+        iOffset += (pHeader[0] & s_BoardSizeMask) * sizeof(WORD);
+        iTTT = pHeader[3] & s_TimestampMask;
+        if (iTTT < state.LastTTT) state.rollovers++; // CAEN timestamp rolls over every 43 seconds, separately on each board
+        state.LastTTT = iTTT;
+        state.latest = iTTT + state.rollovers * s_TimestampOffset;
+        state.queue.push_back(Pending{Fragment{pHeader, board, state.latest, block}, tNow});
+    }
+    block.Reset();
+}
+
+bool EventBuilder::Next(FragmentSet& event, bool bFlush) {
+    int iEarliest(-1), iMatched(0);
+    bool bMissing(false), bUndecided(false), bLate(false);
+    event.fragments.clear();
+    for (unsigned b = 0; b < m_vBoards.size(); b++) {
+        if (m_vBoards[b].queue.empty()) continue;
+        if ((iEarliest < 0) || (m_vBoards[b].queue.front().fragment.timestamp < m_vBoards[iEarliest].queue.front().fragment.timestamp))
+            iEarliest = b;
+    }
+    if (iEarliest < 0) return false;
+    const Pending& first = m_vBoards[iEarliest].queue.front();
+    long lEnd = first.fragment.timestamp + m_lWindow;
+    for (auto& b : m_vBoards) {
+        if (!b.queue.empty() && (b.queue.front().fragment.timestamp <= lEnd)) continue;
+        bMissing = true;
+        // a board that has already sent something later won't send this one any more
+        if (b.latest <= lEnd) bUndecided = true;
+    }
+    if (bUndecided && !bFlush && (chrono::steady_clock::now() - first.arrival < m_Timeout)) return false;
+    // its window overlaps an event already built, which it should have been part of
+    bLate = (m_lLastBuilt >= 0) && (first.fragment.timestamp <= m_lLastBuilt + m_lWindow);
+    m_lLastBuilt = max(m_lLastBuilt, first.fragment.timestamp);
+
+    event.timestamp = first.fragment.timestamp;
+    event.number = m_iEventNumber++;
+    event.incomplete = bMissing;
+    for (auto& b : m_vBoards) {
+        if (b.queue.empty() || (b.queue.front().fragment.timestamp > lEnd)) continue;
+        event.fragments.push_back(move(b.queue.front().fragment));
+        b.queue.pop_front();
+        iMatched++;
+    }
+    if (bLate) {
+        m_lOrphans += iMatched;
+        BOOST_LOG_TRIVIAL(debug) << "Event " << event.number << " built from " << iMatched << " fragments that came after their event";
+    } else if (bMissing) {
+        m_lIncomplete++;
+        BOOST_LOG_TRIVIAL(debug) << "Event " << event.number << " built from " << iMatched << " of " << m_vBoards.size() << " boards";
+    }
+    return true;
+}
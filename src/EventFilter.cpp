@@ -0,0 +1,14 @@
+#include "EventFilter.h"
+
+EventFilter::EventFilter(int MinChannels, int MinArea, int MinHeight, int Prescale) :
+    m_iMinChannels(MinChannels), m_fMinArea(MinArea), m_iMinHeight(MinHeight), m_iPrescale(Prescale) {
+    m_alFailed = 0;
+}
+
+EventFilter::decision_t EventFilter::Decide(const PulseSummary& summary) {
+    if ((__builtin_popcount(summary.channels_hit) >= m_iMinChannels) &&
+        (max(summary.s1_area, summary.s2_area) >= m_fMinArea) &&
+        (summary.max_height >= m_iMinHeight)) return keep;
+    if ((m_iPrescale > 0) && (m_alFailed++ % m_iPrescale == 0)) return prescale;
+    return drop;
+}
@@ -0,0 +1,36 @@
+#include "EventIndex.h"
+
+EventIndex::EventIndex() {
+    m_vBuffer.reserve(s_BufferRecords);
+    m_lRecords = 0;
+}
+
+EventIndex::~EventIndex() {
+    Close();
+}
+
+bool EventIndex::Open(const string& name) {
+    Close();
+    m_lRecords = 0;
+    m_File.open(name, ofstream::out | ofstream::binary | ofstream::trunc);
+    return m_File.is_open();
+}
+
+void EventIndex::Add(const IndexRecord& record) {
+    m_vBuffer.push_back(record);
+    m_lRecords++;
+    if (m_vBuffer.size() >= s_BufferRecords) Flush();
+}
+
+void EventIndex::Flush() {
+    if (m_vBuffer.empty()) return;
+    m_File.write((const char*)m_vBuffer.data(), m_vBuffer.size()*sizeof(IndexRecord));
+    if (!m_File) BOOST_LOG_TRIVIAL(error) << "Could not write " << m_vBuffer.size() << " index records";
+    m_vBuffer.clear();
+}
+
+void EventIndex::Close() {
+    if (!m_File.is_open()) return;
+    Flush();
+    m_File.close();
+}
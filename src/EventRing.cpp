@@ -0,0 +1,122 @@
+#include "EventRing.h"
+#include <thread>
+
+static inline void s_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+EventRing::EventRing(int Capacity) {
+    long lSize(1);
+    while (lSize < Capacity) lSize <<= 1;
+    if (lSize != Capacity) BOOST_LOG_TRIVIAL(info) << "Event buffer rounded up to " << lSize << " events";
+    m_lMask = lSize-1;
+    m_vSlots.resize(lSize);
+    m_vDecoded = vector<Sequence>(lSize);
+    m_abActive = true;
+    Reset();
+}
+
+void EventRing::Reset() {
+    for (auto& ev : m_vSlots) {
+        ev.TakeStorage();
+        ev.Clear();
+    }
+    m_Bytes.Reset();
+    for (auto& s : m_vDecoded) s.value.store(-1, memory_order_relaxed);
+    m_Insert.value = 0;
+    m_Decode.value = 0;
+    m_Write.value = 0;
+    m_lWriteClaim = 0;
+    m_abActive = true;
+}
+
+void EventRing::Stop() {
+    m_abActive = false;
+    m_InsertWait.Notify(true);
+    m_DecodeWait.Notify(true);
+    m_WriteWait.Notify(true);
+}
+
+template<typename Pred> bool EventRing::WaitFor(WaitPoint& wp, Pred pred) {
+    for (int i = 0; i < s_SpinCount; i++) {
+        if (pred()) return true;
+        if (i < s_SpinCount/2) s_cpu_relax();
+        else this_thread::yield();
+    }
+    auto tEnd = chrono::steady_clock::now() + chrono::nanoseconds(s_MaxWaitNs);
+    long lRemaining(s_MaxWaitNs);
+    while (m_abActive && (lRemaining > 0)) {
+        int iEpoch = wp.Prepare();
+        if (pred()) {
+            wp.Cancel();
+            return true;
+        }
+        if (!m_abActive) {
+            wp.Cancel();
+            break;
+        }
+        wp.Wait(iEpoch, lRemaining);
+        lRemaining = chrono::duration_cast<chrono::nanoseconds>(tEnd - chrono::steady_clock::now()).count();
+    }
+    return m_abActive && pred();
+}
+
+bool EventRing::ClaimInsert(long& seq) {
+    // single producer, so nobody else moves the insert cursor
+    seq = m_Insert.value.load(memory_order_relaxed);
+    return WaitFor(m_InsertWait, [&]{return seq - m_Write.value.load(memory_order_acquire) <= m_lMask;});
+}
+
+void EventRing::PublishInsert(long seq) {
+    m_Insert.value.store(seq+1, memory_order_release);
+    m_DecodeWait.Notify();
+}
+
+bool EventRing::ClaimDecode(long& first, long& count, long MaxCount) {
+    return WaitFor(m_DecodeWait, [&]{
+        long d = m_Decode.value.load(memory_order_relaxed), i(0);
+        while ((i = m_Insert.value.load(memory_order_acquire)) > d) {
+            long n = min(i - d, max(MaxCount, 1l));
+            if (m_Decode.value.compare_exchange_weak(d, d+n, memory_order_acq_rel)) {
+                first = d;
+                count = n;
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+void EventRing::PublishDecode(long first, long count) {
+    for (long seq = first; seq < first+count; seq++) m_vDecoded[seq & m_lMask].value.store(seq, memory_order_release);
+    m_WriteWait.Notify();
+}
+
+bool EventRing::ClaimWrite(long& first, long& count, long MaxCount) {
+    // decoders finish out of order; the writer only ever takes the next ones in sequence
+    first = m_lWriteClaim;
+    if (!WaitFor(m_WriteWait, [&]{return CanClaimWrite();})) return false;
+    count = 1;
+    while ((count < MaxCount) && (m_vDecoded[(first+count) & m_lMask].value.load(memory_order_acquire) == first+count)) count++;
+    m_lWriteClaim = first + count;
+    return true;
+}
+
+char* EventRing::ClaimBytes(size_t Bytes) {
+    char* p(nullptr);
+    if ((Bytes == 0) || (Bytes > m_Bytes.Capacity())) return nullptr;
+    WaitFor(m_InsertWait, [&]{return (p = m_Bytes.Reserve(Bytes)) != nullptr;});
+    return p;
+}
+
+void EventRing::PublishWrite(long first, long count) {
+    // slots are written in sequence, the order their bytes were claimed
+    for (long seq = first; seq < first+count; seq++) {
+        BodySpan storage = m_vSlots[seq & m_lMask].TakeStorage();
+        if (storage.data) m_Bytes.Release(storage.data, storage.size);
+    }
+    m_Write.value.store(first+count, memory_order_release);
+    m_InsertWait.Notify();
+}
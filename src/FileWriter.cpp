@@ -0,0 +1,289 @@
+#include "FileWriter.h"
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static long s_pwrite_all(int fd, const char* data, size_t size, long offset) {
+    long lWritten(0), ret(0);
+    while ((size_t)lWritten < size) {
+        ret = pwrite(fd, data + lWritten, size - lWritten, offset + lWritten);
+        if ((ret < 0) && (errno == EINTR)) continue;
+        if (ret <= 0) return ret < 0 ? -errno : lWritten;
+        lWritten += ret;
+    }
+    return lWritten;
+}
+
+FileWriter::FileWriter(unsigned int BufferBytes, int NumBuffers, bool bDirect, bool bHugePages) : m_bDirect(bDirect), m_bHugePages(bHugePages) {
+    m_iBufferBytes = (BufferBytes + s_Alignment - 1) & ~(s_Alignment - 1);
+    m_iCurrent = 0;
+    m_lLastFileSize = 0;
+    m_lDropped = 0;
+    m_pLatency = nullptr;
+    m_iRingFd = -1;
+    m_bFixedBuffers = false;
+    m_pSQRing = m_pCQRing = MAP_FAILED;
+    m_pSQEs = nullptr;
+    m_vBuffers.resize(NumBuffers);
+    for (auto& buf : m_vBuffers) {
+        // O_DIRECT wants aligned memory, huge pages are
+        buf.data = m_bHugePages ? HugePages::Alloc(m_iBufferBytes) : (char*)aligned_alloc(s_Alignment, m_iBufferBytes);
+        if (buf.data == nullptr) throw bad_alloc();
+        buf.size = 0;
+        buf.busy = false;
+    }
+    if (!SetupRing(NumBuffers)) BOOST_LOG_TRIVIAL(warning) << "io_uring not available, writing with pwrite";
+    else BOOST_LOG_TRIVIAL(debug) << "Writer using io_uring with " << NumBuffers << " buffers of " << m_iBufferBytes << " bytes"
+        << (m_bFixedBuffers ? " (registered)" : "");
+}
+
+FileWriter::~FileWriter() {
+    Close();
+    TeardownRing();
+    for (auto& buf : m_vBuffers) {
+        if (m_bHugePages) HugePages::Free(buf.data, m_iBufferBytes);
+        else free(buf.data);
+    }
+}
+
+bool FileWriter::SetupRing(unsigned int Entries) {
+    struct io_uring_params params;
+    vector<struct iovec> vIovecs;
+    memset(&params, 0, sizeof(params));
+    m_iRingFd = syscall(__NR_io_uring_setup, Entries, &params);
+    if (m_iRingFd < 0) return false;
+    m_iSQRingSize = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    m_iCQRingSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) m_iSQRingSize = m_iCQRingSize = max(m_iSQRingSize, m_iCQRingSize);
+    m_pSQRing = mmap(nullptr, m_iSQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iRingFd, IORING_OFF_SQ_RING);
+    if (m_pSQRing == MAP_FAILED) {
+        TeardownRing();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) m_pCQRing = m_pSQRing;
+    else m_pCQRing = mmap(nullptr, m_iCQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iRingFd, IORING_OFF_CQ_RING);
+    m_pSQEs = (struct io_uring_sqe*)mmap(nullptr, params.sq_entries*sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, m_iRingFd, IORING_OFF_SQES);
+    m_iSQEsSize = params.sq_entries*sizeof(struct io_uring_sqe);
+    if ((m_pCQRing == MAP_FAILED) || (m_pSQEs == MAP_FAILED)) {
+        TeardownRing();
+        return false;
+    }
+    m_pSQHead = (unsigned int*)((char*)m_pSQRing + params.sq_off.head);
+    m_pSQTail = (unsigned int*)((char*)m_pSQRing + params.sq_off.tail);
+    m_pSQArray = (unsigned int*)((char*)m_pSQRing + params.sq_off.array);
+    m_iSQMask = *(unsigned int*)((char*)m_pSQRing + params.sq_off.ring_mask);
+    m_pCQHead = (unsigned int*)((char*)m_pCQRing + params.cq_off.head);
+    m_pCQTail = (unsigned int*)((char*)m_pCQRing + params.cq_off.tail);
+    m_iCQMask = *(unsigned int*)((char*)m_pCQRing + params.cq_off.ring_mask);
+    m_pCQEs = (struct io_uring_cqe*)((char*)m_pCQRing + params.cq_off.cqes);
+
+    // registered buffers save pinning the pages again for every write
+    for (auto& buf : m_vBuffers) vIovecs.push_back(iovec{buf.data, m_iBufferBytes});
+    m_bFixedBuffers = syscall(__NR_io_uring_register, m_iRingFd, IORING_REGISTER_BUFFERS, vIovecs.data(), vIovecs.size()) == 0;
+    return true;
+}
+
+void FileWriter::TeardownRing() {
+    if ((m_pSQEs != nullptr) && (m_pSQEs != MAP_FAILED)) munmap(m_pSQEs, m_iSQEsSize);
+    if ((m_pCQRing != MAP_FAILED) && (m_pCQRing != m_pSQRing)) munmap(m_pCQRing, m_iCQRingSize);
+    if (m_pSQRing != MAP_FAILED) munmap(m_pSQRing, m_iSQRingSize);
+    if (m_iRingFd >= 0) close(m_iRingFd);
+    m_pSQEs = nullptr;
+    m_pSQRing = m_pCQRing = MAP_FAILED;
+    m_iRingFd = -1;
+}
+
+int FileWriter::OpenFile(const string& filename, long lPreallocate) {
+    // also runs on the PrepareNext thread, so only touches its arguments and m_bDirect
+    int iFlags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = open(filename.c_str(), iFlags | (m_bDirect ? O_DIRECT : 0), 0644);
+    if ((fd < 0) && m_bDirect && (errno == EINVAL)) {
+        BOOST_LOG_TRIVIAL(warning) << filename << " can't be opened O_DIRECT, going through the page cache";
+        fd = open(filename.c_str(), iFlags, 0644);
+    }
+    if (fd < 0) {
+        BOOST_LOG_TRIVIAL(error) << "Could not open " << filename << ": " << strerror(errno);
+        return -1;
+    }
+    // KEEP_SIZE so a reader never sees the preallocated tail, Finish trims it
+    if ((lPreallocate > 0) && (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, lPreallocate) != 0))
+        BOOST_LOG_TRIVIAL(debug) << "Could not preallocate " << filename << ": " << strerror(errno);
+    return fd;
+}
+
+bool FileWriter::Open(const string& filename) {
+    int fd(-1);
+    if (m_lDropped > 0) BOOST_LOG_TRIVIAL(error) << "Dropped " << m_lDropped << " bytes with no file open";
+    m_lDropped = 0;
+    if (m_pFile) {
+        Submit();
+        m_lLastFileSize = m_pFile->size;
+        m_pFile->closing = true;
+        if (m_pFile->inflight == 0) Finish(*m_pFile);
+        m_pFile.reset();
+    }
+    if (m_NextFd.valid() && (m_sNextName == filename)) fd = m_NextFd.get();
+    else {
+        DiscardNext();
+        fd = OpenFile(filename, 0);
+    }
+    if (fd < 0) return false;
+    m_pFile = make_shared<File>(File{fd, 0, 0, 0, false});
+    return true;
+}
+
+void FileWriter::PrepareNext(const string& filename) {
+    long lPreallocate(m_lLastFileSize);
+    DiscardNext();
+    m_sNextName = filename;
+    m_NextFd = async(launch::async, [this, filename, lPreallocate]{return OpenFile(filename, lPreallocate);});
+}
+
+void FileWriter::DiscardNext() {
+    if (!m_NextFd.valid()) return;
+    int fd = m_NextFd.get();
+    if (fd < 0) return;
+    close(fd);
+    unlink(m_sNextName.c_str());
+}
+
+void FileWriter::Write(const char* data, size_t size) {
+    size_t iChunk(0);
+    if (!m_pFile) { // nowhere for the buffers to go
+        m_lDropped += size;
+        return;
+    }
+    while (size > 0) {
+        Buffer& buf = m_vBuffers[m_iCurrent];
+        iChunk = min(size, (size_t)(m_iBufferBytes - buf.size));
+        memcpy(buf.data + buf.size, data, iChunk);
+        buf.size += iChunk;
+        data += iChunk;
+        size -= iChunk;
+        if (buf.size == m_iBufferBytes) Submit();
+    }
+}
+
+void FileWriter::Write(const struct iovec* iov, int iovcnt) {
+    size_t iTotal(0);
+    for (int i = 0; i < iovcnt; i++) iTotal += iov[i].iov_len;
+    if (!m_pFile) {
+        m_lDropped += iTotal;
+        return;
+    }
+    Buffer& buf = m_vBuffers[m_iCurrent];
+    if (buf.size + iTotal < m_iBufferBytes) { // the usual case, no buffer fills up on the way
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(buf.data + buf.size, iov[i].iov_base, iov[i].iov_len);
+            buf.size += iov[i].iov_len;
+        }
+        return;
+    }
+    for (int i = 0; i < iovcnt; i++) Write((const char*)iov[i].iov_base, iov[i].iov_len);
+}
+
+void FileWriter::Submit() {
+    Buffer& buf = m_vBuffers[m_iCurrent];
+    unsigned int iLength(buf.size), iTail(0);
+    struct io_uring_sqe* sqe(nullptr);
+    if ((buf.size == 0) || !m_pFile) return;
+    if (m_bDirect) { // only ever the last buffer of a file
+        iLength = (buf.size + s_Alignment - 1) & ~(s_Alignment - 1);
+        memset(buf.data + buf.size, 0, iLength - buf.size);
+    }
+    buf.busy = true;
+    buf.file = m_pFile;
+    buf.offset = m_pFile->offset;
+    buf.iov = iovec{buf.data, iLength};
+    buf.submit_ticks = MetricsClock::Ticks();
+    m_pFile->offset += iLength;
+    m_pFile->size += buf.size;
+    m_pFile->inflight++;
+
+    if (m_iRingFd < 0) Complete(m_iCurrent, s_pwrite_all(buf.file->fd, buf.data, iLength, buf.offset));
+    else {
+        iTail = *m_pSQTail;
+        sqe = &m_pSQEs[iTail & m_iSQMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = buf.file->fd;
+        sqe->off = buf.offset;
+        sqe->user_data = m_iCurrent;
+        if (m_bFixedBuffers) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->addr = (unsigned long)buf.data;
+            sqe->len = iLength;
+            sqe->buf_index = m_iCurrent;
+        } else {
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = (unsigned long)&buf.iov;
+            sqe->len = 1;
+        }
+        m_pSQArray[iTail & m_iSQMask] = iTail & m_iSQMask;
+        __atomic_store_n(m_pSQTail, iTail+1, __ATOMIC_RELEASE);
+        while (syscall(__NR_io_uring_enter, m_iRingFd, 1, 0, 0, nullptr, 0) < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) continue;
+            BOOST_LOG_TRIVIAL(error) << "io_uring submit failed: " << strerror(errno) << ", writing with pwrite";
+            // the kernel only takes entries in io_uring_enter, so one it didn't take can be withdrawn
+            if (__atomic_load_n(m_pSQHead, __ATOMIC_ACQUIRE) == iTail) {
+                __atomic_store_n(m_pSQTail, iTail, __ATOMIC_RELEASE);
+                Complete(m_iCurrent, s_pwrite_all(buf.file->fd, buf.data, iLength, buf.offset));
+            }
+            break;
+        }
+    }
+    // buffers are reused round robin, so the next one is the oldest in flight
+    m_iCurrent = (m_iCurrent + 1) % m_vBuffers.size();
+    Reap(false);
+    while (m_vBuffers[m_iCurrent].busy) Reap(true);
+}
+
+void FileWriter::Reap(bool bWait) {
+    unsigned int iHead(0);
+    if (m_iRingFd < 0) return;
+    if (bWait) syscall(__NR_io_uring_enter, m_iRingFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    iHead = *m_pCQHead;
+    while (iHead != __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe& cqe = m_pCQEs[iHead & m_iCQMask];
+        Complete(cqe.user_data, cqe.res);
+        iHead++;
+        __atomic_store_n(m_pCQHead, iHead, __ATOMIC_RELEASE);
+    }
+}
+
+void FileWriter::Complete(int iBuffer, int res) {
+    Buffer& buf = m_vBuffers[iBuffer];
+    if (res < 0) BOOST_LOG_TRIVIAL(error) << "Write failed: " << strerror(-res);
+    else if ((size_t)res < buf.iov.iov_len) { // short write, finish it here
+        res = s_pwrite_all(buf.file->fd, buf.data + res, buf.iov.iov_len - res, buf.offset + res);
+        if (res < 0) BOOST_LOG_TRIVIAL(error) << "Write failed: " << strerror(-res);
+    }
+    if (m_pLatency) m_pLatency->Record(MetricsClock::Ticks() - buf.submit_ticks);
+    buf.size = 0;
+    buf.busy = false;
+    if ((--buf.file->inflight == 0) && buf.file->closing) Finish(*buf.file);
+    buf.file.reset();
+}
+
+void FileWriter::Finish(File& file) {
+    // drops the O_DIRECT padding and whatever was preallocated past the end
+    if (ftruncate(file.fd, file.size) != 0) BOOST_LOG_TRIVIAL(error) << "Could not truncate file: " << strerror(errno);
+    close(file.fd);
+    file.fd = -1;
+}
+
+void FileWriter::Close() {
+    if (m_lDropped > 0) BOOST_LOG_TRIVIAL(error) << "Dropped " << m_lDropped << " bytes with no file open";
+    m_lDropped = 0;
+    if (m_pFile) {
+        Submit();
+        m_pFile->closing = true;
+        if (m_pFile->inflight == 0) Finish(*m_pFile);
+        m_pFile.reset();
+    }
+    for (auto& buf : m_vBuffers) while (buf.busy) Reap(true);
+    DiscardNext();
+}
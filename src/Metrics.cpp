@@ -0,0 +1,165 @@
+#include "Metrics.h"
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+double MetricsClock::NsPerTick() {
+    static const double dNsPerTick = [] {
+#ifdef __x86_64__
+        auto tStart = chrono::steady_clock::now();
+        long lStart = Ticks();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        long lTicks = Ticks() - lStart;
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - tStart).count() / max(lTicks, 1l);
+#else
+        return chrono::duration<double, nano>(chrono::steady_clock::duration(1)).count();
+#endif
+    }();
+    return dNsPerTick;
+}
+
+double LatencyHistogram::s_dNsPerTick = MetricsClock::NsPerTick();
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& c : m_Counts) c.store(0, memory_order_relaxed);
+    m_Sum.store(0, memory_order_relaxed);
+}
+
+void LatencyHistogram::AddTo(vector<unsigned long>& vCounts, unsigned long& lSum) const {
+    vCounts.resize(s_Buckets);
+    for (unsigned i = 0; i < s_Buckets; i++) vCounts[i] += m_Counts[i].load(memory_order_relaxed);
+    lSum += m_Sum.load(memory_order_relaxed);
+}
+
+unsigned long LatencyHistogram::UpperBound(int i) {
+    if (i < 16) return i;
+    int e = 4 + (i-16)/8, s = (i-16)%8;
+    return (1ul << e) + ((unsigned long)(s+1) << (e-3)) - 1;
+}
+
+Metrics::Metrics(int NumBoards, int NumDecodeThreads, int NumWriteShards) : m_vBoards(NumBoards), m_vDecoders(max(NumDecodeThreads, 1)),
+    m_vShards(max(NumWriteShards, 1)), m_pDeadTime(nullptr), m_iListenFd(-1), m_abServe(false) {}
+
+Metrics::~Metrics() {
+    m_abServe = false;
+    if (m_ListenThread.joinable()) m_ListenThread.join();
+    if (m_iListenFd >= 0) {
+        close(m_iListenFd);
+        unlink(m_sSocketPath.c_str());
+    }
+}
+
+void Metrics::Inserted(long lReadoutTicks, long lNow, long lOccupancy) {
+    m_Inserter.readout_to_insert.Record(lNow - lReadoutTicks);
+    s_add(m_Inserter.events, 1);
+    m_Inserter.occupancy.store(lOccupancy, memory_order_relaxed);
+    if (lOccupancy > m_Inserter.high_water.load(memory_order_relaxed)) m_Inserter.high_water.store(lOccupancy, memory_order_relaxed);
+}
+
+bool Metrics::Serve(const string& SocketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (SocketPath.size() >= sizeof(addr.sun_path)) {
+        BOOST_LOG_TRIVIAL(error) << "Metrics socket path too long: " << SocketPath;
+        return false;
+    }
+    strcpy(addr.sun_path, SocketPath.c_str());
+    m_iListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(SocketPath.c_str()); // left over from a crash
+    if ((m_iListenFd < 0) || (bind(m_iListenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(m_iListenFd, 4) != 0)) {
+        BOOST_LOG_TRIVIAL(error) << "Could not serve metrics on " << SocketPath << ": " << strerror(errno);
+        if (m_iListenFd >= 0) close(m_iListenFd);
+        m_iListenFd = -1;
+        return false;
+    }
+    m_sSocketPath = SocketPath;
+    m_abServe = true;
+    m_ListenThread = thread(&Metrics::Listen, this);
+    BOOST_LOG_TRIVIAL(info) << "Serving metrics on " << SocketPath;
+    return true;
+}
+
+void Metrics::Listen() {
+    struct pollfd pfd{m_iListenFd, POLLIN, 0};
+    char request[1024];
+    while (m_abServe) {
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int fd = accept4(m_iListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        // whatever was asked, the answer is the same
+        struct pollfd req{fd, POLLIN, 0};
+        if (poll(&req, 1, 100) > 0) (void)!read(fd, request, sizeof(request));
+        string body = Text();
+        string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+        for (size_t iSent = 0; iSent < response.size(); ) {
+            ssize_t ret = send(fd, response.data() + iSent, response.size() - iSent, MSG_NOSIGNAL);
+            if (ret <= 0) break;
+            iSent += ret;
+        }
+        close(fd);
+    }
+}
+
+string Metrics::Text() const {
+    stringstream ss;
+    auto header = [&](const char* name, const char* type, const char* help) {
+        ss << "# HELP obelix_" << name << " " << help << "\n# TYPE obelix_" << name << " " << type << "\n";
+    };
+    auto histogram = [&](const char* stage, const vector<const LatencyHistogram*>& vShards) {
+        vector<unsigned long> vCounts(LatencyHistogram::s_Buckets, 0);
+        unsigned long lCum(0), lSumNs(0);
+        int i(0);
+        for (auto pShard : vShards) pShard->AddTo(vCounts, lSumNs);
+        // powers of two from 256 ns to 64 s, which are bucket edges
+        for (int e = 8; e <= 36; e++) {
+            for (; (i < (int)vCounts.size()) && (LatencyHistogram::UpperBound(i) < (1ul << e)); i++) lCum += vCounts[i];
+            ss << "obelix_latency_seconds_bucket{stage=\"" << stage << "\",le=\"" << (1ul << e)*1e-9 << "\"} " << lCum << "\n";
+        }
+        for (; i < (int)vCounts.size(); i++) lCum += vCounts[i];
+        ss << "obelix_latency_seconds_bucket{stage=\"" << stage << "\",le=\"+Inf\"} " << lCum << "\n";
+        ss << "obelix_latency_seconds_sum{stage=\"" << stage << "\"} " << lSumNs*1e-9 << "\n";
+        ss << "obelix_latency_seconds_count{stage=\"" << stage << "\"} " << lCum << "\n";
+    };
+
+    header("board_bytes_total", "counter", "Bytes read from each board.");
+    for (unsigned b = 0; b < m_vBoards.size(); b++) ss << "obelix_board_bytes_total{board=\"" << b << "\"} " << m_vBoards[b].bytes.load(memory_order_relaxed) << "\n";
+    header("board_blocks_total", "counter", "Block transfers from each board.");
+    for (unsigned b = 0; b < m_vBoards.size(); b++) ss << "obelix_board_blocks_total{board=\"" << b << "\"} " << m_vBoards[b].blocks.load(memory_order_relaxed) << "\n";
+    header("events_inserted_total", "counter", "Events built and put in the ring.");
+    ss << "obelix_events_inserted_total " << m_Inserter.events.load(memory_order_relaxed) << "\n";
+    header("events_decoded_total", "counter", "Events decoded, by decode thread.");
+    for (unsigned t = 0; t < m_vDecoders.size(); t++) ss << "obelix_events_decoded_total{thread=\"" << t << "\"} " << m_vDecoders[t].events.load(memory_order_relaxed) << "\n";
+    header("events_written_total", "counter", "Events the writer has handed on, whether or not they were kept.");
+    ss << "obelix_events_written_total " << m_Writer.events.load(memory_order_relaxed) << "\n";
+    header("bytes_written_total", "counter", "Event bytes written, before compression.");
+    ss << "obelix_bytes_written_total " << m_Writer.bytes.load(memory_order_relaxed) << "\n";
+    header("shard_bytes_written_total", "counter", "Event bytes written, by output directory.");
+    for (unsigned s = 0; s < m_vShards.size(); s++) ss << "obelix_shard_bytes_written_total{shard=\"" << s << "\"} " << m_vShards[s].bytes.load(memory_order_relaxed) << "\n";
+    header("ring_occupancy_events", "gauge", "Events in the ring when the last one was inserted.");
+    ss << "obelix_ring_occupancy_events " << m_Inserter.occupancy.load(memory_order_relaxed) << "\n";
+    header("ring_high_water_events", "gauge", "Most events ever waiting in the ring.");
+    ss << "obelix_ring_high_water_events " << m_Inserter.high_water.load(memory_order_relaxed) << "\n";
+    if (m_pDeadTime) {
+        DeadTime::Summary dead = m_pDeadTime->Totals();
+        header("dead_seconds_total", "counter", "Time in which triggers could be lost, overlapping causes counted once.");
+        ss << "obelix_dead_seconds_total " << dead.dead_ns*1e-9 << "\n";
+        header("dead_by_cause_seconds_total", "counter", "Dead time by cause.");
+        for (int c = 0; c < DeadTime::num_causes; c++) ss << "obelix_dead_by_cause_seconds_total{cause=\"" << DeadTime::Names[c] << "\"} " << dead.cause_ns[c]*1e-9 << "\n";
+    }
+
+    header("latency_seconds", "histogram", "Readout to insert, insert to decoded, decoded to written, and file writes.");
+    histogram("readout_to_insert", {&m_Inserter.readout_to_insert});
+    vector<const LatencyHistogram*> vDecode;
+    for (auto& d : m_vDecoders) vDecode.push_back(&d.insert_to_decode);
+    histogram("insert_to_decode", vDecode);
+    histogram("decode_to_write", {&m_Writer.decode_to_write});
+    vector<const LatencyHistogram*> vFileWrite;
+    for (auto& s : m_vShards) vFileWrite.push_back(&s.file_write);
+    histogram("file_write", vFileWrite);
+    return ss.str();
+}
@@ -0,0 +1,74 @@
+#include "NoiseCalibration.h"
+#include <cmath>
+
+NoiseCalibration::NoiseCalibration(float ZLERateHz, float TriggerRateHz) :
+    m_vCounts(4*NUM_CH*s_Bins), m_fZLERateHz(ZLERateHz), m_fTriggerRateHz(TriggerRateHz) {
+    Reset();
+}
+
+void NoiseCalibration::Reset() {
+    for (auto& c : m_vCounts) c.store(0, memory_order_relaxed);
+    m_alEvents = 0;
+}
+
+void NoiseCalibration::Add(int ch, unsigned int iFirst, unsigned int iLast, unsigned int* counts) {
+    atomic<unsigned long>* pCounts(m_vCounts.data() + ch*s_Bins);
+    for (unsigned int i = iFirst; i < iLast; i++) {
+        if (counts[i] == 0) continue;
+        pCounts[i].fetch_add(counts[i], memory_order_relaxed);
+        counts[i] = 0;
+    }
+}
+
+vector<NoiseResult> NoiseCalibration::Results() const {
+    vector<NoiseResult> vResults;
+    vector<unsigned long> vCum(s_Bins);
+    unsigned long lCount(0);
+    double dSum(0), dSumSq(0), dLiveTime(0);
+    for (int ch = 0; ch < 4*NUM_CH; ch++) {
+        NoiseResult result{ch / NUM_CH, ch % NUM_CH, 0, 0, 0, vector<float>(s_MaxThreshold), -1, -1};
+        dSum = dSumSq = 0;
+        for (unsigned int v = 0; v < s_Bins; v++) {
+            lCount = m_vCounts[ch*s_Bins + v].load(memory_order_relaxed);
+            result.samples += lCount;
+            vCum[v] = result.samples; // samples at or below v
+            dSum += (double)lCount*v;
+            dSumSq += (double)lCount*v*v;
+        }
+        if (result.samples == 0) continue;
+        result.baseline = dSum/result.samples;
+        result.rms = sqrt(max(dSumSq/result.samples - result.baseline*result.baseline, 0.));
+        dLiveTime = result.samples*s_NsPerSample*1e-9;
+        for (unsigned int t = 0; t < s_MaxThreshold; t++) {
+            result.rate[t] = vCum[iBaselineRef - t]/dLiveTime;
+            if ((t > 0) && (result.zle_threshold < 0) && (result.rate[t] <= m_fZLERateHz)) result.zle_threshold = t;
+            if ((t > 0) && (result.trigger_threshold < 0) && (result.rate[t] <= m_fTriggerRateHz)) result.trigger_threshold = t;
+        }
+        vResults.push_back(result);
+    }
+    return vResults;
+}
+
+NoiseHistogram::NoiseHistogram(NoiseCalibration* pCalibration) :
+    m_pCalibration(pCalibration), m_vCounts(4*NUM_CH*NoiseCalibration::s_Bins) {}
+
+void NoiseHistogram::Fill(const Event& event) {
+    unsigned int iMask(event.ChannelMask()), iLowest(0), iHighest(0), v(0);
+    unsigned int* pCounts(nullptr);
+    for (int ch = 0; ch < 4*NUM_CH; ch++) {
+        if (!(iMask & (1u << ch))) continue;
+        pCounts = m_vCounts.data() + ch*NoiseCalibration::s_Bins;
+        iLowest = NoiseCalibration::s_Bins;
+        iHighest = 0;
+        for (auto& seg : event.Channel(ch)) {
+            for (unsigned int i = 0; i < seg.length; i++) {
+                v = seg.samples[i] & (NoiseCalibration::s_Bins - 1);
+                pCounts[v]++;
+                iLowest = min(iLowest, v);
+                iHighest = max(iHighest, v);
+            }
+        }
+        if (iLowest <= iHighest) m_pCalibration->Add(ch, iLowest, iHighest+1, pCounts);
+    }
+    m_pCalibration->AddEvent();
+}
@@ -0,0 +1,29 @@
+#include "PollPolicy.h"
+
+PollPolicy::PollPolicy(long MinWaitNs, long MaxWaitNs) : m_lMinWaitNs(max(MinWaitNs, 1l)), m_lMaxWaitNs(max(MaxWaitNs, MinWaitNs)) {
+    Reset();
+}
+
+void PollPolicy::Reset() {
+    m_lWaitNs = 0;
+    m_lLastEvents = -1;
+    m_dRate = 0;
+}
+
+long PollPolicy::Next(unsigned int NumEvents, long lNow) {
+    double dSpacing(0), dRate(0);
+    if (NumEvents > 0) {
+        if ((m_lLastEvents >= 0) && (lNow > m_lLastEvents)) {
+            dRate = NumEvents * 1e9 / (lNow - m_lLastEvents);
+            m_dRate = (m_dRate > 0) ? (1 - s_RateWeight) * m_dRate + s_RateWeight * dRate : dRate;
+        }
+        m_lLastEvents = lNow;
+        m_lWaitNs = 0;
+        return 0;
+    }
+    m_lWaitNs = (m_lWaitNs > 0) ? min(2*m_lWaitNs, m_lMaxWaitNs) : m_lMinWaitNs;
+    if (m_dRate <= 0) return m_lWaitNs;
+    dSpacing = 1e9 / m_dRate;
+    if (lNow - m_lLastEvents > 2*dSpacing) return m_lWaitNs;
+    return min(m_lWaitNs, max(m_lMinWaitNs, long(dSpacing/4)));
+}
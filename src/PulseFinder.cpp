@@ -0,0 +1,164 @@
+#include "PulseFinder.h"
+#include <climits>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+using Half = unsigned short;
+
+static int s_baseline_scalar(const Half* in, unsigned int n) {
+    int iSum(0);
+    for (unsigned i = 0; i < n; i++) iSum += in[i];
+    return iSum / (int)n;
+}
+
+// adds baseline - sample into sum, returns the largest value added
+static int s_add_channel_scalar(const Half* in, unsigned int n, int baseline, int* sum) {
+    int iMax(0), v(0);
+    for (unsigned i = 0; i < n; i++) {
+        v = baseline - in[i];
+        sum[i] += v;
+        iMax = max(iMax, v);
+    }
+    return iMax;
+}
+
+// first sample in [from, to) over the threshold, or to
+static unsigned int s_next_above_scalar(const int* sum, unsigned int from, unsigned int to, int threshold) {
+    while ((from < to) && (sum[from] <= threshold)) from++;
+    return from;
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static int s_baseline_avx2(const Half* in, unsigned int n) {
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    unsigned int i(0);
+    int iSum(0);
+    // samples are 14 bits, so pairwise sums fit madd's 32-bit lanes
+    for (; i + 16 <= n; i += 16) acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(in + i)), one));
+    __m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    acc128 = _mm_add_epi32(acc128, _mm_srli_si128(acc128, 8));
+    acc128 = _mm_add_epi32(acc128, _mm_srli_si128(acc128, 4));
+    iSum = _mm_cvtsi128_si32(acc128);
+    for (; i < n; i++) iSum += in[i];
+    return iSum / (int)n;
+}
+
+__attribute__((target("avx2")))
+static int s_add_channel_avx2(const Half* in, unsigned int n, int baseline, int* sum) {
+    const __m256i base = _mm256_set1_epi32(baseline);
+    __m256i lowest = _mm256_set1_epi16(-1);
+    unsigned int i(0);
+    int iMax(0);
+    for (; i + 16 <= n; i += 16) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(in + i));
+        lowest = _mm256_min_epu16(lowest, s);
+        __m256i lo = _mm256_sub_epi32(base, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(s)));
+        __m256i hi = _mm256_sub_epi32(base, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(s, 1)));
+        _mm256_storeu_si256((__m256i*)(sum + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(sum + i)), lo));
+        _mm256_storeu_si256((__m256i*)(sum + i + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(sum + i + 8)), hi));
+    }
+    if (i > 0) {
+        __m128i low128 = _mm_min_epu16(_mm256_castsi256_si128(lowest), _mm256_extracti128_si256(lowest, 1));
+        iMax = max(iMax, baseline - (_mm_cvtsi128_si32(_mm_minpos_epu16(low128)) & 0xFFFF));
+    }
+    return max(iMax, s_add_channel_scalar(in + i, n - i, baseline, sum + i));
+}
+
+__attribute__((target("avx2")))
+static unsigned int s_next_above_avx2(const int* sum, unsigned int from, unsigned int to, int threshold) {
+    const __m256i thresh = _mm256_set1_epi32(threshold);
+    unsigned int iBits(0);
+    for (; from + 8 <= to; from += 8) {
+        iBits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(sum + from)), thresh)));
+        if (iBits) return from + __builtin_ctz(iBits);
+    }
+    return s_next_above_scalar(sum, from, to, threshold);
+}
+
+static auto s_baseline = CpuHasAVX2() ? s_baseline_avx2 : s_baseline_scalar;
+static auto s_add_channel = CpuHasAVX2() ? s_add_channel_avx2 : s_add_channel_scalar;
+static auto s_next_above = CpuHasAVX2() ? s_next_above_avx2 : s_next_above_scalar;
+#else
+static auto s_baseline = s_baseline_scalar;
+static auto s_add_channel = s_add_channel_scalar;
+static auto s_next_above = s_next_above_scalar;
+#endif
+
+PulseFinder::PulseFinder(unsigned int RecordLength, int Threshold, int S2MinWidthNs) :
+    m_vSum(RecordLength), m_iThreshold(Threshold) {
+    m_iS2MinWidth = max(S2MinWidthNs, 0) / s_NsPerSample;
+}
+
+void PulseFinder::Process(Event& event) {
+    PulseSummary& summary = event.Summary();
+    unsigned int iMask(event.ChannelMask()), iFirst(UINT_MAX), iLast(0);
+    int iBaseline(0);
+    summary = PulseSummary{0, 0, 0, 0, 0, -1, -1, 0};
+    for (int ch = 0; ch < 4*NUM_CH; ch++) {
+        if (!(iMask & (1u << ch))) continue;
+        for (auto& seg : event.Channel(ch)) {
+            iFirst = min(iFirst, seg.start);
+            iLast = max(iLast, seg.start + seg.length);
+        }
+    }
+    if (iFirst >= iLast) return;
+    if (m_vSum.size() < iLast) m_vSum.resize(iLast);
+    fill(m_vSum.begin() + iFirst, m_vSum.begin() + iLast, 0);
+
+    for (int ch = 0; ch < 4*NUM_CH; ch++) {
+        if (!(iMask & (1u << ch))) continue;
+        SegmentRange segs = event.Channel(ch);
+        if (segs.size() == 0) continue;
+        iBaseline = s_baseline(segs.first->samples, min(segs.first->length, s_BaselineSamples));
+        for (auto& seg : segs) {
+            if (s_add_channel(seg.samples, seg.length, iBaseline, m_vSum.data() + seg.start) > m_iThreshold)
+                summary.channels_hit |= 1u << ch;
+        }
+    }
+    FindPeaks(iFirst, iLast, summary);
+}
+
+void PulseFinder::FindPeaks(unsigned int iFirst, unsigned int iLast, PulseSummary& summary) {
+    const int* pSum(m_vSum.data());
+    unsigned int i(s_next_above(pSum, iFirst, iLast, m_iThreshold)), iStart(0), iEnd(0), iGap(0), iPeak(0), iWidth(0);
+    long lArea(0);
+    while (i < iLast) {
+        // the peak runs until the waveform stays under threshold for longer than the merge gap
+        iStart = i;
+        iEnd = i;
+        iGap = 0;
+        for (; (i < iLast) && (iGap <= s_MergeGap); i++) {
+            if (pSum[i] > m_iThreshold) {
+                iEnd = i + 1;
+                iGap = 0;
+            } else iGap++;
+        }
+        lArea = 0;
+        iPeak = iStart;
+        for (i = iStart; i < iEnd; i++) {
+            lArea += pSum[i];
+            if (pSum[i] > pSum[iPeak]) iPeak = i;
+        }
+        iWidth = 0;
+        for (i = iStart; i < iEnd; i++) iWidth += (2*pSum[i] >= pSum[iPeak]);
+        summary.max_height = max(summary.max_height, pSum[iPeak]);
+
+        if (iWidth >= m_iS2MinWidth) {
+            if (summary.n_s2 < USHRT_MAX) summary.n_s2++;
+            if (lArea > summary.s2_area) {
+                summary.s2_area = lArea;
+                summary.s2_time = iPeak;
+            }
+        } else {
+            if (summary.n_s1 < USHRT_MAX) summary.n_s1++;
+            if (lArea > summary.s1_area) {
+                summary.s1_area = lArea;
+                summary.s1_time = iPeak;
+            }
+        }
+        i = s_next_above(pSum, iEnd, iLast, m_iThreshold);
+    }
+}
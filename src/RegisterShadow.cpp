@@ -0,0 +1,60 @@
+#include "RegisterShadow.h"
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+bool RegisterShadow::Load(const string& path) {
+    ifstream fin(path);
+    string line, kind, name;
+    WORD addr(0), value(0);
+    Clear();
+    if (!fin.is_open()) return false;
+    while (getline(fin, line)) {
+        stringstream ss(line);
+        if (!(ss >> kind)) continue;
+        if (kind == "stamp") ss >> setbase(16) >> m_iStamp;
+        else if ((kind == "setting") && (ss >> name >> setbase(16) >> value)) m_Settings[name] = value;
+        else if ((kind == "register") && (ss >> setbase(16) >> addr >> value)) m_Registers[addr] = value;
+        else {
+            BOOST_LOG_TRIVIAL(warning) << "Can't read register shadow " << path << ", ignoring it";
+            Clear();
+            return false;
+        }
+    }
+    return m_iStamp != 0;
+}
+
+bool RegisterShadow::Save(const string& path) const {
+    string temp = path + ".new";
+    ofstream fout(temp, ofstream::trunc);
+    if (!fout.is_open()) return false;
+    fout << setbase(16) << "stamp " << m_iStamp << "\n";
+    for (auto& s : m_Settings) fout << "setting " << s.first << " " << s.second << "\n";
+    for (auto& r : m_Registers) fout << "register " << r.first << " " << r.second << "\n";
+    fout.close();
+    // a crash while writing leaves the old one, which the board's stamp no longer matches
+    if (fout.fail() || (rename(temp.c_str(), path.c_str()) != 0)) {
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool RegisterShadow::Has(const string& setting, WORD value) const {
+    auto it = m_Settings.find(setting);
+    return (it != m_Settings.end()) && (it->second == value);
+}
+
+vector<string> RegisterShadow::Names(const string& prefix) const {
+    vector<string> vNames;
+    for (auto it = m_Settings.lower_bound(prefix); (it != m_Settings.end()) && (it->first.compare(0, prefix.size(), prefix) == 0); it++)
+        vNames.push_back(it->first);
+    return vNames;
+}
+
+bool RegisterShadow::Known(WORD addr, WORD& value) const {
+    auto it = m_Registers.find(addr);
+    if (it == m_Registers.end()) return false;
+    value = it->second;
+    return true;
+}
@@ -0,0 +1,156 @@
+#include "SampleCodec.h"
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+using Half = unsigned short;
+static const unsigned int s_BlockValues = 32;
+
+static inline Half s_zigzag(Half v) {
+    short d = v - iBaselineRef;
+    return (d << 1) ^ (d >> 15);
+}
+
+static inline Half s_unzigzag(Half z) {
+    return ((z >> 1) ^ -(z & 1)) + iBaselineRef;
+}
+
+static unsigned int s_encode_block_scalar(const Half* in, char* out) {
+    Half zz[s_BlockValues];
+    Half iAll(0);
+    unsigned int iWidth(0), iPlane(0);
+    for (unsigned i = 0; i < s_BlockValues; i++) {
+        zz[i] = s_zigzag(in[i]);
+        iAll |= zz[i];
+    }
+    iWidth = iAll ? 32 - __builtin_clz(iAll) : 0;
+    *out++ = iWidth;
+    for (unsigned b = 0; b < iWidth; b++) {
+        iPlane = 0;
+        for (unsigned i = 0; i < s_BlockValues; i++) iPlane |= ((zz[i] >> b) & 1u) << i;
+        memcpy(out + 4*b, &iPlane, 4);
+    }
+    return 1 + 4*iWidth;
+}
+
+static void s_decode_block_scalar(const char* in, unsigned int iWidth, Half* out) {
+    unsigned int iPlane(0);
+    Half zz[s_BlockValues] = {};
+    for (unsigned b = 0; b < iWidth; b++) {
+        memcpy(&iPlane, in + 4*b, 4);
+        for (unsigned i = 0; i < s_BlockValues; i++) zz[i] |= ((iPlane >> i) & 1u) << b;
+    }
+    for (unsigned i = 0; i < s_BlockValues; i++) out[i] = s_unzigzag(zz[i]);
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static unsigned int s_encode_block_avx2(const Half* in, char* out) {
+    const __m256i base = _mm256_set1_epi16(iBaselineRef);
+    __m256i d0 = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)in), base);
+    __m256i d1 = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(in + 16)), base);
+    __m256i z0 = _mm256_xor_si256(_mm256_slli_epi16(d0, 1), _mm256_srai_epi16(d0, 15));
+    __m256i z1 = _mm256_xor_si256(_mm256_slli_epi16(d1, 1), _mm256_srai_epi16(d1, 15));
+    __m256i all = _mm256_or_si256(z0, z1);
+    __m128i all128 = _mm_or_si128(_mm256_castsi256_si128(all), _mm256_extracti128_si256(all, 1));
+    all128 = _mm_or_si128(all128, _mm_srli_si128(all128, 8));
+    all128 = _mm_or_si128(all128, _mm_srli_si128(all128, 4));
+    all128 = _mm_or_si128(all128, _mm_srli_si128(all128, 2));
+    unsigned int iAll = _mm_extract_epi16(all128, 0);
+    unsigned int iWidth = iAll ? 32 - __builtin_clz(iAll) : 0;
+    *out++ = iWidth;
+    for (unsigned b = 0; b < iWidth; b++) {
+        // move bit b to the sign, saturating packs keeps the sign, movemask collects it
+        __m128i shift = _mm_cvtsi32_si128(15 - b);
+        __m256i packed = _mm256_packs_epi16(_mm256_sll_epi16(z0, shift), _mm256_sll_epi16(z1, shift));
+        packed = _mm256_permute4x64_epi64(packed, 0xD8); // packs works within 128-bit lanes
+        unsigned int iPlane = _mm256_movemask_epi8(packed);
+        memcpy(out + 4*b, &iPlane, 4);
+    }
+    return 1 + 4*iWidth;
+}
+
+__attribute__((target("avx2")))
+static void s_decode_block_avx2(const char* in, unsigned int iWidth, Half* out) {
+    const __m256i lanes = _mm256_setr_epi16(1<<0, 1<<1, 1<<2, 1<<3, 1<<4, 1<<5, 1<<6, 1<<7,
+                                            1<<8, 1<<9, 1<<10, 1<<11, 1<<12, 1<<13, 1<<14, (short)(1<<15));
+    const __m256i base = _mm256_set1_epi16(iBaselineRef);
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i z0 = _mm256_setzero_si256(), z1 = _mm256_setzero_si256();
+    unsigned int iPlane(0);
+    for (unsigned b = 0; b < iWidth; b++) {
+        memcpy(&iPlane, in + 4*b, 4);
+        __m256i bit = _mm256_set1_epi16(1 << b);
+        __m256i p0 = _mm256_and_si256(_mm256_set1_epi16(iPlane & 0xFFFF), lanes);
+        __m256i p1 = _mm256_and_si256(_mm256_set1_epi16(iPlane >> 16), lanes);
+        z0 = _mm256_or_si256(z0, _mm256_and_si256(_mm256_cmpeq_epi16(p0, lanes), bit));
+        z1 = _mm256_or_si256(z1, _mm256_and_si256(_mm256_cmpeq_epi16(p1, lanes), bit));
+    }
+    z0 = _mm256_xor_si256(_mm256_srli_epi16(z0, 1), _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_and_si256(z0, one)));
+    z1 = _mm256_xor_si256(_mm256_srli_epi16(z1, 1), _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_and_si256(z1, one)));
+    _mm256_storeu_si256((__m256i*)out, _mm256_add_epi16(z0, base));
+    _mm256_storeu_si256((__m256i*)(out + 16), _mm256_add_epi16(z1, base));
+}
+#endif
+
+static auto s_encode_block = s_encode_block_scalar;
+static auto s_decode_block = s_decode_block_scalar;
+static bool s_bAVX2 = SampleCodec::SelectAVX2(true);
+
+bool SampleCodec::UsesAVX2() {
+    return s_bAVX2;
+}
+
+bool SampleCodec::SelectAVX2(bool bWanted) {
+    s_encode_block = s_encode_block_scalar;
+    s_decode_block = s_decode_block_scalar;
+    s_bAVX2 = false;
+#ifdef __x86_64__
+    if (bWanted && CpuHasAVX2()) {
+        s_encode_block = s_encode_block_avx2;
+        s_decode_block = s_decode_block_avx2;
+        s_bAVX2 = true;
+    }
+#endif
+    return s_bAVX2;
+}
+
+unsigned int SampleCodec::Encode(const char* in, unsigned int RawBytes, char* out) {
+    unsigned int iBlocks = RawBytes / (2*s_BlockValues), iTail = RawBytes % (2*s_BlockValues);
+    char* pOut(out);
+    memcpy(pOut, &RawBytes, 4);
+    pOut += 4;
+    for (unsigned int i = 0; i < iBlocks; i++) pOut += s_encode_block((const Half*)in + i*s_BlockValues, pOut);
+    memcpy(pOut, in + RawBytes - iTail, iTail);
+    return pOut + iTail - out;
+}
+
+bool SampleCodec::Decode(const char* in, unsigned int InBytes, vector<char>& out) {
+    const char* pIn(in);
+    const char* pEnd(in + InBytes);
+    unsigned int iRawBytes(0), iBlocks(0), iTail(0), iWidth(0);
+    Half* pOut(nullptr);
+    while (pIn < pEnd) {
+        if (pEnd - pIn < 4) return false;
+        memcpy(&iRawBytes, pIn, 4);
+        pIn += 4;
+        iBlocks = iRawBytes / (2*s_BlockValues);
+        iTail = iRawBytes % (2*s_BlockValues);
+        // every block takes at least its width byte, so a length the input can't hold is corrupt
+        if ((unsigned long)(pEnd - pIn) < (unsigned long)iBlocks + iTail) return false;
+        out.resize(out.size() + iRawBytes);
+        pOut = (Half*)(out.data() + out.size() - iRawBytes);
+        for (unsigned int i = 0; i < iBlocks; i++) {
+            if (pIn >= pEnd) return false;
+            iWidth = (unsigned char)*pIn++;
+            if ((iWidth > 16) || (pEnd - pIn < 4*iWidth)) return false;
+            s_decode_block(pIn, iWidth, pOut + i*s_BlockValues);
+            pIn += 4*iWidth;
+        }
+        if (pEnd - pIn < iTail) return false;
+        memcpy((char*)pOut + iRawBytes - iTail, pIn, iTail);
+        pIn += iTail;
+    }
+    return true;
+}
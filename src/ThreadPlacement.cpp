@@ -0,0 +1,148 @@
+#include "ThreadPlacement.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <sstream>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+const char* ThreadPlacement::Names[ThreadPlacement::num_roles] = {"readout", "build", "decode", "write"};
+
+ThreadPlacement::ThreadPlacement() {
+    CPU_ZERO(&m_Default);
+    sched_getaffinity(0, sizeof(cpu_set_t), &m_Default);
+    for (auto& set : m_Cpus) CPU_ZERO(&set);
+    m_bPinned.fill(false);
+    m_Priority.fill(0);
+}
+
+string ThreadPlacement::s_read_line(const string& path) {
+    ifstream fin(path);
+    string line;
+    getline(fin, line);
+    return line;
+}
+
+bool ThreadPlacement::s_parse(const string& list, cpu_set_t& set) {
+    stringstream ss(list);
+    string item;
+    CPU_ZERO(&set);
+    while (getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        if (item.compare(0, 4, "node") == 0) {
+            string nodelist = s_read_line("/sys/devices/system/node/" + item + "/cpulist");
+            cpu_set_t node;
+            if (nodelist.empty() || !s_parse(nodelist, node)) return false;
+            CPU_OR(&set, &set, &node);
+            continue;
+        }
+        char* end(nullptr);
+        long first = strtol(item.c_str(), &end, 10), last(first);
+        if (*end == '-') last = strtol(end+1, &end, 10);
+        if ((*end != '\0') || (first < 0) || (last < first) || (last >= CPU_SETSIZE)) return false;
+        for (long c = first; c <= last; c++) CPU_SET(c, &set);
+    }
+    return CPU_COUNT(&set) > 0;
+}
+
+string ThreadPlacement::s_list(const cpu_set_t& set) {
+    string list;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &set)) continue;
+        int last(c);
+        while ((last+1 < CPU_SETSIZE) && CPU_ISSET(last+1, &set)) last++;
+        list += (list.empty() ? "" : ",") + to_string(c) + (last > c ? "-" + to_string(last) : "");
+        c = last;
+    }
+    return list;
+}
+
+bool ThreadPlacement::SetCpus(role_t role, const string& cpus) {
+    cpu_set_t online;
+    m_bPinned[role] = false;
+    if (cpus.empty()) return true;
+    if (!s_parse(cpus, m_Cpus[role])) return false;
+    if (s_parse(s_read_line("/sys/devices/system/cpu/online"), online)) CPU_AND(&m_Cpus[role], &m_Cpus[role], &online);
+    m_bPinned[role] = CPU_COUNT(&m_Cpus[role]) > 0;
+    return m_bPinned[role];
+}
+
+void ThreadPlacement::Apply(pthread_t th, role_t role, const string& name) const {
+    cpu_set_t set;
+    struct sched_param param;
+    int policy(SCHED_OTHER), ret(0);
+    const cpu_set_t& cpus = m_bPinned[role] ? m_Cpus[role] : m_Default;
+    if ((CPU_COUNT(&cpus) > 0) && ((ret = pthread_setaffinity_np(th, sizeof(cpu_set_t), &cpus)) != 0))
+        BOOST_LOG_TRIVIAL(warning) << "Could not pin " << name << " to cpus " << s_list(cpus) << ": " << strerror(ret);
+    if (m_Priority[role] > 0) {
+        param.sched_priority = m_Priority[role];
+        if ((ret = pthread_setschedparam(th, SCHED_FIFO, &param)) != 0)
+            BOOST_LOG_TRIVIAL(warning) << "Could not run " << name << " SCHED_FIFO " << m_Priority[role] << ": " << strerror(ret);
+    }
+    // report what the kernel says, not what was asked for
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(th, sizeof(cpu_set_t), &set);
+    pthread_getschedparam(th, &policy, &param);
+    if (m_bPinned[role] || (m_Priority[role] > 0))
+        BOOST_LOG_TRIVIAL(info) << "Placed " << name << " on cpus " << s_list(set)
+            << (policy == SCHED_FIFO ? ", SCHED_FIFO " + to_string(param.sched_priority) : "");
+    else BOOST_LOG_TRIVIAL(debug) << name << " runs on cpus " << s_list(set);
+}
+
+string ThreadPlacement::Topology() {
+    stringstream ss;
+    vector<string> vNodes;
+    ss << "cpus " << s_read_line("/sys/devices/system/cpu/online");
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (struct dirent* entry = readdir(dir)) {
+            string node(entry->d_name);
+            if ((node.compare(0, 4, "node") == 0) && isdigit(node.back())) vNodes.push_back(node);
+        }
+        closedir(dir);
+    }
+    sort(vNodes.begin(), vNodes.end());
+    for (auto& node : vNodes) ss << ", " << node << ": " << s_read_line("/sys/devices/system/node/" + node + "/cpulist");
+    return ss.str();
+}
+
+char* HugePages::Alloc(size_t Bytes) {
+    size_t iMapped = (Bytes + s_PageBytes - 1) & ~(s_PageBytes - 1);
+    void* p = mmap(nullptr, iMapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) { // none reserved, or not enough
+        p = mmap(nullptr, iMapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return nullptr;
+        madvise(p, iMapped, MADV_HUGEPAGE);
+    }
+    Lock((char*)p, iMapped);
+    return (char*)p;
+}
+
+void HugePages::Free(char* p, size_t Bytes) {
+    if (p) munmap(p, (Bytes + s_PageBytes - 1) & ~(s_PageBytes - 1));
+}
+
+void HugePages::Lock(char* p, size_t Bytes) {
+    static atomic<bool> s_abWarned(false);
+    // only whole 2 MB stretches can become huge pages
+    char* pFirst = (char*)(((size_t)p + s_PageBytes - 1) & ~(s_PageBytes - 1));
+    if (pFirst + s_PageBytes <= p + Bytes) madvise(pFirst, (p + Bytes - pFirst) & ~(s_PageBytes - 1), MADV_HUGEPAGE);
+    if ((mlock(p, Bytes) != 0) && !s_abWarned.exchange(true))
+        BOOST_LOG_TRIVIAL(warning) << "Could not lock buffers in memory (" << strerror(errno) << "), raise the memlock limit";
+}
+
+bool HugePages::LockAll() {
+    struct rlimit limit;
+    // with a finite limit, MCL_FUTURE makes any allocation past it fail
+    if ((geteuid() != 0) && ((getrlimit(RLIMIT_MEMLOCK, &limit) != 0) || (limit.rlim_cur != RLIM_INFINITY))) {
+        BOOST_LOG_TRIVIAL(warning) << "Not locking all memory, the memlock limit isn't unlimited";
+        return false;
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not lock all memory: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,197 @@
+#include "V1724Emulator.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+atomic<bool> V1724Emulator::s_abRunning(false);
+atomic<long> V1724Emulator::s_lRunStart(0);
+atomic<long> V1724Emulator::s_lSWTriggers(0);
+atomic<long> V1724Emulator::s_lLastSWTriggerTime(0);
+
+V1724Emulator::V1724Emulator(const EmulatorSettings_t& ES) : m_Settings(ES) {
+    m_iRecordLength = 0;
+    m_iBlockTransfer = 0;
+    m_iEnableMask = 0;
+    m_iTriggerPosition = 0;
+    m_bIsZLE = false;
+    m_iBufferSize = 0;
+    m_lRunStart = -1;
+    m_lEventsRead = 0;
+    m_lSWTriggersRead = 0;
+    m_iEventCounter = 0;
+    m_iIRQEvents = 1;
+    m_iRandomState = 0x9E3779B9 ^ (m_Settings.BoardID + 1);
+    m_bRunning = false;
+    if ((m_Settings.ZLEOccupancy < 0) || (m_Settings.ZLEOccupancy > 1) || (m_Settings.TriggerRate < 0) ||
+        (m_Settings.MissedTriggers < 0) || (m_Settings.MissedTriggers >= 1)) {
+        BOOST_LOG_TRIVIAL(fatal) << "Emulator " << m_Settings.BoardID << ": invalid settings";
+        throw DigitizerException();
+    }
+    BOOST_LOG_TRIVIAL(debug) << "Emulator " << m_Settings.BoardID << ": created";
+}
+
+V1724Emulator::~V1724Emulator() {
+    StopReadout();
+    ClearBlocks();
+    m_Pool.reset();
+    s_abRunning = false;
+}
+
+void V1724Emulator::StartAcquisition() {
+    s_lSWTriggers = 0;
+    s_lRunStart = chrono::high_resolution_clock::now().time_since_epoch().count();
+    s_abRunning = true;
+    m_bRunning = true;
+    BOOST_LOG_TRIVIAL(debug) << "Emulator " << m_Settings.BoardID << ": acquisition started";
+}
+
+void V1724Emulator::StopAcquisition() {
+    m_bRunning = false;
+    s_abRunning = false;
+    BOOST_LOG_TRIVIAL(debug) << "Emulator " << m_Settings.BoardID << ": acquisition stopped";
+}
+
+void V1724Emulator::SWTrigger() {
+    s_lLastSWTriggerTime = chrono::high_resolution_clock::now().time_since_epoch().count() - s_lRunStart;
+    s_lSWTriggers++;
+}
+
+void V1724Emulator::ProgramDigitizer(ConfigSettings_t& CS) {
+    unsigned int iMaxWordsPerEvent(0);
+    m_iRecordLength = CS.RecordLength & ~1u; // two samples per word
+    m_iBlockTransfer = max(CS.BlockTransfer, 1u);
+    m_iEnableMask = CS.EnableMask & 0xFF;
+    m_iTriggerPosition = (m_iRecordLength * (100 - CS.PostTrigger) / 100) & ~1u;
+    m_bIsZLE = CS.IsZLE;
+
+    iMaxWordsPerEvent = 4 + 8*(m_iRecordLength/2 + 4);
+    m_iBufferSize = (size_t)m_iBlockTransfer * iMaxWordsPerEvent * sizeof(WORD);
+    m_vNoise.resize(s_NoisePoolSize + m_iRecordLength);
+
+    mt19937 gen(m_Settings.BoardID);
+    normal_distribution<float> noise(0, 2.5);
+    for (auto& s : m_vNoise) s = min(max(lround(iBaselineRef + noise(gen)), 0l), 0x3FFFl);
+
+    // single photoelectron-like and S2-like pulse shapes, unit height
+    m_vS1Shape.resize(40);
+    for (unsigned i = 0; i < m_vS1Shape.size(); i++) m_vS1Shape[i] = (1 - exp(-(i+0.5f)/1.5f)) * exp(-i/6.f);
+    m_vS2Shape.resize(600);
+    for (unsigned i = 0; i < m_vS2Shape.size(); i++) m_vS2Shape[i] = exp(-0.5f * pow((i - 300.f)/80.f, 2));
+
+    BOOST_LOG_TRIVIAL(info) << "Emulator " << m_Settings.BoardID << " ready with mask " << m_iEnableMask
+        << ", " << m_Settings.TriggerRate << " Hz, ZLE occupancy " << m_Settings.ZLEOccupancy
+        << ", missing " << m_Settings.MissedTriggers << " of triggers\n";
+}
+
+char* V1724Emulator::MallocReadoutBuffer(unsigned int& AllocSize) {
+    AllocSize = m_iBufferSize;
+    if (!m_bHugePages) return new char[m_iBufferSize];
+    char* buffer = HugePages::Alloc(m_iBufferSize);
+    if (buffer == nullptr) throw bad_alloc();
+    return buffer;
+}
+
+void V1724Emulator::FreeReadoutBuffer(char* buffer) {
+    if (m_bHugePages) HugePages::Free(buffer, m_iBufferSize);
+    else delete[] buffer;
+}
+
+unsigned int V1724Emulator::Random() {
+    m_iRandomState ^= m_iRandomState << 13;
+    m_iRandomState ^= m_iRandomState >> 17;
+    m_iRandomState ^= m_iRandomState << 5;
+    return m_iRandomState;
+}
+
+unsigned int V1724Emulator::FillChannel(WORD* pOut, const vector<float>& vPulse, float fAmplitude) {
+    WORD* pWord(pOut);
+    unsigned int iStart(0), iLength(m_iRecordLength), iTail(0);
+    if (m_bIsZLE) {
+        iLength = 2*(unsigned int)(m_Settings.ZLEOccupancy * m_iRecordLength / 2);
+        iStart = (m_iTriggerPosition > iLength/4) ? ((m_iTriggerPosition - iLength/4) & ~1u) : 0;
+        if (iStart + iLength > m_iRecordLength) iStart = m_iRecordLength - iLength;
+        iTail = m_iRecordLength - iStart - iLength;
+        pWord++; // channel size, filled below
+        if (iStart > 0) *pWord++ = iStart/2;
+        if (iLength > 0) *pWord++ = s_GoodControlWord | (iLength/2);
+    }
+    unsigned short* pSamples = (unsigned short*)pWord;
+    memcpy(pSamples, m_vNoise.data() + (Random() % s_NoisePoolSize), iLength*sizeof(unsigned short));
+    unsigned int iPulseEnd = min(iStart + iLength, m_iTriggerPosition + (unsigned int)vPulse.size());
+    for (unsigned int i = max(iStart, m_iTriggerPosition); i < iPulseEnd; i++)
+        pSamples[i - iStart] -= min((unsigned short)(fAmplitude * vPulse[i - m_iTriggerPosition]), pSamples[i - iStart]);
+    pWord += iLength/2;
+    if (m_bIsZLE) {
+        if (iTail > 0) *pWord++ = iTail/2;
+        *pOut = pWord - pOut;
+    }
+    return pWord - pOut;
+}
+
+unsigned int V1724Emulator::FillEvent(WORD* pOut, long lTriggerTime) {
+    WORD* pWord(pOut + 4);
+    bool bIsS2 = Random() & 1;
+    const vector<float>& vPulse = bIsS2 ? m_vS2Shape : m_vS1Shape;
+    float fAmplitude = bIsS2 ? 10 + Random() % 90 : 20 + Random() % 400;
+    for (int ch = 0; ch < 8; ch++) {
+        if (!(m_iEnableMask & (1 << ch))) continue;
+        pWord += FillChannel(pWord, vPulse, fAmplitude * (0.5f + (Random() & 0xFF)/256.f));
+    }
+    pOut[0] = s_HeaderTag | (pWord - pOut);
+    pOut[1] = (m_Settings.BoardID << s_BoardIDShift) | (m_bIsZLE ? s_ZLEFlag : 0) | m_iEnableMask;
+    pOut[2] = (m_iEventCounter++) & s_CounterMask;
+    pOut[3] = (lTriggerTime / s_NsPerTriggerClock) & s_TimestampMask;
+    return pWord - pOut;
+}
+
+double V1724Emulator::Spacing() const {
+    return (m_Settings.TriggerRate > 0) ? 1e9/m_Settings.TriggerRate : double(m_iRecordLength * s_NsPerSample);
+}
+
+bool V1724Emulator::WaitForInterrupt(long lTimeoutNs) {
+    long lNow = chrono::high_resolution_clock::now().time_since_epoch().count(), lRaised(0);
+    if (s_abRunning && ((m_lRunStart != s_lRunStart) || (m_lSWTriggersRead < s_lSWTriggers) || (m_Settings.TriggerRate == 0)))
+        return true;
+    // the trigger that makes it m_iIRQEvents waiting; ones this board misses still count
+    lRaised = s_lRunStart + long((m_lEventsRead + m_iIRQEvents - 1) * Spacing());
+    if (!s_abRunning || (lRaised > lNow + lTimeoutNs)) {
+        this_thread::sleep_for(chrono::nanoseconds(lTimeoutNs));
+        return false;
+    }
+    if (lRaised > lNow) this_thread::sleep_for(chrono::nanoseconds(lRaised - lNow));
+    return true;
+}
+
+unsigned int V1724Emulator::ReadBuffer(char* buffer, unsigned int& BufferSize) {
+    unsigned int NumEvents(0);
+    WORD* pOut = (WORD*)buffer;
+    BufferSize = 0;
+    if (!s_abRunning) return 0;
+    if (m_lRunStart != s_lRunStart) { // a new run was started from the first board
+        m_lRunStart = s_lRunStart;
+        m_lEventsRead = 0;
+        m_lSWTriggersRead = 0;
+        m_iEventCounter = 0;
+    }
+    long lNow = chrono::high_resolution_clock::now().time_since_epoch().count() - m_lRunStart;
+    double dSpacing = Spacing();
+    long lDue = (m_Settings.TriggerRate > 0) ? long(lNow/dSpacing) + 1 : m_lEventsRead + m_iBlockTransfer;
+
+    while ((NumEvents < m_iBlockTransfer) && ((m_lEventsRead < lDue) || (m_lSWTriggersRead < s_lSWTriggers))) {
+        if ((m_lSWTriggersRead < s_lSWTriggers) && (m_lEventsRead * dSpacing > s_lLastSWTriggerTime)) {
+            pOut += FillEvent(pOut, s_lLastSWTriggerTime);
+            m_lSWTriggersRead++;
+        } else if (m_lEventsRead < lDue) {
+            if (Random() < m_Settings.MissedTriggers * 0xFFFFFFFFu) {
+                m_lEventsRead++;
+                continue;
+            }
+            pOut += FillEvent(pOut, long(m_lEventsRead * dSpacing));
+            m_lEventsRead++;
+        } else break;
+        NumEvents++;
+    }
+    BufferSize = (char*)pOut - buffer;
+    return NumEvents;
+}
@@ -0,0 +1,28 @@
+#include "WaitPoint.h"
+#include <climits>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+int WaitPoint::Prepare() {
+    int iEpoch = m_aiEpoch.load(memory_order_acquire);
+    m_aiWaiters++;
+    return iEpoch;
+}
+
+void WaitPoint::Wait(int iEpoch, long lTimeoutNs) {
+    struct timespec ts;
+    ts.tv_sec = lTimeoutNs / 1000000000l;
+    ts.tv_nsec = lTimeoutNs % 1000000000l;
+    syscall(SYS_futex, (int*)&m_aiEpoch, FUTEX_WAIT_PRIVATE, iEpoch, &ts, nullptr, 0);
+    m_aiWaiters--;
+}
+
+void WaitPoint::Notify(bool bForce) {
+    // pairs with the increment in Prepare: either we see the waiter or it sees our data
+    atomic_thread_fence(memory_order_seq_cst);
+    if (bForce || m_aiWaiters.load(memory_order_relaxed)) {
+        m_aiEpoch.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, (int*)&m_aiEpoch, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
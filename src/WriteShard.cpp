@@ -0,0 +1,83 @@
+#include "WriteShard.h"
+
+WriteShard::WriteShard(const string& Dir, unsigned int BufferBytes, int NumBuffers, bool bDirect, bool bHugePages, bool bThreaded) :
+    m_sDir(Dir), m_Writer(BufferBytes, NumBuffers, bDirect, bHugePages), m_lQueued(0), m_alDone(0), m_abFailed(false), m_bStop(false) {
+    if (bThreaded) m_Thread = thread(&WriteShard::Run, this);
+}
+
+WriteShard::~WriteShard() {
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_bStop = true;
+    }
+    m_Work.notify_one();
+    if (m_Thread.joinable()) m_Thread.join();
+}
+
+long WriteShard::Open(const string& filename, const string& nextname) {
+    return Queue(Job{open_job, filename, nextname, {}});
+}
+
+long WriteShard::Write(vector<struct iovec>& vIov) {
+    Job job{write_job, "", "", {}};
+    job.iov.swap(vIov);
+    return Queue(move(job));
+}
+
+long WriteShard::Close() {
+    return Queue(Job{close_job, "", "", {}});
+}
+
+long WriteShard::Queue(Job&& job) {
+    if (!m_Thread.joinable()) {
+        Execute(job);
+        m_alDone.store(++m_lQueued, memory_order_release);
+        return m_lQueued;
+    }
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_Jobs.push_back(move(job));
+    }
+    m_Work.notify_one();
+    return ++m_lQueued;
+}
+
+void WriteShard::Wait(long ticket) {
+    if (Done(ticket)) return;
+    unique_lock<mutex> lock(m_Mutex);
+    m_Finished.wait(lock, [&]{return Done(ticket);});
+}
+
+void WriteShard::Execute(Job& job) {
+    switch (job.type) {
+        case write_job:
+            m_Writer.Write(job.iov.data(), job.iov.size());
+            break;
+        case open_job:
+            // the file before finishes in the background
+            if (!m_Writer.Open(job.name)) {
+                BOOST_LOG_TRIVIAL(error) << "Could not open " << job.name;
+                m_abFailed = true;
+            } else BOOST_LOG_TRIVIAL(debug) << "Opened " << job.name;
+            m_Writer.PrepareNext(job.next);
+            break;
+        case close_job:
+            m_Writer.Close();
+            break;
+    }
+}
+
+void WriteShard::Run() {
+    unique_lock<mutex> lock(m_Mutex);
+    while (true) {
+        m_Work.wait(lock, [&]{return m_bStop || !m_Jobs.empty();});
+        if (m_Jobs.empty()) return; // whatever was queued gets done first
+        Job job(move(m_Jobs.front()));
+        m_Jobs.pop_front();
+        lock.unlock();
+        Execute(job);
+        lock.lock();
+        m_alDone.fetch_add(1, memory_order_release);
+        m_Finished.notify_all();
+    }
+}
@@ -36,7 +36,7 @@ void KBHIT::deinit() {
     tcsetattr(0, TCSANOW, &old_kbd_mode);
 }
 
-int KBHIT::kbhit() {
+int KBHIT::kbhit(int TimeoutMs) {
     struct timeval timeout;
     fd_set read_handles;
     int status;
@@ -44,7 +44,8 @@ int KBHIT::kbhit() {
     /* check stdin (fd 0) for activity */
     FD_ZERO(&read_handles);
     FD_SET(0, &read_handles);
-    timeout.tv_sec = timeout.tv_usec = 0;
+    timeout.tv_sec = TimeoutMs / 1000;
+    timeout.tv_usec = (TimeoutMs % 1000) * 1000;
     status = select(0 + 1, &read_handles, NULL, NULL, &timeout);
     if(status>0 && FD_ISSET(0,&read_handles))
         return (status);
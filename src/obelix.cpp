@@ -31,6 +31,7 @@ int main(int argc, char** argv) {
         ("version,v", "output current version and return")
         ("comment,C", po::value<string>()->default_value(run_comment), "specify comment for runs DB")
         ("log,l", po::value<string>()->default_value(default_log), "logging level")
+        ("headless", "no terminal, take commands only through the config's control_socket")
     ;
 
     po::options_description secret_options("Secret arguments");
@@ -88,7 +89,7 @@ int main(int argc, char** argv) {
         return 1;
     }
     try {
-        daq->Readout();
+        daq->Readout(!vm.count("headless"));
     } catch (exception& e) {
         BOOST_LOG_TRIVIAL(fatal) << "Runtime error! Error: " << e.what();
     }
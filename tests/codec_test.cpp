@@ -0,0 +1,99 @@
+// Round-trips board bodies through SampleCodec with the scalar and the AVX2
+// block functions, and checks that both write the same bytes.
+#include "bench.h"
+#include "SampleCodec.h"
+#include "test.h"
+
+static vector<char> s_encode(const vector<char>& raw) {
+    vector<char> out(SampleCodec::MaxEncodedSize(raw.size()));
+    out.resize(SampleCodec::Encode(raw.data(), raw.size(), out.data()));
+    return out;
+}
+
+static bool s_round_trip(const vector<char>& raw, const vector<char>& encoded) {
+    vector<char> decoded;
+    return SampleCodec::Decode(encoded.data(), encoded.size(), decoded) && (decoded == raw);
+}
+
+static void s_check(const vector<char>& raw, bool bAVX2) {
+    SampleCodec::SelectAVX2(false);
+    vector<char> scalar = s_encode(raw);
+    CHECK(scalar.size() <= SampleCodec::MaxEncodedSize(raw.size()));
+    CHECK(s_round_trip(raw, scalar));
+    if (!bAVX2) return;
+    SampleCodec::SelectAVX2(true);
+    vector<char> avx2 = s_encode(raw);
+    CHECK(avx2 == scalar);
+    CHECK(s_round_trip(raw, avx2));
+    SampleCodec::SelectAVX2(false);
+    CHECK(s_round_trip(raw, avx2));
+}
+
+int main() {
+    mt19937 gen(1724);
+    bool bAVX2 = SampleCodec::SelectAVX2(true);
+    if (!bAVX2) printf("codec_test: no AVX2 on this cpu, checking the scalar version only\n");
+
+    // board events as the digitizer sends them, header and control words included
+    for (bool bZLE : {false, true}) {
+        for (int iSegments : {0, 1, 4}) {
+            vector<WORD> words;
+            MakeBoard(words, 0, bZLE, iSegments, 1000, gen);
+            s_check(vector<char>((char*)words.data(), (char*)(words.data() + words.size())), bAVX2);
+        }
+    }
+
+    // noise around the baseline with spikes to full range, at lengths that
+    // leave every possible tail after the last block of 32
+    normal_distribution<double> noise(iBaselineRef, 3);
+    for (unsigned int iHalfWords = 0; iHalfWords < 200; iHalfWords++) {
+        vector<unsigned short> body(iHalfWords);
+        for (auto& v : body) v = (gen() % 50) ? (unsigned short)noise(gen) : (unsigned short)gen();
+        vector<char> raw((char*)body.data(), (char*)(body.data() + body.size()));
+        s_check(raw, bAVX2);
+        raw.push_back(0x5A); // odd byte count
+        s_check(raw, bAVX2);
+    }
+
+    // every width, from a flat block to one that needs all 16 planes
+    for (unsigned int iWidth = 0; iWidth <= 16; iWidth++) {
+        // the zigzagged value 1 << (iWidth-1) is the difference -1 or 1 << (iWidth-2)
+        vector<unsigned short> body(64, iBaselineRef);
+        if (iWidth == 1) body[gen() % 64] = iBaselineRef - 1;
+        else if (iWidth > 1) body[gen() % 64] = iBaselineRef + (1u << (iWidth-2));
+        s_check(vector<char>((char*)body.data(), (char*)(body.data() + body.size())), bAVX2);
+    }
+
+    // several segments back to back decode into one buffer
+    vector<char> a(100, 0x11), b(64, 0x22), encoded;
+    for (auto& raw : {a, b}) {
+        vector<char> part = s_encode(raw);
+        encoded.insert(encoded.end(), part.begin(), part.end());
+    }
+    vector<char> decoded, both(a);
+    both.insert(both.end(), b.begin(), b.end());
+    CHECK(SampleCodec::Decode(encoded.data(), encoded.size(), decoded) && (decoded == both));
+
+    // truncated input is refused, not read past the end
+    vector<char> big(1000);
+    for (auto& c : big) c = gen();
+    vector<char> bad = s_encode(big);
+    for (size_t iCut : {size_t(2), size_t(5), bad.size()/2, bad.size()-1}) {
+        decoded.clear();
+        CHECK(!SampleCodec::Decode(bad.data(), iCut, decoded));
+    }
+    bad[4] = 17; // a width no block can have
+    decoded.clear();
+    CHECK(!SampleCodec::Decode(bad.data(), bad.size(), decoded));
+
+    // so is a length word the rest of the input can't hold, before anything is allocated for it
+    bad = s_encode(big);
+    for (unsigned int iRawBytes : {(unsigned int)(64*bad.size()), 0xFFFFFFFFu}) {
+        memcpy(bad.data(), &iRawBytes, 4);
+        decoded.clear();
+        CHECK(!SampleCodec::Decode(bad.data(), bad.size(), decoded));
+        CHECK(decoded.empty());
+    }
+
+    return TestResult("codec_test");
+}
@@ -0,0 +1,134 @@
+// Checks PollPolicy's backoff and rate cap, and that a board in interrupt
+// mode that can't interrupt is polled adaptively instead.
+#include "PollPolicy.h"
+#include "V1724Emulator.h"
+#include "test.h"
+#include "boost/log/core.hpp"
+
+static const long s_Us = (1000);
+static const long s_Ms = (1000000);
+
+static void s_check_backoff() {
+    PollPolicy poll(10*s_Us, 1*s_Ms);
+    long lNow(0);
+    // empty transfers double the wait up to the maximum
+    for (long lWait : {10, 20, 40, 80, 160, 320, 640, 1000, 1000}) CHECK(poll.Next(0, lNow += s_Ms) == lWait*s_Us);
+    // events mean reading again at once, and the next empty one starts over
+    CHECK(poll.Next(5, lNow += s_Ms) == 0);
+    CHECK(poll.Next(0, lNow += s_Us) == 10*s_Us);
+    CHECK(poll.Next(0, lNow += s_Us) == 20*s_Us);
+    poll.Reset();
+    CHECK(poll.Rate() == 0);
+    CHECK(poll.Next(0, lNow) == 10*s_Us);
+
+    // a maximum below the minimum is raised to it
+    PollPolicy narrow(100*s_Us, 50*s_Us);
+    CHECK(narrow.MaxWaitNs() == 100*s_Us);
+    CHECK(narrow.Next(0, 0) == 100*s_Us);
+    CHECK(narrow.Next(0, 0) == 100*s_Us);
+}
+
+static void s_check_rate_cap() {
+    PollPolicy poll(10*s_Us, 10*s_Ms);
+    long lNow(0);
+    // one event per ms
+    for (int i = 0; i < 20; i++) CHECK(poll.Next(1, lNow += s_Ms) == 0);
+    CHECK(abs(poll.Rate() - 1000) < 1e-6);
+    // within twice the spacing, waits stay under a quarter of it
+    long lLast(lNow);
+    for (long lWait : {10, 20, 40, 80, 160, 250, 250}) CHECK(poll.Next(0, lNow += lWait*s_Us) == lWait*s_Us);
+    CHECK(lNow - lLast < 2*s_Ms);
+    // after that the rate is taken as gone and the backoff goes on to the maximum
+    lNow = lLast + 2*s_Ms;
+    for (long lWait : {1280, 2560, 5120, 10000, 10000}) CHECK(poll.Next(0, lNow += s_Ms) == lWait*s_Us);
+
+    // the newest interval counts for a quarter of the rate
+    CHECK(poll.Next(1, lLast + s_Ms/2) == 0);
+    CHECK(abs(poll.Rate() - 1250) < 1e-6);
+
+    // a cap below the minimum wait is raised to it
+    PollPolicy fast(10*s_Us, 10*s_Ms);
+    lNow = 0;
+    for (int i = 0; i < 20; i++) fast.Next(1, lNow += 20*s_Us); // 50 kHz, a quarter of the spacing is 5 us
+    CHECK(fast.Next(0, lNow + s_Us) == 10*s_Us);
+    CHECK(fast.Next(0, lNow + 2*s_Us) == 10*s_Us);
+}
+
+/* An emulated board that can be told to refuse interrupts, counting what
+ * the readout thread asks of it.
+*/
+class IRQEmulator : public V1724Emulator {
+public:
+    IRQEmulator(const EmulatorSettings_t& ES, bool CanInterrupt) : V1724Emulator(ES), m_bCanInterrupt(CanInterrupt) {}
+    atomic<int> m_aiEnables{0};
+    atomic<int> m_aiWaits{0};
+
+protected:
+    bool EnableInterrupts(unsigned int NumEvents) {
+        m_aiEnables++;
+        return m_bCanInterrupt && V1724Emulator::EnableInterrupts(NumEvents);
+    }
+    bool WaitForInterrupt(long lTimeoutNs) {
+        m_aiWaits++;
+        return V1724Emulator::WaitForInterrupt(lTimeoutNs);
+    }
+
+private:
+    bool m_bCanInterrupt;
+};
+
+// reads an emulated board at 1 kHz for a while in interrupt mode, returns the events that came
+static long s_read_interrupt_mode(IRQEmulator& board) {
+    ConfigSettings_t CS{};
+    WaitPoint DataReady;
+    BlockRef block;
+    long lEvents(0);
+    CS.RecordLength = 1024;
+    CS.PostTrigger = 60;
+    CS.EnableMask = 0xFF;
+    CS.BlockTransfer = 64;
+    CS.IsZLE = true;
+    board.ProgramDigitizer(CS);
+    board.AllocateBlocks(4);
+    board.SetPolling(PollPolicy::interrupt, PollPolicy::s_DefaultMinWaitNs, PollPolicy::s_DefaultMaxWaitNs, 16);
+    board.StartAcquisition();
+    board.StartReadout(&DataReady);
+    auto tEnd = chrono::steady_clock::now() + chrono::milliseconds(300);
+    while (chrono::steady_clock::now() < tEnd) {
+        int iEpoch = DataReady.Prepare();
+        if (!board.PopBlock(block)) {
+            DataReady.Wait(iEpoch, s_Ms);
+            continue;
+        }
+        DataReady.Cancel();
+        lEvents += block->NumEvents;
+        block.Reset();
+    }
+    board.StopReadout();
+    board.StopAcquisition();
+    CHECK(!board.HasFailed());
+    return lEvents;
+}
+
+static void s_check_interrupt_fallback() {
+    IRQEmulator refuses(EmulatorSettings_t{0, 1000., 0.05, 0}, false);
+    long lEvents = s_read_interrupt_mode(refuses);
+    CHECK(refuses.m_aiEnables == 1);
+    CHECK(refuses.m_aiWaits == 0);
+    CHECK(lEvents > 200); // about 300, read by polling
+
+    // the same board that can interrupt waits for it
+    IRQEmulator interrupts(EmulatorSettings_t{0, 1000., 0.05, 0}, true);
+    lEvents = s_read_interrupt_mode(interrupts);
+    CHECK(interrupts.m_aiEnables == 1);
+    CHECK(interrupts.m_aiWaits > 0);
+    CHECK(lEvents > 200);
+}
+
+int main() {
+    logging::core::get()->set_logging_enabled(false); // the fallback warns, as it should
+    s_check_backoff();
+    s_check_rate_cap();
+    s_check_interrupt_fallback();
+    return TestResult("poll_test");
+}
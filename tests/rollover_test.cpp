@@ -0,0 +1,194 @@
+// Takes data from an emulated board through several run rollovers, then
+// checks that every run's index, files and pax_info.json agree and that no
+// event went missing or was written twice around the rollovers: every built
+// event is in some run, and the board's triggers go on from one run to the
+// next without a gap.
+#include "DAQ.h"
+#include "EventIndex.h"
+#include "test.h"
+#include "boost/log/core.hpp"
+#include "boost/log/expressions.hpp"
+#include <bsoncxx/json.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const int s_Runs = (4);
+static const int s_EventsPerRun = (2000);
+static const int s_EventsPerFile = (700);
+static const long s_NsPerTriggerClock = (20);
+static const long s_TriggerClocks = (10000); // between the emulator's triggers at 5 kHz
+
+static void s_write_config(const fs::path& dir) {
+    ofstream config(dir / "config.json");
+    config << "{\n"
+           << "    \"digitizers\" : [{\"backend\" : \"emulator\", \"trigger_rate\" : 5000.0, \"zle_occupancy\" : 0.05}],\n"
+           << "    \"record_length\" : {\"value\" : 1024},\n"
+           << "    \"external_trigger\" : {\"value\" : \"acquisition_only\"},\n"
+           << "    \"block_transfer\" : {\"value\" : 64},\n"
+           << "    \"post_trigger\" : {\"value\" : 60},\n"
+           << "    \"fpio_level\" : {\"value\" : \"nim\"},\n"
+           << "    \"events_per_file\" : {\"value\" : " << s_EventsPerFile << "},\n"
+           << "    \"max_events_per_run\" : {\"value\" : " << s_EventsPerRun << "},\n"
+           << "    \"is_zle\" : {\"value\" : \"yes\"},\n"
+           << "    \"channel_trigger\" : {\"value\" : \"acquisition_only\"},\n"
+           << "    \"raw_data_dir\" : {\"value\" : \"" << (dir / "data").string() << "/\"},\n"
+           << "    \"control_socket\" : {\"value\" : \"" << (dir / "control").string() << "\"},\n"
+           << "    \"decode_threads\" : {\"value\" : 2},\n"
+           << "    \"registers\" : []\n"
+           << "}\n";
+    fs::copy_file("config/pmt_config.json", dir / "pmt_config.json");
+}
+
+// one command through the control socket, as a client would send it
+static string s_command(const fs::path& socket_path, const string& line) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    for (int i = 0; (i < 100) && (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0); i++) usleep(50000);
+    string reply, sent(line + "\n");
+    char c;
+    if (write(fd, sent.data(), sent.size()) == (ssize_t)sent.size())
+        while ((read(fd, &c, 1) == 1) && (c != '\n')) reply += c;
+    close(fd);
+    return reply;
+}
+
+static int s_count_runs(const fs::path& data) {
+    int iRuns(0);
+    for (auto& entry : fs::directory_iterator(data)) iRuns += fs::exists(entry.path() / "pax_info.json");
+    return iRuns;
+}
+
+static string s_read(const fs::path& file) {
+    ifstream fin(file, ios::binary);
+    return string(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+}
+
+static long s_get_integer(const bsoncxx::document::element& el) {
+    // json numbers come back as int32 when they fit
+    if (el.type() == bsoncxx::type::k_int64) return el.get_int64().value;
+    return el.get_int32().value;
+}
+
+struct RunCheck {
+    string name;
+    long start, end;
+    long events;
+    long first_trigger, last_trigger; // board clock ticks
+};
+
+// everything about one run that can be checked on its own; returns what the run order needs
+static RunCheck s_check_run(const fs::path& dir) {
+    const string name = dir.filename().string();
+    auto pax_doc = bsoncxx::from_json(s_read(dir / "pax_info.json"));
+    auto pax = pax_doc.view();
+    RunCheck run{name, s_get_integer(pax["start_time_ns"]), s_get_integer(pax["end_time_ns"]), s_get_integer(pax["events"]),
+                 s_get_integer(pax["first_trigger_clock"]), -1};
+    CHECK(pax["run_name"].get_utf8().value.to_string() == name);
+    CHECK(s_get_integer(pax["index"]["records"]) == run.events);
+    CHECK(run.events > 0);
+
+    string index = s_read(dir / (name + ".idx"));
+    CHECK((long)index.size() == run.events*(long)sizeof(IndexRecord));
+    vector<IndexRecord> records(index.size() / sizeof(IndexRecord));
+    memcpy(records.data(), index.data(), records.size()*sizeof(IndexRecord));
+
+    // the files the header lists cover the events in order
+    long lNextFile(0), lNextEvent(0), lFileEvents(0);
+    map<long, string> files;
+    for (auto f : pax["file_info"].get_array().value) {
+        CHECK(s_get_integer(f["file_number"]) == lNextFile++);
+        CHECK(s_get_integer(f["first_event"]) == lNextEvent);
+        CHECK(s_get_integer(f["last_event"]) - s_get_integer(f["first_event"]) + 1 == s_get_integer(f["n_events"]));
+        lNextEvent = s_get_integer(f["last_event"]) + 1;
+        lFileEvents += s_get_integer(f["n_events"]);
+        char sFile[256];
+        snprintf(sFile, sizeof(sFile), "%s_%06li.ast", name.c_str(), s_get_integer(f["file_number"]));
+        files[s_get_integer(f["file_number"])] = s_read(dir / sFile);
+    }
+    CHECK(lFileEvents == run.events);
+    CHECK(lNextFile == (run.events + s_EventsPerFile - 1)/s_EventsPerFile);
+
+    // event numbers start at 0 with the run's start time and have no gaps or repeats,
+    // the triggers behind them have none either, and every record points at the header it describes
+    uint64_t lPrevTimestamp(0);
+    long lTrigger(0);
+    WORD header[5];
+    CHECK(run.first_trigger >= 0);
+    for (size_t i = 0; i < records.size(); i++) {
+        const IndexRecord& r = records[i];
+        CHECK(r.event_number == i);
+        CHECK(r.block == EventIndex::s_NoBlock);
+        if (i == 0) CHECK((long)r.timestamp == run.start);
+        else CHECK(r.timestamp > lPrevTimestamp);
+        lPrevTimestamp = r.timestamp;
+        // timestamps count from the run's first trigger
+        lTrigger = run.first_trigger + (long)(r.timestamp - run.start)/s_NsPerTriggerClock;
+        if (i > 0) CHECK(lTrigger == run.last_trigger + s_TriggerClocks);
+        run.last_trigger = lTrigger;
+        if (!files.count(r.file_number) || (r.offset + sizeof(header) > files[r.file_number].size())) {
+            CHECK(!"record points past its file");
+            continue;
+        }
+        memcpy(header, files[r.file_number].data() + r.offset, sizeof(header));
+        CHECK((header[0] & 0x3FFFFFFF) == r.event_number);
+        CHECK(header[1] == r.channel_mask);
+        CHECK((header[2] & 0xFFFFFFF) == r.size);
+        CHECK((((uint64_t)header[3] << 32) | header[4]) == r.timestamp);
+    }
+    return run;
+}
+
+int main() {
+    char sTemplate[] = "/tmp/obelix_rollover_XXXXXX";
+    if (!mkdtemp(sTemplate)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const fs::path dir(sTemplate);
+    long lBuilt(0), lWritten(0);
+    fs::create_directory(dir / "data");
+    s_write_config(dir);
+    logging::core::get()->set_filter(logging::trivial::severity >= logging::trivial::warning);
+
+    {
+        DAQ daq(8192);
+        daq.Setup((dir / "config.json").string());
+        thread readout([&]{daq.Readout(false);});
+        CHECK(s_command(dir / "control", "testrun yes") == "ok");
+        CHECK(s_command(dir / "control", "write yes") == "ok");
+        // a run's summary is written once the next run has its first event
+        auto tGiveUp = chrono::steady_clock::now() + chrono::seconds(30);
+        while ((s_count_runs(dir / "data") < s_Runs - 1) && (chrono::steady_clock::now() < tGiveUp)) this_thread::sleep_for(chrono::milliseconds(100));
+        // once stopped, everything built is on disk
+        CHECK(s_command(dir / "control", "stop") == "ok");
+        auto status_doc = bsoncxx::from_json(s_command(dir / "control", "status"));
+        lBuilt = s_get_integer(status_doc.view()["events_built"]);
+        CHECK(s_command(dir / "control", "quit") == "ok");
+        readout.join();
+    }
+
+    vector<RunCheck> runs;
+    for (auto& entry : fs::directory_iterator(dir / "data")) runs.push_back(s_check_run(entry.path()));
+    sort(runs.begin(), runs.end(), [](const RunCheck& a, const RunCheck& b){return a.start < b.start;});
+    CHECK((int)runs.size() >= s_Runs);
+    // each run ends where the next one starts, and all but the last are full;
+    // the next run's first event is the board's next trigger after the last one of this run
+    for (size_t i = 0; i + 1 < runs.size(); i++) {
+        CHECK(runs[i].end == runs[i+1].start);
+        CHECK(runs[i].events >= s_EventsPerRun);
+        CHECK(runs[i+1].first_trigger == runs[i].last_trigger + s_TriggerClocks);
+    }
+    for (auto& run : runs) lWritten += run.events;
+    CHECK(lBuilt > 0);
+    CHECK(lWritten == lBuilt);
+    if (s_Failures == 0) fs::remove_all(dir);
+    else fprintf(stderr, "rollover_test: data left in %s\n", dir.c_str());
+    return TestResult("rollover_test");
+}
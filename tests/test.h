@@ -0,0 +1,22 @@
+#ifndef _TEST_H_
+#define _TEST_H_ 1
+
+// Shared by the tests: a CHECK that reports and counts failures instead of
+// stopping, and the exit status for main.
+#include <cstdio>
+
+static int s_Failures(0);
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        s_Failures++; \
+    } \
+} while (0)
+
+static int TestResult(const char* name) {
+    printf("%s: %s\n", name, s_Failures ? "FAILED" : "ok");
+    return s_Failures ? 1 : 0;
+}
+
+#endif // _TEST_H_ defined